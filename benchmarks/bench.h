@@ -0,0 +1,87 @@
+/*
+ * Minbif - IRC instant messaging gateway
+ * Copyright(C) 2011 Romain Bignon
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <stdint.h>
+
+/** Minimal micro-benchmark runner.
+ *
+ * A benchmark is a function called in loop until it has run for at
+ * least \a min_time seconds. The mean time per call is displayed,
+ * and the throughput if the number of processed bytes is given.
+ */
+class Benchmark
+{
+public:
+	typedef void (*func_t)(void* data);
+
+	static double now()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ts.tv_sec + ts.tv_nsec / 1e9;
+	}
+
+	static void header(const char* title)
+	{
+		printf("\n%s\n", title);
+		printf("%-40s %12s %12s %12s\n", "benchmark", "iterations", "ns/op", "MB/s");
+	}
+
+	/** Run a benchmark.
+	 *
+	 * @param name  name displayed
+	 * @param func  function to bench
+	 * @param data  argument given to \a func
+	 * @param bytes  number of bytes processed by one call (0 if it doesn't make sense)
+	 * @param min_time  minimal duration of the benchmark, in seconds
+	 * @return  mean time of one call, in nanoseconds.
+	 */
+	static double run(const char* name, func_t func, void* data, size_t bytes = 0, double min_time = 0.5)
+	{
+		uint64_t iterations = 0, batch = 1;
+		double start = now(), elapsed = 0;
+
+		/* Warm up */
+		func(data);
+
+		while(elapsed < min_time)
+		{
+			for(uint64_t i = 0; i < batch; ++i)
+				func(data);
+			iterations += batch;
+			batch *= 2;
+			elapsed = now() - start;
+		}
+
+		double ns = elapsed * 1e9 / iterations;
+		if(bytes)
+			printf("%-40s %12llu %12.1f %12.1f\n", name, (unsigned long long)iterations, ns,
+			       bytes * iterations / elapsed / (1024 * 1024));
+		else
+			printf("%-40s %12llu %12.1f %12s\n", name, (unsigned long long)iterations, ns, "-");
+		return ns;
+	}
+};
+
+#endif /* BENCH_H */
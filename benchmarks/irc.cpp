@@ -0,0 +1,209 @@
+/*
+ * Minbif - IRC instant messaging gateway
+ * Copyright(C) 2011 Romain Bignon
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+
+#include "bench.h"
+#include "core/minbif.h"
+#include "core/config.h"
+#include "core/util.h"
+#include "sockwrap/sockwrap_plain.h"
+#include "irc/irc.h"
+#include "irc/message.h"
+#include "irc/nick.h"
+#include "irc/status_channel.h"
+
+using std::vector;
+using namespace irc;
+
+/* Lines as they are received from the IRC user. */
+static const char* parse_corpus[][2] = {
+	{ "ping",     "PING :im.symlink.me" },
+	{ "privmsg",  "PRIVMSG romain:jabber0 :hey, are you coming tonight? we are meeting at 8pm" },
+	{ "prefixed", ":minbif!minbif@localhost.localdomain PRIVMSG #minbif :hello world, how are you?" },
+	{ "map add",  "MAP add jabber romain@jabber.org secretpassword -server talk.google.com -port 5223 &minbif" },
+	{ "mode",     "MODE &minbif +vvvv buddy1 buddy2 buddy3 buddy4" },
+};
+
+static void bench_parse(void* data)
+{
+	Message::parse(static_cast<const char*>(data));
+}
+
+static void bench_format(void* data)
+{
+	static_cast<Message*>(data)->format();
+}
+
+struct nickize_case
+{
+	vector<string> names;
+	size_t next;
+};
+
+static void bench_nickize(void* data)
+{
+	nickize_case* c = static_cast<nickize_case*>(data);
+	Nick::nickize(c->names[c->next++ % c->names.size()]);
+}
+
+struct lookup_case
+{
+	IRC* irc;
+	Channel* chan;
+	string nick;
+};
+
+static void bench_get_chan_user(void* data)
+{
+	lookup_case* c = static_cast<lookup_case*>(data);
+	c->chan->getChanUser(c->nick);
+}
+
+static void bench_get_nick(void* data)
+{
+	lookup_case* c = static_cast<lookup_case*>(data);
+	c->irc->getNick(c->nick);
+}
+
+static void bench_get_nick_case_sensitive(void* data)
+{
+	lookup_case* c = static_cast<lookup_case*>(data);
+	c->irc->getNick(c->nick, true);
+}
+
+/* Zero padded, so the last one is also the last one of the sorted
+ * containers. */
+static string buddy_name(int i)
+{
+	char name[16];
+	snprintf(name, sizeof name, "Buddy%04d", i);
+	return name;
+}
+
+/** Load a minimal configuration from a temporary file. */
+static void load_config()
+{
+	char path[] = "/tmp/minbif-bench-XXXXXX";
+	int fd = mkstemp(path);
+	if(fd < 0)
+	{
+		perror("mkstemp");
+		exit(EXIT_FAILURE);
+	}
+
+	const char* config = "path {\n  users = /tmp\n  motd = /dev/null\n}\n"
+	                     "irc {\n  type = 0\n}\n"
+	                     "logging {\n  level = ERR\n  to_syslog = false\n}\n";
+	bool loaded = write(fd, config, strlen(config)) == (ssize_t)strlen(config) && conf.Load(path);
+	close(fd);
+	unlink(path);
+	if(!loaded)
+	{
+		fprintf(stderr, "Unable to load configuration\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/** Build an IRC server without any client, with a status channel of
+ * \a count buddies. */
+static IRC* build_irc(Channel** chan, int count)
+{
+	sock::SockWrapper* sockw = new sock::SockWrapperPlain(conf.GetSection("irc"),
+	                                                      open("/dev/null", O_RDONLY),
+	                                                      open("/dev/null", O_WRONLY));
+	IRC* irc = new IRC(NULL, sockw, "bench.minbif.im", 0);
+
+	*chan = new StatusChannel(irc, "&minbif");
+	irc->addChannel(*chan);
+	for(int i = 0; i < count; ++i)
+	{
+		Nick* n = new Nick(irc, buddy_name(i), "buddy", "jabber.org", "Buddy number " + t2s(i));
+		irc->addNick(n);
+		n->join(*chan);
+	}
+	return irc;
+}
+
+int main()
+{
+	char name[64];
+
+	/* Declares the configuration items. */
+	Minbif minbif;
+	load_config();
+
+	Benchmark::header("Message::parse");
+	for(size_t i = 0; i < sizeof parse_corpus / sizeof *parse_corpus; ++i)
+	{
+		snprintf(name, sizeof name, "parse/%s", parse_corpus[i][0]);
+		Benchmark::run(name, bench_parse, (void*)parse_corpus[i][1], strlen(parse_corpus[i][1]));
+	}
+
+	Benchmark::header("Message::format");
+	for(size_t i = 0; i < sizeof parse_corpus / sizeof *parse_corpus; ++i)
+	{
+		Message m = Message::parse(parse_corpus[i][1]);
+		snprintf(name, sizeof name, "format/%s", parse_corpus[i][0]);
+		Benchmark::run(name, bench_format, &m, strlen(parse_corpus[i][1]));
+	}
+
+	/* Aliases of buddies, as given by protocols. More names than the
+	 * cache size are used to measure misses. */
+	static const char* aliases[] = {
+		"Romain Bignon", "Jérôme Müller-Lüdenscheidt", "Zoë O'Brien",
+		"李小龍", "Ελένη Παπαδοπούλου", "alice@jabber.org", "[AFK] bob (work)",
+	};
+	nickize_case hits, misses;
+	hits.next = misses.next = 0;
+	for(size_t i = 0; i < sizeof aliases / sizeof *aliases; ++i)
+		hits.names.push_back(aliases[i]);
+	for(size_t i = 0; i < 4096; ++i)
+		misses.names.push_back(string(aliases[i % (sizeof aliases / sizeof *aliases)]) + " " + t2s(i));
+
+	Benchmark::header("Nick::nickize");
+	Benchmark::run("nickize/cached", bench_nickize, &hits);
+	Benchmark::run("nickize/uncached", bench_nickize, &misses);
+
+	static const int sizes[] = { 50, 500 };
+	for(size_t i = 0; i < sizeof sizes / sizeof *sizes; ++i)
+	{
+		lookup_case c;
+		c.irc = build_irc(&c.chan, sizes[i]);
+
+		snprintf(name, sizeof name, "lookups with %d buddies", sizes[i]);
+		Benchmark::header(name);
+
+		/* Users are searched with the case they typed. */
+		c.nick = strlower(buddy_name(sizes[i] - 1));
+		Benchmark::run("Channel::getChanUser/last", bench_get_chan_user, &c);
+		Benchmark::run("IRC::getNick/last", bench_get_nick, &c);
+		c.nick = buddy_name(sizes[i] - 1);
+		Benchmark::run("IRC::getNick/last, case sensitive", bench_get_nick_case_sensitive, &c);
+		c.nick = "nobody";
+		Benchmark::run("Channel::getChanUser/missing", bench_get_chan_user, &c);
+		Benchmark::run("IRC::getNick/missing", bench_get_nick, &c);
+
+		delete c.irc;
+	}
+
+	return 0;
+}
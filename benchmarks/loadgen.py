@@ -0,0 +1,381 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+"""
+Minbif - IRC instant messaging gateway
+Copyright(C) 2011 Romain Bignon
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+"""
+
+# Load generator.
+#
+# Run a daemon fork minbif on localhost, with K IRC users each having an
+# account on the loopback protocol plugin (plugins/loopback), which
+# simulates buddies, rooms, presence changes and received messages
+# without any network. Every user also sends probes to a buddy, which
+# are echoed back.
+#
+# Reported for each user:
+#   login   time from TCP connect to account connected
+#   roster  time from TCP connect to every buddy joined on &minbif
+#   msgs/s  flood messages and echoed probes received per second
+#   p50/p99 latency of these messages, from plugin (or driver) to IRC
+#   rss     resident memory of the user process, from the stats socket
+#
+# It needs minbif to be built with ENABLE_PLUGIN, and nothing else: it
+# can be run offline, for example by "make bench_load".
+
+from __future__ import print_function
+import sys
+import os
+import re
+import errno
+import json
+import shutil
+import signal
+import socket
+import tempfile
+from optparse import OptionParser
+from select import select
+from subprocess import Popen, STDOUT
+from time import sleep, time
+
+BUILD_PATH = os.path.normpath(os.path.join(os.path.dirname(__file__), '..', 'build'))
+PASSWORD = 'benchmark'
+
+def now_us():
+    return int(time() * 1000000)
+
+def percentile(values, p):
+    if not values:
+        return 0
+    values = sorted(values)
+    return values[int(round(p / 100.0 * (len(values) - 1)))]
+
+class Client:
+    """ One IRC user, driven by the main loop of Driver. """
+
+    def __init__(self, driver, nickname):
+        self.driver = driver
+        self.nickname = nickname
+        self.sock = None
+        self.buf = b''
+        self.closed = False
+        self.start = 0
+        self.welcome = False
+        self.login = None
+        self.roster = None
+        self.buddies = set()
+        self.latencies = []
+        self.received = 0
+        self.next_probe = 0
+
+    def connect(self):
+        self.sock = socket.create_connection(('127.0.0.1', self.driver.port))
+        self.start = time()
+        self.write('USER %s * * :Benchmark' % self.nickname)
+        self.write('PASS %s' % PASSWORD)
+        self.write('NICK %s' % self.nickname)
+
+    def close(self):
+        if self.sock:
+            self.sock.close()
+        self.sock = None
+        self.closed = True
+
+    def fileno(self):
+        return self.sock.fileno()
+
+    def write(self, line):
+        self.sock.sendall((line + '\r\n').encode('utf-8'))
+
+    def read(self):
+        try:
+            data = self.sock.recv(65536)
+        except socket.error as e:
+            if e.args[0] in (errno.EINTR, errno.EAGAIN):
+                return
+            data = b''
+        if not data:
+            self.close()
+            return
+
+        self.buf += data
+        lines = self.buf.split(b'\n')
+        self.buf = lines.pop()
+        for line in lines:
+            self.parse(line.rstrip(b'\r').decode('utf-8', 'replace'))
+
+    def parse(self, line):
+        if line.startswith('PING '):
+            self.write('PONG %s' % line[5:])
+            return
+
+        args = line.split(' ', 3)
+        if len(args) < 3 or not args[0].startswith(':'):
+            return
+        sender = args[0][1:].split('!')[0]
+        cmd = args[1]
+        text = args[3][1:] if len(args) > 3 and args[3].startswith(':') else ''
+
+        if cmd == '001':
+            self.welcome = True
+        elif cmd == 'PRIVMSG':
+            words = text.split()
+            if len(words) >= 2 and words[0] in ('flood', 'probe'):
+                self.received += 1
+                self.latencies.append(now_us() - int(words[-1]))
+        elif cmd == 'NOTICE':
+            if self.login is None and re.search('Connection to [^ ]+ established!', text):
+                self.login = time() - self.start
+        elif cmd == 'JOIN':
+            if self.roster is None and sender.startswith('buddy'):
+                self.buddies.add(sender)
+                if len(self.buddies) >= self.driver.options.buddies:
+                    self.roster = time() - self.start
+
+    def probe(self, t):
+        if not self.login or not self.driver.options.probes or not self.driver.options.buddies:
+            return
+        if t < self.next_probe:
+            return
+        self.next_probe = t + 1.0 / self.driver.options.probes
+        self.write('PRIVMSG buddy0000 :probe %d' % now_us())
+
+    def reset(self):
+        """ Forget messages received while connecting. """
+        self.latencies = []
+        self.received = 0
+
+class Driver:
+    def __init__(self, options):
+        self.options = options
+        self.path = tempfile.mkdtemp(prefix='minbif-bench-')
+        self.port = self.free_port()
+        self.process = None
+        self.clients = []
+
+    def free_port(self):
+        s = socket.socket()
+        s.bind(('127.0.0.1', 0))
+        port = s.getsockname()[1]
+        s.close()
+        return port
+
+    def write_config(self):
+        config = """path {
+    users = %(path)s/users
+}
+irc {
+    hostname = bench.minbif.im
+    type = 2
+    ping = 0
+    daemon {
+        bind = 127.0.0.1
+        port = %(port)d
+        background = false
+        stats_socket = %(path)s/stats.sock
+    }
+}
+aaa {
+    password_iterations = 1000
+}
+logging {
+    level = WARNING ERR INFO
+    to_syslog = false
+}
+""" % {'path': self.path, 'port': self.port}
+
+        filename = os.path.join(self.path, 'minbif.conf')
+        with open(filename, 'w') as f:
+            f.write(config)
+        return filename
+
+    def start(self):
+        os.mkdir(os.path.join(self.path, 'users'))
+        self.log = open(os.path.join(self.path, 'minbif.log'), 'w')
+        env = dict(os.environ)
+        env['MINBIF_PLUGIN_PATH'] = os.path.dirname(os.path.abspath(self.options.plugin))
+        self.process = Popen((self.options.minbif, self.write_config()),
+                             stdout=self.log, stderr=STDOUT, env=env)
+
+        for i in range(100):
+            try:
+                socket.create_connection(('127.0.0.1', self.port)).close()
+                return
+            except socket.error:
+                if self.process.poll() is not None:
+                    break
+                sleep(0.1)
+        raise Exception('minbif did not start (use --keep to read its logs)')
+
+    def stop(self):
+        for client in self.clients:
+            client.close()
+        if self.process and self.process.poll() is None:
+            self.process.send_signal(signal.SIGTERM)
+            self.process.wait()
+        if not self.options.keep:
+            shutil.rmtree(self.path, True)
+        else:
+            print('Files kept in %s' % self.path)
+
+    def run_until(self, clients, cond, timeout):
+        end = time() + timeout
+        while time() < end and not cond():
+            alive = [c for c in clients if not c.closed]
+            if not alive:
+                return
+            for client in select(alive, [], [], 0.05)[0]:
+                client.read()
+            t = time()
+            for client in alive:
+                if not client.closed:
+                    client.probe(t)
+
+    def setup_user(self, nickname):
+        """ Create the user, and add the loopback account. """
+        o = self.options
+        client = Client(self, nickname)
+        client.connect()
+        self.run_until([client], lambda: client.welcome, 10)
+        client.write('QUIT')
+        self.run_until([client], lambda: client.closed, 10)
+
+        client = Client(self, nickname)
+        client.connect()
+        client.write('MAP add loopback %s %s -buddies %d -chats %d -members %d '
+                     '-churn %d -flood %d -seed %d &minbif' %
+                     (nickname, PASSWORD, o.buddies, o.chats, o.members, o.churn, o.flood,
+                      len(self.clients)))
+        self.run_until([client], lambda: client.login is not None, 10)
+        client.write('QUIT')
+        self.run_until([client], lambda: client.closed, 10)
+
+        if not client.welcome or client.login is None:
+            raise Exception('unable to add the loopback account of %s' % nickname)
+
+    def read_stats(self, timeout):
+        """ Children report their resources every 10 seconds. """
+        rss = {}
+        end = time() + timeout
+        while time() < end:
+            s = socket.socket(socket.AF_UNIX)
+            try:
+                s.connect(os.path.join(self.path, 'stats.sock'))
+                data = b''
+                while True:
+                    chunk = s.recv(65536)
+                    if not chunk:
+                        break
+                    data += chunk
+            finally:
+                s.close()
+
+            for line in data.decode('utf-8', 'replace').splitlines():
+                m = re.match(r'(\S+)\s+pid\s+\d+\s+rss\s+(\d+) KiB', line)
+                if m:
+                    rss[m.group(1)] = int(m.group(2))
+            if all(c.nickname in rss for c in self.clients):
+                break
+            sleep(1)
+        return rss
+
+    def run(self):
+        o = self.options
+        self.start()
+
+        nicknames = ['bench%d' % i for i in range(o.clients)]
+        for nickname in nicknames:
+            self.setup_user(nickname)
+            self.clients.append(Client(self, nickname))
+
+        for client in self.clients:
+            client.connect()
+        self.run_until(self.clients, lambda: all(c.login is not None and
+                                                 (c.roster is not None or not o.buddies)
+                                                 for c in self.clients), o.timeout)
+
+        for client in self.clients:
+            client.reset()
+        start = time()
+        self.run_until(self.clients, lambda: False, o.duration)
+        duration = time() - start
+
+        rss = self.read_stats(12)
+
+        results = []
+        for c in self.clients:
+            results.append({'user':     c.nickname,
+                            'login':    c.login,
+                            'roster':   c.roster,
+                            'messages': c.received,
+                            'rate':     c.received / duration,
+                            'p50':      percentile(c.latencies, 50),
+                            'p99':      percentile(c.latencies, 99),
+                            'rss':      rss.get(c.nickname),
+                           })
+        return results
+
+def format_seconds(s):
+    return '%8.1fms' % (s * 1000) if s is not None else '%10s' % 'timeout'
+
+def display(results):
+    print('%-10s %10s %10s %10s %10s %10s %10s %10s' % ('user', 'login', 'roster', 'messages',
+                                                        'msgs/s', 'p50', 'p99', 'rss'))
+    for r in results:
+        print('%-10s %10s %10s %10d %10.1f %8.1fms %8.1fms %10s' %
+              (r['user'], format_seconds(r['login']), format_seconds(r['roster']),
+               r['messages'], r['rate'], r['p50'] / 1000.0, r['p99'] / 1000.0,
+               '%dKiB' % r['rss'] if r['rss'] is not None else '-'))
+
+def main():
+    parser = OptionParser(usage='%prog [options]')
+    parser.add_option('--minbif', default=os.path.join(BUILD_PATH, 'src', 'minbif'),
+                      help='minbif binary [default: %default]')
+    parser.add_option('--plugin', default=os.path.join(BUILD_PATH, 'plugins', 'loopback', 'libloopback.so'),
+                      help='loopback plugin [default: %default]')
+    parser.add_option('-k', '--clients', type='int', default=4, help='IRC users [default: %default]')
+    parser.add_option('-n', '--buddies', type='int', default=50, help='buddies per user [default: %default]')
+    parser.add_option('-c', '--chats', type='int', default=1, help='rooms per user [default: %default]')
+    parser.add_option('-m', '--members', type='int', default=20, help='members per room [default: %default]')
+    parser.add_option('--churn', type='int', default=5, help='presence changes per second [default: %default]')
+    parser.add_option('--flood', type='int', default=20, help='received messages per second [default: %default]')
+    parser.add_option('--probes', type='int', default=5, help='echoed messages sent per second [default: %default]')
+    parser.add_option('-d', '--duration', type='float', default=30, help='seconds of measure [default: %default]')
+    parser.add_option('--timeout', type='float', default=60, help='maximum seconds to log in [default: %default]')
+    parser.add_option('--json', action='store_true', help='display results as JSON')
+    parser.add_option('--keep', action='store_true', help='keep configuration and logs')
+    options, args = parser.parse_args()
+
+    driver = Driver(options)
+    try:
+        results = driver.run()
+    except Exception as e:
+        print('Error: %s' % e, file=sys.stderr)
+        return 1
+    finally:
+        driver.stop()
+
+    if options.json:
+        print(json.dumps(results, indent=2))
+    else:
+        display(results)
+
+    # Useful in CI: fail if a user was not able to log in.
+    return 0 if all(r['login'] is not None for r in results) else 1
+
+if __name__ == '__main__':
+    sys.exit(main())
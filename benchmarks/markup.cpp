@@ -0,0 +1,134 @@
+/*
+ * Minbif - IRC instant messaging gateway
+ * Copyright(C) 2011 Romain Bignon
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <cstdlib>
+
+#include "bench.h"
+#include "core/util.h"
+
+/* Messages as they are received from libpurple. */
+static const char* markup_corpus[][2] = {
+	{ "plain text",
+	  "hey, are you coming tonight? we are meeting at 8pm at the usual place" },
+	{ "xmpp xhtml-im",
+	  "<body xmlns='http://www.w3.org/1999/xhtml'><p><span style='font-weight: bold;'>Build #4521</span> "
+	  "failed on <a href='http://ci.example.org/job/minbif/4521/'>http://ci.example.org/job/minbif/4521/</a>"
+	  "</p><p>Culprit: <em>romain</em> &lt;romain@example.org&gt;</p></body>" },
+	{ "pidgin font",
+	  "<FONT COLOR=\"red\" BACK=\"black\">alert</FONT> <B>disk</B> is <I>almost</I> full &amp; "
+	  "<U>backups</U> are late<BR>please check <FONT FACE=\"Arial\" COLOR=\"light blue\">now</FONT>" },
+	{ "multiline",
+	  "first line of a pasted log\n"
+	  "2011-12-04 12:00:01 INFO started\n"
+	  "2011-12-04 12:00:02 WARN &quot;cache&quot; is cold\n"
+	  "2011-12-04 12:00:03 INFO done" },
+	{ "entities",
+	  "caf&#233; cr&#xe8;me &amp; cr&#232;me br&#251;l&#233;e &lt;3 &nbsp; &copy; 2011 &apos;quoted&apos;" },
+};
+
+/* Messages as they are sent by the IRC user. */
+static const char* irc_corpus[][2] = {
+	{ "plain text",
+	  "ok, I'll be there in 10 minutes, wait for me at the entrance please" },
+	{ "escaped chars",
+	  "if (a < b && c > d) { puts(\"it's \\\"fine\\\"\"); }" },
+	{ "irc formatting",
+	  "\002important:\002 \00304,01red alert\003 on \037prod\037, \00312see\017 the logs" },
+};
+
+/* Expected conversions, checked before benchmarks as the benchmarked
+ * code has to be correct first. */
+static const char* markup_checks[][2] = {
+	/* entities */
+	{ "a &amp; b &lt;c&gt; &quot;d&quot;",     "a & b <c> \"d\"" },
+	{ "it&apos;s",                              "it's" },
+	{ "caf&#233; cr&#xE8;me",                   "caf\303\251 cr\303\250me" },
+	{ "&foo; & bar",                            "&foo; & bar" },
+	/* numeric entities which would give invalid UTF-8 */
+	{ "&#0;",                                   "&#0;" },
+	{ "&#xD800;",                               "&#xD800;" },
+	{ "&#x110000;",                             "&#x110000;" },
+	{ "&#xFFFFFFFF;",                           "&#xFFFFFFFF;" },
+	/* tags */
+	{ "<b>bold <i>both</i></b> <u>u</u>",       "\002bold \037\002both\037\002\002 \037u\037" },
+	{ "<font color=\"red\">alert</font>",       "\00304alert\003" },
+	{ "<span style=\"x\">plain</span>",         "plain" },
+	{ "if a < b",                               "if a < b" },
+	{ "x<script>alert(\"<b>\")</script>y",      "xy" },
+	/* new lines */
+	{ "a<br>b<BR/>c",                           "a\nb\nc" },
+	{ "<p>one</p><p>two</p>",                   "one\ntwo" },
+	{ "<table><tr><td>a</td><td>b</td></tr></table>", "a\tb\n" },
+	/* links */
+	{ "<a href=\"http://minbif.im/\">the site</a>", "the site (http://minbif.im/)" },
+	{ "<a href=\"http://minbif.im/\">http://minbif.im/</a>", "http://minbif.im/" },
+	{ "<a href=\"http://minbif.im\">minbif.im</a>", "minbif.im" },
+	{ "<a href=\"http://a.org/?x=1&amp;y=2\">query</a>", "query (http://a.org/?x=1&y=2)" },
+};
+
+/** @return  number of failed checks. */
+static int check_markup2irc()
+{
+	int failures = 0;
+	for(size_t i = 0; i < sizeof markup_checks / sizeof *markup_checks; ++i)
+	{
+		gchar* result = markup2irc(markup_checks[i][0]);
+		if(strcmp(result, markup_checks[i][1]))
+		{
+			fprintf(stderr, "markup2irc(\"%s\") = \"%s\", expected \"%s\"\n",
+				markup_checks[i][0], result, markup_checks[i][1]);
+			failures++;
+		}
+		g_free(result);
+	}
+	return failures;
+}
+
+static void bench_markup2irc(void* data)
+{
+	g_free(markup2irc(static_cast<const char*>(data)));
+}
+
+static void bench_irc2markup(void* data)
+{
+	g_free(irc2markup(static_cast<const char*>(data)));
+}
+
+int main()
+{
+	char name[64];
+
+	if(check_markup2irc())
+		return EXIT_FAILURE;
+
+	Benchmark::header("markup2irc");
+	for(size_t i = 0; i < sizeof markup_corpus / sizeof *markup_corpus; ++i)
+	{
+		snprintf(name, sizeof name, "markup2irc/%s", markup_corpus[i][0]);
+		Benchmark::run(name, bench_markup2irc, (void*)markup_corpus[i][1], strlen(markup_corpus[i][1]));
+	}
+
+	Benchmark::header("irc2markup");
+	for(size_t i = 0; i < sizeof irc_corpus / sizeof *irc_corpus; ++i)
+	{
+		snprintf(name, sizeof name, "irc2markup/%s", irc_corpus[i][0]);
+		Benchmark::run(name, bench_irc2markup, (void*)irc_corpus[i][1], strlen(irc_corpus[i][1]));
+	}
+
+	return 0;
+}
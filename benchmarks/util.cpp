@@ -0,0 +1,146 @@
+/*
+ * Minbif - IRC instant messaging gateway
+ * Copyright(C) 2011 Romain Bignon
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <string>
+
+#include "bench.h"
+#include "core/util.h"
+
+using std::string;
+
+struct tok_case
+{
+	const char* name;
+	const char* delims;
+	string text;
+};
+
+/* The whole input is split, as done by callers. */
+static void bench_tokenizer(void* data)
+{
+	tok_case* c = static_cast<tok_case*>(data);
+	StringTokenizer tok(c->text, c->delims);
+	string token;
+	while(tok.next(token))
+		;
+}
+
+/* Former implementation, which copies the rest of the input after each
+ * token: splitting a buffer is quadratic. Kept for comparison. */
+static string legacy_stringtok(string &in, const char * const delimiters)
+{
+	string::size_type i = in.find_first_not_of(delimiters);
+	string::size_type j = in.find_first_of(delimiters, i);
+	string s;
+
+	if(j == string::npos)
+	{
+		if(i != string::npos)
+			s = in.substr(i);
+		in = "";
+		return s;
+	}
+
+	s = in.substr(i, j-i);
+	in = in.substr(j+1);
+	return s;
+}
+
+static void bench_legacy_stringtok(void* data)
+{
+	tok_case* c = static_cast<tok_case*>(data);
+	string in = c->text;
+	while(!legacy_stringtok(in, c->delims).empty())
+		;
+}
+
+static void bench_strlower(void* data)
+{
+	strlower(*static_cast<string*>(data));
+}
+
+static void bench_strupper(void* data)
+{
+	strupper(*static_cast<string*>(data));
+}
+
+int main()
+{
+	char name[64];
+	tok_case cases[4];
+
+	/* Arguments of an IRC message. */
+	cases[0].name = "irc message";
+	cases[0].delims = " ";
+	cases[0].text = ":romain!romain@localhost.localdomain PRIVMSG #minbif :are you coming tonight?";
+
+	/* Lines read at once from the IRC socket, as in IRC::readIO(). */
+	cases[1].name = "read buffer";
+	cases[1].delims = "\r\n";
+	for(int i = 0; i < 20; ++i)
+		cases[1].text += "PRIVMSG buddy" + t2s(i) + " :hey, how are you? here is a link http://minbif.im/\r\n";
+
+	/* Channels list of a JOIN. */
+	cases[2].name = "join list";
+	cases[2].delims = ",";
+	for(int i = 0; i < 30; ++i)
+		cases[2].text += (i ? ",#channel" : "#channel") + t2s(i) + ":jabber0";
+
+	/* Nicks of a 353 (NAMES) reply. */
+	cases[3].name = "names reply";
+	cases[3].delims = " ";
+	for(int i = 0; i < 120; ++i)
+		cases[3].text += (i % 3 ? "" : "@") + string("buddy_name") + t2s(i) + " ";
+
+	Benchmark::header("StringTokenizer");
+	for(size_t i = 0; i < sizeof cases / sizeof *cases; ++i)
+	{
+		snprintf(name, sizeof name, "tokenizer/%s", cases[i].name);
+		Benchmark::run(name, bench_tokenizer, &cases[i], cases[i].text.size());
+	}
+
+	/* A big paste read at once from the IRC socket. The throughput has
+	 * to stay the same whatever the size is. */
+	Benchmark::header("StringTokenizer scaling, lines of 64 bytes");
+	for(size_t kib = 1; kib <= 64; kib *= 4)
+	{
+		tok_case big;
+		big.name = "lines";
+		big.delims = "\r\n";
+		while(big.text.size() < kib * 1024)
+			big.text += "PRIVMSG #minbif :a line of a big paste, padded to 64 bytes....\r\n";
+
+		snprintf(name, sizeof name, "tokenizer/%lu KiB", (unsigned long)kib);
+		Benchmark::run(name, bench_tokenizer, &big, big.text.size());
+		snprintf(name, sizeof name, "legacy stringtok/%lu KiB", (unsigned long)kib);
+		Benchmark::run(name, bench_legacy_stringtok, &big, big.text.size());
+	}
+
+	string nick = "Romain_Bignon";
+	string mask = "Romain!rbignon@im.symlink.me";
+	string line = ":RomainBignon!rbignon@im.symlink.me PRIVMSG #MinBif :Hello World, how Are You Doing?";
+
+	Benchmark::header("strlower/strupper");
+	Benchmark::run("strlower/nick", bench_strlower, &nick, nick.size());
+	Benchmark::run("strlower/mask", bench_strlower, &mask, mask.size());
+	Benchmark::run("strlower/line", bench_strlower, &line, line.size());
+	Benchmark::run("strupper/nick", bench_strupper, &nick, nick.size());
+	Benchmark::run("strupper/line", bench_strupper, &line, line.size());
+
+	return 0;
+}
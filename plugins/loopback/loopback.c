@@ -0,0 +1,497 @@
+/*
+ * Minbif - IRC instant messaging gateway
+ * Copyright(C) 2009-2011 Romain Bignon
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <string.h>
+
+#include "loopback.h"
+
+PurplePlugin *_loopback_plugin = NULL;
+
+typedef struct _LoopbackEcho LoopbackEcho;
+
+struct _LoopbackEcho {
+	int chat_id;          /**< 0 for an IM */
+	gchar* who;
+	gchar* what;
+};
+
+static LoopbackAccount* loopback_account_new(PurpleAccount *account)
+{
+	LoopbackAccount* lba;
+
+	lba = g_new0(LoopbackAccount, 1);
+	lba->account = account;
+	lba->pc = purple_account_get_connection(account);
+	lba->buddies = purple_account_get_int(account, "buddies", LB_DEFAULT_BUDDIES);
+	lba->chats = purple_account_get_int(account, "chats", LB_DEFAULT_CHATS);
+	lba->members = purple_account_get_int(account, "members", LB_DEFAULT_MEMBERS);
+	lba->churn = purple_account_get_int(account, "churn", LB_DEFAULT_CHURN);
+	lba->flood = purple_account_get_int(account, "flood", LB_DEFAULT_FLOOD);
+	/* Same seed, same events: runs can be compared. */
+	lba->rand = g_rand_new_with_seed(purple_account_get_int(account, "seed", 0));
+	lba->echoes = g_queue_new();
+	lba->next_chat_id = 1;
+
+	account->gc->proto_data = lba;
+	return lba;
+}
+
+static void loopback_echo_free(LoopbackEcho* echo)
+{
+	g_free(echo->who);
+	g_free(echo->what);
+	g_free(echo);
+}
+
+static void loopback_account_free(LoopbackAccount* lba)
+{
+	LoopbackEcho* echo;
+
+	if (lba->tick_timer)
+		purple_timeout_remove(lba->tick_timer);
+	if (lba->echo_timer)
+		purple_timeout_remove(lba->echo_timer);
+
+	while ((echo = g_queue_pop_head(lba->echoes)) != NULL)
+		loopback_echo_free(echo);
+	g_queue_free(lba->echoes);
+
+	g_rand_free(lba->rand);
+	g_free(lba);
+}
+
+static const char *loopback_blist_icon(PurpleAccount *a, PurpleBuddy *b)
+{
+	return "loopback";
+}
+
+/** Microseconds since epoch, put in generated messages so the receiver
+ * can compute the delivery latency. */
+static gint64 loopback_now(void)
+{
+	GTimeVal tv;
+	g_get_current_time(&tv);
+	return (gint64)tv.tv_sec * G_USEC_PER_SEC + tv.tv_usec;
+}
+
+static void loopback_fill_blist(LoopbackAccount* lba)
+{
+	PurpleGroup *group;
+	int i;
+
+	group = purple_find_group(LB_GROUP);
+	if (!group)
+	{
+		group = purple_group_new(LB_GROUP);
+		purple_blist_add_group(group, NULL);
+	}
+
+	for (i = 0; i < lba->buddies; ++i)
+	{
+		gchar* name = g_strdup_printf(LB_BUDDY_FORMAT, i);
+		PurpleBuddy* buddy = purple_find_buddy(lba->account, name);
+
+		if (!buddy)
+		{
+			buddy = purple_buddy_new(lba->account, name, NULL);
+			purple_blist_add_buddy(buddy, NULL, group, NULL);
+		}
+		purple_prpl_got_user_status(lba->account, name, "available", NULL);
+		g_free(name);
+	}
+}
+
+static void loopback_join_room(LoopbackAccount* lba, const char* room)
+{
+	PurpleConversation* conv;
+	GList *users = NULL, *flags = NULL, *l;
+	int i;
+
+	conv = serv_got_joined_chat(lba->pc, lba->next_chat_id++, room);
+	if (!conv)
+		return;
+
+	for (i = 0; i < lba->members; ++i)
+	{
+		users = g_list_append(users, g_strdup_printf(LB_MEMBER_FORMAT, i));
+		flags = g_list_append(flags, GINT_TO_POINTER(i ? PURPLE_CBFLAGS_NONE : PURPLE_CBFLAGS_OP));
+	}
+	purple_conv_chat_add_users(PURPLE_CONV_CHAT(conv), users, NULL, flags, FALSE);
+
+	for (l = users; l; l = l->next)
+		g_free(l->data);
+	g_list_free(users);
+	g_list_free(flags);
+}
+
+/** A random buddy switches between available and away. */
+static void loopback_churn(LoopbackAccount* lba)
+{
+	gchar* name;
+	PurpleBuddy* buddy;
+	const char* status = "available";
+
+	if (lba->buddies <= 0)
+		return;
+
+	name = g_strdup_printf(LB_BUDDY_FORMAT, g_rand_int_range(lba->rand, 0, lba->buddies));
+	buddy = purple_find_buddy(lba->account, name);
+	if (buddy && purple_presence_is_available(purple_buddy_get_presence(buddy)))
+		status = "away";
+
+	purple_prpl_got_user_status(lba->account, name, status, NULL);
+	g_free(name);
+}
+
+/** Receive a message from a random buddy, or from a random member of a
+ * room. Its text is "flood <seq> <usec since epoch>". */
+static void loopback_flood(LoopbackAccount* lba)
+{
+	gchar *text, *who;
+	gboolean to_chat = lba->next_chat_id > 1 && lba->members > 0;
+
+	if (lba->buddies > 0 && to_chat)
+		to_chat = g_rand_boolean(lba->rand);
+
+	text = g_strdup_printf("flood %lu %" G_GINT64_FORMAT, ++lba->seq, loopback_now());
+
+	if (to_chat)
+	{
+		int id = g_rand_int_range(lba->rand, 1, lba->next_chat_id);
+		who = g_strdup_printf(LB_MEMBER_FORMAT, g_rand_int_range(lba->rand, 0, lba->members));
+
+		/* The user may have left this room. */
+		if (purple_find_chat(lba->pc, id))
+			serv_got_chat_in(lba->pc, id, who, PURPLE_MESSAGE_RECV, text, time(NULL));
+		g_free(who);
+	}
+	else if (lba->buddies > 0)
+	{
+		who = g_strdup_printf(LB_BUDDY_FORMAT, g_rand_int_range(lba->rand, 0, lba->buddies));
+		serv_got_im(lba->pc, who, text, PURPLE_MESSAGE_RECV, time(NULL));
+		g_free(who);
+	}
+
+	g_free(text);
+}
+
+static gboolean loopback_tick(gpointer data)
+{
+	LoopbackAccount* lba = data;
+
+	lba->churn_debt += lba->churn * LB_TICK / 1000.0;
+	for (; lba->churn_debt >= 1; lba->churn_debt -= 1)
+		loopback_churn(lba);
+
+	lba->flood_debt += lba->flood * LB_TICK / 1000.0;
+	for (; lba->flood_debt >= 1; lba->flood_debt -= 1)
+		loopback_flood(lba);
+
+	return TRUE;
+}
+
+static gboolean loopback_flush_echoes(gpointer data)
+{
+	LoopbackAccount* lba = data;
+	LoopbackEcho* echo;
+
+	lba->echo_timer = 0;
+	while ((echo = g_queue_pop_head(lba->echoes)) != NULL)
+	{
+		if (echo->chat_id)
+		{
+			if (purple_find_chat(lba->pc, echo->chat_id))
+				serv_got_chat_in(lba->pc, echo->chat_id, echo->who, PURPLE_MESSAGE_RECV, echo->what, time(NULL));
+		}
+		else
+			serv_got_im(lba->pc, echo->who, echo->what, PURPLE_MESSAGE_RECV, time(NULL));
+		loopback_echo_free(echo);
+	}
+	return FALSE;
+}
+
+/** Messages are sent back from the next main loop iteration, as a real
+ * server would do it. */
+static void loopback_queue_echo(LoopbackAccount* lba, int chat_id, const char* who, const char* what)
+{
+	LoopbackEcho* echo = g_new0(LoopbackEcho, 1);
+
+	echo->chat_id = chat_id;
+	echo->who = g_strdup(who);
+	echo->what = g_strdup(what);
+	g_queue_push_tail(lba->echoes, echo);
+
+	if (!lba->echo_timer)
+		lba->echo_timer = purple_timeout_add(0, loopback_flush_echoes, lba);
+}
+
+static void loopback_login(PurpleAccount *account)
+{
+	PurpleConnection *gc;
+	LoopbackAccount* lba;
+	int i;
+
+	gc = purple_account_get_connection(account);
+	lba = loopback_account_new(account);
+
+	purple_connection_set_state(gc, PURPLE_CONNECTED);
+	loopback_fill_blist(lba);
+
+	for (i = 0; i < lba->chats; ++i)
+	{
+		gchar* room = g_strdup_printf(LB_ROOM_FORMAT, i);
+		loopback_join_room(lba, room);
+		g_free(room);
+	}
+
+	lba->tick_timer = purple_timeout_add(LB_TICK, loopback_tick, lba);
+}
+
+static void loopback_close(PurpleConnection *gc)
+{
+	g_return_if_fail(gc != NULL);
+	g_return_if_fail(gc->proto_data != NULL);
+
+	loopback_account_free(gc->proto_data);
+	gc->proto_data = NULL;
+}
+
+static int loopback_send_im(PurpleConnection *gc, const char *who, const char *what, PurpleMessageFlags flags)
+{
+	loopback_queue_echo(gc->proto_data, 0, who, what);
+	return 1;
+}
+
+static GList *loopback_chat_info(PurpleConnection *gc)
+{
+	struct proto_chat_entry *pce = g_new0(struct proto_chat_entry, 1);
+
+	pce->label = "_Room:";
+	pce->identifier = "room";
+	pce->required = TRUE;
+
+	return g_list_append(NULL, pce);
+}
+
+static GHashTable *loopback_chat_info_defaults(PurpleConnection *gc, const char *chat_name)
+{
+	GHashTable *defaults = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+
+	if (chat_name)
+		g_hash_table_insert(defaults, "room", g_strdup(chat_name));
+
+	return defaults;
+}
+
+static void loopback_join_chat(PurpleConnection *gc, GHashTable *components)
+{
+	const char *room = g_hash_table_lookup(components, "room");
+
+	if (room)
+		loopback_join_room(gc->proto_data, room);
+}
+
+static char *loopback_get_chat_name(GHashTable *components)
+{
+	return g_strdup(g_hash_table_lookup(components, "room"));
+}
+
+static void loopback_chat_leave(PurpleConnection *gc, int id)
+{
+	serv_got_chat_left(gc, id);
+}
+
+static int loopback_chat_send(PurpleConnection *gc, int id, const char *what, PurpleMessageFlags flags)
+{
+	LoopbackAccount* lba = gc->proto_data;
+	gchar* who = g_strdup_printf(LB_MEMBER_FORMAT, 0);
+
+	loopback_queue_echo(lba, id, who, what);
+	g_free(who);
+	return 0;
+}
+
+static GList *loopback_status_types(PurpleAccount *account)
+{
+	PurpleStatusType *type;
+	GList *types = NULL;
+
+	type = purple_status_type_new(PURPLE_STATUS_AVAILABLE, NULL, NULL, TRUE);
+	types = g_list_append(types, type);
+
+	type = purple_status_type_new(PURPLE_STATUS_AWAY, NULL, NULL, TRUE);
+	types = g_list_append(types, type);
+
+	type = purple_status_type_new(PURPLE_STATUS_OFFLINE, NULL, NULL, TRUE);
+	types = g_list_append(types, type);
+
+	return types;
+}
+
+static void loopback_set_status(PurpleAccount *account, PurpleStatus *status)
+{
+}
+
+static PurplePluginProtocolInfo prpl_info =
+{
+	OPT_PROTO_PASSWORD_OPTIONAL,
+	NULL,					/* user_splits */
+	NULL,					/* protocol_options */
+	NO_BUDDY_ICONS,		/* icon_spec */
+	loopback_blist_icon,		/* list_icon */
+	NULL,			/* list_emblems */
+	NULL,					/* status_text */
+	NULL,					/* tooltip_text */
+	loopback_status_types,	/* away_states */
+	NULL,					/* blist_node_menu */
+	loopback_chat_info,	/* chat_info */
+	loopback_chat_info_defaults,	/* chat_info_defaults */
+	loopback_login,		/* login */
+	loopback_close,		/* close */
+	loopback_send_im,		/* send_im */
+	NULL,					/* set_info */
+	NULL,					/* send_typing */
+	NULL,		/* get_info */
+	loopback_set_status,		/* set_status */
+	NULL,					/* set_idle */
+	NULL,					/* change_passwd */
+	NULL,		/* add_buddy */
+	NULL,					/* add_buddies */
+	NULL,	/* remove_buddy */
+	NULL,					/* remove_buddies */
+	NULL,					/* add_permit */
+	NULL,					/* add_deny */
+	NULL,					/* rem_permit */
+	NULL,					/* rem_deny */
+	NULL,					/* set_permit_deny */
+	loopback_join_chat,		/* join_chat */
+	NULL,					/* reject_chat */
+	loopback_get_chat_name,	/* get_chat_name */
+	NULL,	/* chat_invite */
+	loopback_chat_leave,		/* chat_leave */
+	NULL,					/* chat_whisper */
+	loopback_chat_send,		/* chat_send */
+	NULL,		/* keepalive */
+	NULL,					/* register_user */
+	NULL,					/* get_cb_info */
+	NULL,					/* get_cb_away */
+	NULL,					/* alias_buddy */
+	NULL,					/* group_buddy */
+	NULL,					/* rename_group */
+	NULL,					/* buddy_free */
+	NULL,					/* convo_closed */
+	purple_normalize_nocase,	/* normalize */
+	NULL,					/* set_buddy_icon */
+	NULL,					/* remove_group */
+	NULL,					/* get_cb_real_name */
+	NULL,	/* set_chat_topic */
+	NULL,					/* find_blist_chat */
+	NULL,	/* roomlist_get_list */
+	NULL,	/* roomlist_cancel */
+	NULL,					/* roomlist_expand_category */
+	NULL,					/* can_receive_file */
+	NULL,	/* send_file */
+	NULL,	/* new_xfer */
+	NULL,					/* offline_message */
+	NULL,					/* whiteboard_prpl_ops */
+	NULL,			/* send_raw */
+	NULL,					/* roomlist_room_serialize */
+	NULL,                   /* unregister_user */
+	NULL,                   /* send_attention */
+	NULL,                   /* get_attention_types */
+	sizeof(PurplePluginProtocolInfo),    /* struct_size */
+	NULL,                    /* get_account_text_table */
+	NULL,                    /* initiate_media */
+	NULL					 /* can_do_media */
+#if (PURPLE_MAJOR_VERSION == 2 && PURPLE_MINOR_VERSION >= 7)
+	, NULL,					 /* get_moods */
+	NULL,					 /* set_public_alias */
+	NULL					 /* get_public_alias */
+#endif
+#if (PURPLE_MAJOR_VERSION == 2 && PURPLE_MINOR_VERSION >= 8)
+	, NULL,					/* add_buddy_with_invite */
+	NULL					/* add_budies_with_invite */
+#endif
+};
+
+static gboolean load_plugin (PurplePlugin *plugin) {
+
+	return TRUE;
+}
+
+static PurplePluginInfo info =
+{
+	PURPLE_PLUGIN_MAGIC,
+	PURPLE_MAJOR_VERSION,
+	PURPLE_MINOR_VERSION,
+	PURPLE_PLUGIN_PROTOCOL,                           /**< type           */
+	NULL,                                             /**< ui_requirement */
+	0,                                                /**< flags          */
+	NULL,                                             /**< dependencies   */
+	PURPLE_PRIORITY_DEFAULT,                          /**< priority       */
+
+	"prpl-loopback",                                  /**< id             */
+	"Loopback",                                       /**< name           */
+	"1.0",                                            /**< version        */
+	"Loopback Protocol Plugin",                       /**  summary        */
+	"Simulated server, to benchmark purple clients",  /**  description    */
+	"Romain Bignon",                                  /**< author         */
+	"http://minbif.im",                               /**< homepage       */
+
+	load_plugin,                                      /**< load           */
+	NULL,                                             /**< unload         */
+	NULL,                                             /**< destroy        */
+
+	NULL,                                             /**< ui_info        */
+	&prpl_info,                                       /**< extra_info     */
+	NULL,                                             /**< prefs_info     */
+	NULL,
+
+	/* padding */
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
+
+static void _init_plugin(PurplePlugin *plugin)
+{
+	PurpleAccountOption *option;
+
+	option = purple_account_option_int_new("Number of buddies", "buddies", LB_DEFAULT_BUDDIES);
+	prpl_info.protocol_options = g_list_append(prpl_info.protocol_options, option);
+
+	option = purple_account_option_int_new("Rooms joined at login", "chats", LB_DEFAULT_CHATS);
+	prpl_info.protocol_options = g_list_append(prpl_info.protocol_options, option);
+
+	option = purple_account_option_int_new("Members per room", "members", LB_DEFAULT_MEMBERS);
+	prpl_info.protocol_options = g_list_append(prpl_info.protocol_options, option);
+
+	option = purple_account_option_int_new("Presence changes per second", "churn", LB_DEFAULT_CHURN);
+	prpl_info.protocol_options = g_list_append(prpl_info.protocol_options, option);
+
+	option = purple_account_option_int_new("Received messages per second", "flood", LB_DEFAULT_FLOOD);
+	prpl_info.protocol_options = g_list_append(prpl_info.protocol_options, option);
+
+	option = purple_account_option_int_new("Random seed", "seed", 0);
+	prpl_info.protocol_options = g_list_append(prpl_info.protocol_options, option);
+
+	_loopback_plugin = plugin;
+}
+
+PURPLE_INIT_PLUGIN(loopback, _init_plugin, info);
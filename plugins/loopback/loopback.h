@@ -0,0 +1,65 @@
+/*
+ * Minbif - IRC instant messaging gateway
+ * Copyright(C) 2009-2011 Romain Bignon
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef LB_LOOPBACK_H
+#define LB_LOOPBACK_H
+
+#include <purple.h>
+
+#define LB_GROUP "Loopback"
+#define LB_BUDDY_FORMAT "buddy%04d"
+#define LB_MEMBER_FORMAT "member%04d"
+#define LB_ROOM_FORMAT "room%d"
+
+#define LB_DEFAULT_BUDDIES 50
+#define LB_DEFAULT_CHATS 1
+#define LB_DEFAULT_MEMBERS 20
+#define LB_DEFAULT_CHURN 0
+#define LB_DEFAULT_FLOOD 0
+
+/** Period of the timer simulating server activity, in ms. */
+#define LB_TICK 100
+
+typedef struct _LoopbackAccount LoopbackAccount;
+
+struct _LoopbackAccount {
+	PurpleAccount *account;
+	PurpleConnection *pc;
+
+	int buddies;
+	int chats;
+	int members;
+	int churn;            /**< presence changes per second */
+	int flood;            /**< received messages per second */
+
+	/* Events not sent yet, as rates are given per second and the timer
+	 * ticks every LB_TICK ms. */
+	double churn_debt;
+	double flood_debt;
+	guint tick_timer;
+
+	/* Messages sent by user, echoed on next main loop iteration. */
+	GQueue* echoes;
+	guint echo_timer;
+
+	GRand* rand;
+	int next_chat_id;
+	unsigned long seq;    /**< number of flood messages */
+};
+
+#endif /* LB_LOOPBACK_H */
@@ -16,6 +16,10 @@
  */
 
 #include <cstdlib>
+#include <list>
+#include <map>
+#include <sstream>
+#include <sys/stat.h>
 #include <glib.h>
 #ifdef HAVE_CACA
 	#include <caca.h>
@@ -23,15 +27,16 @@
 #endif
 
 #include "caca_image.h"
+#include "callback.h"
+#include "mutex.h"
 #include <string.h>
 
 #ifdef HAVE_CACA
 	struct CacaImage::image
 	{
 		char *pixels;
-		unsigned int w, h;
+		unsigned int w, h, bpp;
 		cucul_dither_t *dither;
-		void *priv;
 		unsigned ref;
 
 		image();
@@ -40,8 +45,217 @@
 		void create_dither(unsigned bpp);
 		static struct CacaImage::image * load_file(char const * name);
 	};
+
+	struct CacaContext::canvases
+	{
+		/* There is usually only a few sizes used, but it is bounded
+		 * as sizes can be given by user. */
+		static const size_t MAX_SIZE = 8;
+
+		typedef std::map<std::pair<unsigned, unsigned>, cucul_canvas_t*> map_t;
+		map_t canvas;
+
+		~canvases()
+		{
+			clear();
+		}
+
+		void clear()
+		{
+			for(map_t::iterator it = canvas.begin(); it != canvas.end(); ++it)
+				cucul_free_canvas(it->second);
+			canvas.clear();
+		}
+
+		cucul_canvas_t* get(unsigned width, unsigned height)
+		{
+			map_t::iterator it = canvas.find(std::make_pair(width, height));
+			if(it != canvas.end())
+				return it->second;
+
+			if(canvas.size() >= MAX_SIZE)
+				clear();
+
+			cucul_canvas_t* cv = cucul_create_canvas(width, height);
+			if(cv)
+				canvas[std::make_pair(width, height)] = cv;
+			return cv;
+		}
+	};
+#else
+	struct CacaContext::canvases {};
+#endif /* HAVE_CACA */
+
+CacaContext CacaContext::main_thread;
+
+CacaContext::CacaContext()
+	: cvs(new canvases())
+{}
+
+CacaContext::~CacaContext()
+{
+	delete cvs;
+}
+
+static struct RenderCache
+{
+	static const size_t MAX_SIZE = 64;
+
+	typedef std::list<std::pair<string, string> > entries_t;
+	entries_t entries;
+	std::map<string, entries_t::iterator> index;
+
+	bool get(const string& key, string& value)
+	{
+		std::map<string, entries_t::iterator>::iterator it = index.find(key);
+		if(it == index.end())
+			return false;
+
+		/* Move entry at the front of the list. */
+		entries.splice(entries.begin(), entries, it->second);
+		value = it->second->second;
+		return true;
+	}
+
+	void put(const string& key, const string& value)
+	{
+		entries.push_front(std::make_pair(key, value));
+		index[key] = entries.begin();
+		if(index.size() > MAX_SIZE)
+		{
+			index.erase(entries.back().first);
+			entries.pop_back();
+		}
+	}
+} render_cache;
+
+#ifdef HAVE_CACA
+/** Renders are done by only one thread, as imlib2 isn't thread-safe. */
+static GThreadPool* render_pool = NULL;
+
+/** Context used by the render thread. */
+static CacaContext render_context;
 #endif /* HAVE_CACA */
 
+/** Used to serialize calls to imlib2 between render thread and others. */
+static Mutex imlib_mutex;
+
+const Mutex& CacaImage::imlibMutex()
+{
+	return imlib_mutex;
+}
+
+CacaRender::CacaRender(string _path, unsigned _width, unsigned _height, string _output_type, unsigned _font_width, unsigned _font_height)
+	: path(_path),
+	  width(_width),
+	  height(_height),
+	  output_type(_output_type),
+	  font_width(_font_width),
+	  font_height(_font_height),
+	  status(PENDING),
+	  callback(NULL)
+{}
+
+static void render_finish(CacaRender* r)
+{
+	_CallBack* cb = r->callback;
+
+	r->callback = NULL;
+	cb->run();
+	delete cb;
+}
+
+#ifdef HAVE_CACA
+/* Main loop. */
+static gboolean render_done(gpointer data)
+{
+	CacaRender* r = static_cast<CacaRender*>(data);
+
+	if(r->status == CacaRender::RENDERED)
+		render_cache.put(r->key, r->buf);
+
+	/* Cancelled. */
+	if(!r->callback)
+	{
+		delete r;
+		return FALSE;
+	}
+
+	render_finish(r);
+	return FALSE;
+}
+
+/* Render thread. */
+static void render_job(gpointer data, gpointer user_data)
+{
+	CacaRender* r = static_cast<CacaRender*>(data);
+
+	try
+	{
+		r->buf = CacaImage(r->path).draw(render_context, r->width, r->height, r->output_type.c_str(), r->font_width, r->font_height);
+		r->status = CacaRender::RENDERED;
+	}
+	catch(CacaError &e)
+	{
+		r->status = CacaRender::NO_PICTURE;
+	}
+
+	g_idle_add(render_done, r);
+}
+#endif /* HAVE_CACA */
+
+void CacaImage::render(CacaRender* r, _CallBack* callback)
+{
+	r->callback = callback;
+
+#ifndef HAVE_CACA
+	r->status = CacaRender::NOT_LOADED;
+	render_finish(r);
+#else
+	struct stat st;
+	if(r->path.empty() || stat(r->path.c_str(), &st) < 0)
+	{
+		r->status = CacaRender::NO_PICTURE;
+		render_finish(r);
+		return;
+	}
+
+	/* Size and modification time are checked, in case the file is
+	 * overwritten with an other picture. */
+	std::ostringstream oss;
+	oss << r->path << '\n' << st.st_size << '\n' << st.st_mtime << '\n'
+	    << r->width << 'x' << r->height << '\n' << r->output_type << '\n'
+	    << r->font_width << 'x' << r->font_height;
+	r->key = oss.str();
+
+	if(render_cache.get(r->key, r->buf))
+	{
+		r->status = CacaRender::RENDERED;
+		render_finish(r);
+		return;
+	}
+
+	if(!render_pool)
+		render_pool = g_thread_pool_new(render_job, NULL, 1, FALSE, NULL);
+
+	if(render_pool)
+		g_thread_pool_push(render_pool, r, NULL);
+	else
+	{
+		/* Unable to create thread, render it now. */
+		render_job(r, NULL);
+	}
+#endif /* HAVE_CACA */
+}
+
+void CacaImage::cancel(CacaRender* r)
+{
+	/* Only pending renders can be cancelled, and the callback is only
+	 * used by the main thread. */
+	delete r->callback;
+	r->callback = NULL;
+}
+
 CacaImage::CacaImage()
 	: width(0),
 	  height(0),
@@ -70,12 +284,7 @@ CacaImage::CacaImage(const void* buf, size_t size, unsigned buf_width, unsigned
 	  img(NULL)
 {
 #ifdef HAVE_CACA
-	img = new image();
-	img->w = buf_width;
-	img->h = buf_height;
-	img->pixels = g_strndup((const char*)buf, size);
-
-	img->create_dither(bpp);
+	setPixels(buf, size, buf_width, buf_height, bpp);
 #endif
 }
 
@@ -88,7 +297,8 @@ CacaImage::CacaImage(const CacaImage& caca)
 	  img(caca.img)
 {
 #ifdef HAVE_CACA
-	img->ref++;
+	if(img)
+		img->ref++;
 #endif
 }
 
@@ -102,7 +312,8 @@ CacaImage& CacaImage::operator=(const CacaImage& caca)
 	font_height = caca.font_height;
 	img = caca.img;
 #ifdef HAVE_CACA
-	img->ref++;
+	if(img)
+		img->ref++;
 #endif
 	return *this;
 }
@@ -125,6 +336,55 @@ void CacaImage::deinit()
 #endif
 }
 
+void CacaImage::setPixels(const void* data, size_t size, unsigned buf_width, unsigned buf_height, unsigned bpp, unsigned max_width)
+{
+#ifndef HAVE_CACA
+	throw CacaNotLoaded();
+#else
+	unsigned depth = bpp / 8;
+	if(!depth || !buf_width || !buf_height || size < (size_t)buf_width * buf_height * depth)
+		throw CacaError();
+
+	/* Only keep one pixel out of step, on both axes. */
+	unsigned step = 1;
+	if(max_width && buf_width > max_width)
+		step = (buf_width + max_width - 1) / max_width;
+
+	unsigned w = buf_width / step, h = buf_height / step;
+
+	/* The pixels buffer and the dither are reused when the geometry
+	 * doesn't change, which is the case of every frames of a stream. */
+	if(!img || img->ref > 1 || img->w != w || img->h != h || img->bpp != bpp)
+	{
+		deinit();
+		img = new image();
+		img->w = w;
+		img->h = h;
+		img->pixels = (char*)malloc(w * h * depth);
+		img->create_dither(bpp);
+		if(!img->pixels || !img->dither)
+		{
+			deinit();
+			throw CacaError();
+		}
+	}
+
+	const char* src = static_cast<const char*>(data);
+	char* dst = img->pixels;
+	if(step == 1)
+		memcpy(dst, src, w * h * depth);
+	else
+		for(unsigned y = 0; y < h; ++y)
+		{
+			const char* row = src + (size_t)y * step * buf_width * depth;
+			for(unsigned x = 0; x < w; ++x, dst += depth)
+				memcpy(dst, row + (size_t)x * step * depth, depth);
+		}
+
+	buf.clear();
+#endif /* HAVE_CACA */
+}
+
 string CacaImage::getIRCBuffer()
 {
 	if(buf.empty())
@@ -150,76 +410,87 @@ string CacaImage::getIRCBuffer(unsigned _width, unsigned _height, const char *ou
 	font_width = _font_width;
 	font_height = _font_height;
 
-	cucul_canvas_t *cv = cucul_create_canvas(0, 0);
-	if(!cv)
+	buf = draw(CacaContext::main_thread, width, height, output_type, font_width, font_height);
+	computeSize(width, height, font_width, font_height);
+
+	return buf;
+#endif /* HAVE_CACA */
+}
+
+const string& CacaImage::draw(CacaContext& ctx, unsigned _width, unsigned _height, const char* output_type, unsigned _font_width, unsigned _font_height) const
+{
+#ifndef HAVE_CACA
+	throw CacaNotLoaded();
+#else
+	if(!img)
 		throw CacaError();
 
-	if(!width && !height)
-	{
-		height = 10;
-		width = height * img->w * font_height / img->h / font_width;
-	}
-	else if(width && !height)
-		height = width * img->h * font_width / img->w / font_height;
-	else if(!width && height)
-		width = height * img->w * font_height / img->h / font_width;
+	computeSize(_width, _height, _font_width, _font_height);
 
-	cucul_set_canvas_size(cv, width, height);
-	cucul_set_color_ansi(cv, CUCUL_DEFAULT, CUCUL_TRANSPARENT);
-	cucul_clear_canvas(cv);
-	if(cucul_set_dither_algorithm(img->dither, "fstein"))
-	{
-		cucul_free_canvas(cv);
+	cucul_canvas_t *cv = ctx.cvs->get(_width, _height);
+	if(!cv)
 		throw CacaError();
-	}
 
-	cucul_dither_bitmap(cv, 0, 0, width, height, img->dither, img->pixels);
+	cucul_set_color_ansi(cv, CUCUL_DEFAULT, CUCUL_TRANSPARENT);
+	cucul_clear_canvas(cv);
+	cucul_dither_bitmap(cv, 0, 0, _width, _height, img->dither, img->pixels);
 
 	size_t len;
-	char* tmp;
+	void* tmp;
 #ifdef HAVE_OLD_CACA
-	tmp = (char*)cucul_export_memory(cv, output_type, &len);
+	tmp = cucul_export_memory(cv, output_type, &len);
 #else
-	tmp = (char*)caca_export_canvas_to_memory(cv, output_type, &len);
+	tmp = caca_export_canvas_to_memory(cv, output_type, &len);
 #endif
 	if(!tmp)
 		throw CacaError();
 
-	tmp = (char*)realloc(tmp, len+1);
-	tmp[len] = 0;
-	buf = tmp;
-
+	/* The string keeps its capacity, so there isn't any allocation
+	 * once it is large enough. */
+	ctx.out.assign(static_cast<const char*>(tmp), len);
 	free(tmp);
 
-	cucul_free_canvas(cv);
-
-	return buf;
+	return ctx.out;
 #endif /* HAVE_CACA */
 }
 
+#ifdef HAVE_CACA
+void CacaImage::computeSize(unsigned& _width, unsigned& _height, unsigned _font_width, unsigned _font_height) const
+{
+	if(!_width && !_height)
+	{
+		_height = 10;
+		_width = _height * img->w * _font_height / img->h / _font_width;
+	}
+	else if(_width && !_height)
+		_height = _width * img->h * _font_width / img->w / _font_height;
+	else if(!_width && _height)
+		_width = _height * img->w * _font_height / img->h / _font_width;
+}
+#endif /* HAVE_CACA */
+
 #ifdef HAVE_CACA
 CacaImage::image::image()
 	: pixels(0),
 	  w(0),
 	  h(0),
+	  bpp(0),
 	  dither(0),
-	  priv(0),
 	  ref(1)
 {
 }
 
 CacaImage::image::~image()
 {
-	if(priv)
-		imlib_free_image();
 	if(dither)
 		cucul_free_dither(dither);
 	free(pixels);
 }
 
-void CacaImage::image::create_dither(unsigned int bpp)
+void CacaImage::image::create_dither(unsigned int _bpp)
 {
 	unsigned int depth, rmask, gmask, bmask, amask;
+	bpp = _bpp;
 	rmask = 0x00ff0000;
 	gmask = 0x0000ff00;
 	bmask = 0x000000ff;
@@ -230,6 +501,13 @@ void CacaImage::image::create_dither(unsigned int bpp)
 	dither = cucul_create_dither(bpp, w, h, depth * w,
 				     rmask, gmask, bmask, amask);
 
+	/* Algorithm is set once, it is kept between renders. */
+	if(dither && cucul_set_dither_algorithm(dither, "fstein"))
+	{
+		cucul_free_dither(dither);
+		dither = NULL;
+	}
+
 }
 
 struct CacaImage::image* CacaImage::image::load_file(char const * name)
@@ -238,6 +516,8 @@ struct CacaImage::image* CacaImage::image::load_file(char const * name)
 
 	Imlib_Image image;
 
+	BlockLockMutex lock(&imlib_mutex);
+
 	/* Load the new image */
 	image = imlib_load_image(name);
 
@@ -247,11 +527,14 @@ struct CacaImage::image* CacaImage::image::load_file(char const * name)
 		return NULL;
 	}
 
+	/* Pixels are copied, so the imlib2 image can be freed now,
+	 * while it is still the context one. */
 	imlib_context_set_image(image);
 	im->w = imlib_image_get_width();
 	im->h = imlib_image_get_height();
 	im->pixels = (char*)malloc(im->w * im->h * 4);
 	memcpy(im->pixels, imlib_image_get_data_for_reading_only(), im->w * im->h * 4);
+	imlib_free_image();
 
 	im->create_dither(32);
 	if(!im->dither)
@@ -260,8 +543,6 @@ struct CacaImage::image* CacaImage::image::load_file(char const * name)
 		return NULL;
 	}
 
-	im->priv = (void *)image;
-
 	return im;
 }
 
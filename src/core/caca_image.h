@@ -29,6 +29,59 @@ class CacaError : public std::exception {};
 /** Raised when libcaca isn't loaded. */
 class CacaNotLoaded : public std::exception {};
 
+class _CallBack;
+class Mutex;
+
+/** Keeps libcaca canvases and the export buffer between renders.
+ *
+ * A context must only be used by one thread at a time.
+ */
+class CacaContext
+{
+	struct canvases;
+	canvases* cvs;
+	string out;
+
+	CacaContext(const CacaContext&);
+	CacaContext& operator=(const CacaContext&);
+
+	friend class CacaImage;
+
+public:
+
+	CacaContext();
+	~CacaContext();
+
+	/** Context used by main thread. */
+	static CacaContext main_thread;
+};
+
+/** A picture file to render with CacaImage::render(). */
+struct CacaRender
+{
+	enum status_t
+	{
+		PENDING,
+		RENDERED,         /**< buf contains the picture */
+		NO_PICTURE,       /**< file can't be decoded */
+		NOT_LOADED        /**< libcaca isn't loaded */
+	};
+
+	CacaRender(string path, unsigned width, unsigned height = 0, string output_type = "irc", unsigned font_width = 6, unsigned font_height = 10);
+	virtual ~CacaRender() {}
+
+	string path;
+	unsigned width, height;
+	string output_type;
+	unsigned font_width, font_height;
+
+	status_t status;
+	string buf;
+
+	string key;               /**< key in render cache */
+	_CallBack* callback;
+};
+
 /** Convert an image (JPG/PNG/..) to a beautiful ASCII-art picture. */
 class CacaImage
 {
@@ -39,6 +92,7 @@ class CacaImage
 	image* img;
 
 	void deinit();
+	void computeSize(unsigned& width, unsigned& height, unsigned font_width, unsigned font_height) const;
 
 public:
 
@@ -60,6 +114,21 @@ public:
 
 	~CacaImage();
 
+	/** Replace the picture with a raw buffer.
+	 *
+	 * When the picture isn't shared and has the same geometry, its
+	 * pixels buffer and its dither are reused.
+	 *
+	 * @param buffer  raw pixels, \a bpp bits per pixel
+	 * @param size  size of buffer
+	 * @param width  width of buffer in pixels
+	 * @param height  height of buffer in pixels
+	 * @param bpp  bits per pixel
+	 * @param max_width  if not null, the picture is downscaled while
+	 *                   copied to be at most this width
+	 */
+	void setPixels(const void* buffer, size_t size, unsigned width, unsigned height, unsigned bpp, unsigned max_width = 0);
+
 	/** Get IRC buffer to ASCII art picture.
 	 * If buffer is empty, it builds it.
 	 *
@@ -75,6 +144,55 @@ public:
 	 * If buffer is empty, it builds it with default parameters.
 	 */
 	string getIRCBuffer();
+
+	/** Render picture in a context.
+	 *
+	 * Nothing is cached in the CacaImage instance, and the returned
+	 * buffer is only valid until the next render in this context.
+	 *
+	 * @param ctx  render context
+	 * @param width  render's text width
+	 * @param height  render's text height
+	 * @param output_type  libcaca export format ("irc", "ansi", ...)
+	 * @param font_width  font width
+	 * @param font_height  font height
+	 * @return  buffer of picture.
+	 */
+	const string& draw(CacaContext& ctx, unsigned width, unsigned height = 0, const char* output_type = "irc", unsigned font_width = 6, unsigned font_height = 10) const;
+
+	/** Render a picture file to an ASCII art picture.
+	 *
+	 * Renders are kept in a LRU cache, keyed by the file (path, size and
+	 * modification time) and the render parameters, so the file is only
+	 * decoded and dithered once.
+	 *
+	 * If the picture is in cache, the callback is called immediately.
+	 * Otherwise, it is decoded and dithered by a worker thread, and the
+	 * callback is called from the main loop once it is done.
+	 *
+	 * The callback is deleted after being called, but not the
+	 * CacaRender instance, which is usually its data.
+	 *
+	 * @param render  the picture to render, result is stored in it
+	 * @param callback  called when render->status is set
+	 */
+	static void render(CacaRender* render, _CallBack* callback);
+
+	/** Cancel a render whose callback hasn't been called yet.
+	 *
+	 * The callback is deleted without being called, and the CacaRender
+	 * instance is deleted once the worker thread is done with it.
+	 */
+	static void cancel(CacaRender* render);
+
+	/** Mutex serializing calls to imlib2 with the render thread.
+	 *
+	 * The imlib2 context is global, so every imlib2 call done outside
+	 * of this class has to hold it:
+	 *
+	 * BlockLockMutex lock(&CacaImage::imlibMutex());
+	 */
+	static const Mutex& imlibMutex();
 };
 
 #endif /* CACA_IMAGE_H */
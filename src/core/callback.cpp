@@ -16,7 +16,11 @@
  * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
 
+#include <typeinfo>
+
 #include "callback.h"
+#include "latency.h"
+#include "watchdog.h"
 #include "log.h"
 
 static bool _callback(void* data)
@@ -31,15 +35,37 @@ static bool _callback(void* data)
 	return cb->run();
 }
 
+/* The callback may delete itself, so its type is read before. */
+static const char* callback_type(void* data)
+{
+	return data ? typeid(*static_cast<_CallBack*>(data)).name() : NULL;
+}
 
 void g_callback_input(void* data, gint src, PurpleInputCondition i)
 {
+	static Histogram& latency = Latency::get("glib.input");
+	const char* type = callback_type(data);
+	uint64_t start = Latency::now();
+
 	_callback(data);
+
+	uint64_t elapsed = Latency::now() - start;
+	latency.record(elapsed);
+	Watchdog::check(elapsed, "input", src, type);
 }
 
 gboolean g_callback(void* data)
 {
-	return _callback(data);
+	static Histogram& latency = Latency::get("glib.timeout");
+	const char* type = callback_type(data);
+	uint64_t start = Latency::now();
+
+	gboolean ret = _callback(data);
+
+	uint64_t elapsed = Latency::now() - start;
+	latency.record(elapsed);
+	Watchdog::check(elapsed, "timeout", -1, type);
+	return ret;
 }
 
 gboolean g_callback_delete(void* data)
@@ -51,7 +77,16 @@ gboolean g_callback_delete(void* data)
 		return false;
 	}
 
+	static Histogram& latency = Latency::get("glib.timeout");
+	const char* type = callback_type(data);
+	uint64_t start = Latency::now();
+
 	bool ret = cb->run();
+
+	uint64_t elapsed = Latency::now() - start;
+	latency.record(elapsed);
+	Watchdog::check(elapsed, "timeout", -1, type);
+
 	if(!ret)
 		delete cb;
 	return ret;
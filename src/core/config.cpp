@@ -19,6 +19,7 @@
 #include <fstream>
 #include <iostream>
 #include "config.h"
+#include "util.h"
 
 MyConfig conf;
 
@@ -36,20 +37,18 @@ MyConfig conf;
 	for(T::iterator x = x##lb; x != x##ub; ++x)
 #define Error(x) do { std::cerr << path << ":" << line_count << ": " << x << std::endl ; error = true; } while(0)
 
-std::string stringtok(std::string &in, const char * const delimiters = " \t\n");
-
 			/********************************************************************************************
 			 *                                Config                                                    *
 			 ********************************************************************************************/
 
 MyConfig::MyConfig(std::string _path)
-			: path(_path), loaded(false)
+			: path(_path), loaded(false), generation(0)
 {
 
 }
 
 MyConfig::MyConfig()
-			: loaded(false)
+			: loaded(false), generation(0)
 {
 
 }
@@ -100,7 +99,9 @@ bool MyConfig::Load(std::string _path)
 				Error("We aren't in a section !");
 				continue;
 			}
-			std::string label = stringtok(ligne, " ");
+			StringTokenizer tok(ligne, " ");
+			std::string label = tok.next();
+			ligne = tok.rest();
 			ConfigItem* item = section->GetItem(label);
 			if(!item)
 			{
@@ -161,7 +162,7 @@ bool MyConfig::Load(std::string _path)
 		}
 		else
 		{
-			std::string tab = stringtok(ligne, " ");
+			std::string tab = StringTokenizer(ligne, " ").next();
 			if(!section)
 				section = GetSection(tab);
 			else
@@ -192,6 +193,9 @@ bool MyConfig::Load(std::string _path)
 	if(FindEmpty())				  // Find empty sections
 		error = true;
 
+	/* Values have changed, even if there is an error. */
+	++generation;
+
 	if(!error)
 		loaded = true;
 	return !error;
@@ -442,3 +446,19 @@ void ConfigSection::AddItem(ConfigItem* item, bool is_name) throw(MyConfig::erro
 		throw;
 	}
 }
+
+			/********************************************************************************************
+			 *                                ConfigItemHandle                                          *
+			 ********************************************************************************************/
+
+void ConfigItemHandle::Resolve() const
+{
+	ConfigSection* s = config->GetSection(section);
+	ConfigItem* i = s ? s->GetItem(label) : 0;
+
+	if(!i)
+		throw MyConfig::error_exc(std::string("Item ") + section + "/" + label + " does not exist");
+
+	item = i;
+	generation = config->Generation();
+}
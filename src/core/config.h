@@ -16,8 +16,8 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
-/* !WARNING! This library must be used in a program with this function :
- *           * std::string stringtok(std::string &in, const char * const delimiters);
+/* !WARNING! This library must be used in a program with the
+ *           StringTokenizer class of util.h.
  */
 
 #ifndef PF_CONFIG_H
@@ -177,10 +177,17 @@ public:
 	unsigned NbLines() const { return line_count; }
 	std::string Path() const { return path; }
 
+	/** Generation of the configuration.
+	 * It is incremented every time the configuration is (re)loaded, so
+	 * cached values can know when they are outdated (see ConfigItemHandle).
+	 */
+	unsigned Generation() const { return generation; }
+
 private:
 	ConfigSection* AddSection(ConfigSection*);
 	std::string path;
 	bool loaded;
+	unsigned generation;
 	SectionMap sections;
 	unsigned int line_count;
 };
@@ -525,5 +532,83 @@ private:
 	bool value;
 };
 
+/********************************************************************************************
+ *                                ConfigItemHandle                                          *
+ ********************************************************************************************/
+/** This is a handle on an item of a head-section.
+ *
+ * The item is looked up only once per configuration generation, so reading it
+ * in a hot path costs a comparison and a pointer dereference instead of two
+ * map lookups with temporary strings.
+ *
+ * <pre>
+ * static ConfigBoolHandle dcc_enabled(&conf, "file_transfers", "dcc");
+ * ...
+ * if(dcc_enabled.Value())
+ *    ...
+ * </pre>
+ */
+class ConfigItemHandle
+{
+public:
+	/** @param _config  the MyConfig instance (it is not used before the first read)
+	 * @param _section  label of the head-section
+	 * @param _label  label of the item
+	 */
+	ConfigItemHandle(MyConfig* _config, const char* _section, const char* _label)
+		: config(_config), section(_section), label(_label), item(0), generation(0)
+		{}
+
+	virtual ~ConfigItemHandle() {}
+
+	/** Get the item, resolving it again if the configuration has been reloaded. */
+	ConfigItem* Item() const
+	{
+		if(!item || generation != config->Generation())
+			Resolve();
+		return item;
+	}
+
+	ConfigItem* operator->() const { return Item(); }
+
+protected:
+	/** Look up the item. It throws a MyConfig::error_exc if it does not exist. */
+	virtual void Resolve() const;
+
+private:
+	MyConfig* config;
+	const char* section;
+	const char* label;
+	mutable ConfigItem* item;
+	mutable unsigned generation;
+};
+
+/** Typed handle on an item, whose value is read once per configuration generation. */
+template<typename T, T (ConfigItem::*Getter)() const>
+class ConfigValueHandle : public ConfigItemHandle
+{
+public:
+	ConfigValueHandle(MyConfig* _config, const char* _section, const char* _label)
+		: ConfigItemHandle(_config, _section, _label), value()
+		{}
+
+	const T& Value() const { Item(); return value; }
+	operator const T&() const { return Value(); }
+
+protected:
+	virtual void Resolve() const
+	{
+		ConfigItemHandle::Resolve();
+		value = (Item()->*Getter)();
+	}
+
+private:
+	mutable T value;
+};
+
+typedef ConfigValueHandle<std::string, &ConfigItem::String> ConfigStringHandle;
+typedef ConfigValueHandle<int, &ConfigItem::Integer> ConfigIntHandle;
+typedef ConfigValueHandle<bool, &ConfigItem::Boolean> ConfigBoolHandle;
+
 extern MyConfig conf;
 #endif						  /* LIBCONFIG_H */
@@ -0,0 +1,149 @@
+/*
+ * Minbif - IRC instant messaging gateway
+ * Copyright(C) 2009 Romain Bignon
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+#include <syslog.h>
+#include <time.h>
+
+#include "latency.h"
+
+Histogram::Histogram()
+{
+	reset();
+}
+
+void Histogram::reset()
+{
+	memset(buckets, 0, sizeof buckets);
+	count = sum = max = 0;
+}
+
+unsigned Histogram::index(uint64_t us)
+{
+	if(us < LINEAR)
+		return (unsigned)us;
+
+	if(us >> MAX_BITS)
+		us = ((uint64_t)1 << MAX_BITS) - 1;
+
+	unsigned e = SUB_BITS + 1;
+	while(us >> (e + 1))
+		++e;
+
+	unsigned sub = (unsigned)(us >> (e - SUB_BITS)) & ((1 << SUB_BITS) - 1);
+	return LINEAR + (e - SUB_BITS - 1) * (1 << SUB_BITS) + sub;
+}
+
+uint64_t Histogram::highest(unsigned i)
+{
+	if(i < LINEAR)
+		return i;
+
+	unsigned e = (i - LINEAR) / (1 << SUB_BITS) + SUB_BITS + 1;
+	unsigned sub = (i - LINEAR) % (1 << SUB_BITS);
+	uint64_t low = (uint64_t)((1 << SUB_BITS) + sub) << (e - SUB_BITS);
+	return low + ((uint64_t)1 << (e - SUB_BITS)) - 1;
+}
+
+void Histogram::record(uint64_t us)
+{
+	buckets[index(us)]++;
+	count++;
+	sum += us;
+	if(us > max)
+		max = us;
+}
+
+uint64_t Histogram::getPercentile(double p) const
+{
+	if(!count)
+		return 0;
+
+	uint64_t target = (uint64_t)(count * p / 100.0 + 0.5);
+	if(target < 1)
+		target = 1;
+
+	uint64_t seen = 0;
+	for(unsigned i = 0; i < NBUCKETS; ++i)
+	{
+		seen += buckets[i];
+		if(seen >= target)
+			return highest(i) < max ? highest(i) : max;
+	}
+	return max;
+}
+
+string Histogram::format() const
+{
+	std::ostringstream oss;
+	oss << "count=" << count
+	    << " mean=" << Latency::formatDuration(getMean())
+	    << " p50=" << Latency::formatDuration(getPercentile(50))
+	    << " p90=" << Latency::formatDuration(getPercentile(90))
+	    << " p99=" << Latency::formatDuration(getPercentile(99))
+	    << " max=" << Latency::formatDuration(max);
+	return oss.str();
+}
+
+map<string, Histogram*>& Latency::histograms()
+{
+	/* Never freed, as references are kept in static variables. */
+	static map<string, Histogram*>* all = new map<string, Histogram*>;
+	return *all;
+}
+
+Histogram& Latency::get(const string& name)
+{
+	Histogram*& h = histograms()[name];
+	if(!h)
+		h = new Histogram;
+	return *h;
+}
+
+void Latency::reset()
+{
+	for(map<string, Histogram*>::iterator it = histograms().begin(); it != histograms().end(); ++it)
+		it->second->reset();
+}
+
+void Latency::dump(const string& prefix)
+{
+	for(map<string, Histogram*>::iterator it = histograms().begin(); it != histograms().end(); ++it)
+		if(it->second->getCount())
+			syslog(LOG_INFO, "[LATENCY] %s%s %s", prefix.c_str(), it->first.c_str(),
+			       it->second->format().c_str());
+}
+
+uint64_t Latency::now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+string Latency::formatDuration(uint64_t us)
+{
+	std::ostringstream oss;
+	if(us < 10000)
+		oss << us << "us";
+	else
+		oss << std::fixed << std::setprecision(1) << us / 1000.0 << "ms";
+	return oss.str();
+}
@@ -0,0 +1,132 @@
+/*
+ * Minbif - IRC instant messaging gateway
+ * Copyright(C) 2009 Romain Bignon
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef CORE_LATENCY_H
+#define CORE_LATENCY_H
+
+#include <string>
+#include <map>
+#include <stdint.h>
+
+using std::string;
+using std::map;
+
+/** Distribution of durations, in microseconds.
+ *
+ * Values are counted in log-linear buckets: durations below 16µs are
+ * exact, and above each power of two is split in 8 buckets, so the
+ * error is under 12.5%. Recording a value is a few shifts and an
+ * increment.
+ */
+class Histogram
+{
+public:
+
+	static const unsigned SUB_BITS = 3;
+	static const unsigned LINEAR = 2 << SUB_BITS;
+	static const unsigned MAX_BITS = 40;          /**< larger values are clamped (about 12 days) */
+	static const unsigned NBUCKETS = LINEAR + (MAX_BITS - SUB_BITS - 1) * (1 << SUB_BITS);
+
+	Histogram();
+
+	void record(uint64_t us);
+	void reset();
+
+	uint64_t getCount() const { return count; }
+	uint64_t getMax() const { return max; }
+	uint64_t getMean() const { return count ? sum / count : 0; }
+
+	/** Get the value under which there are p percent of recorded values.
+	 *
+	 * @param p  percentile, between 0 and 100
+	 * @return  highest value of the bucket.
+	 */
+	uint64_t getPercentile(double p) const;
+
+	/** "count=... mean=... p50=... p90=... p99=... max=..." */
+	string format() const;
+
+private:
+
+	uint64_t buckets[NBUCKETS];
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+
+	static unsigned index(uint64_t us);
+	static uint64_t highest(unsigned index);
+};
+
+/** Named histograms of this process.
+ *
+ * Names are prefixed by the kind of the measured operation: "irc." for
+ * IRC commands, "purple." for libpurple UI ops, "glib." for main loop
+ * callbacks.
+ */
+class Latency
+{
+	static map<string, Histogram*>& histograms();
+
+public:
+
+	/** Get or create a histogram. The reference is valid until exit. */
+	static Histogram& get(const string& name);
+
+	static const map<string, Histogram*>& getAll() { return histograms(); }
+
+	/** Reset every histograms. */
+	static void reset();
+
+	/** Log every non-empty histograms to syslog.
+	 *
+	 * @param prefix  prepended to each line, to know which user it is
+	 */
+	static void dump(const string& prefix);
+
+	/** Monotonic clock, in microseconds. */
+	static uint64_t now();
+
+	/** "123us" or "12.3ms" */
+	static string formatDuration(uint64_t us);
+};
+
+/** Record the lifetime of this object in a histogram. */
+class LatencyTimer
+{
+	Histogram& histogram;
+	uint64_t start;
+
+public:
+
+	LatencyTimer(Histogram& h)
+		: histogram(h),
+		  start(Latency::now())
+	{}
+
+	~LatencyTimer()
+	{
+		histogram.record(Latency::now() - start);
+	}
+};
+
+/** Time the current scope. The histogram lookup is done only once. */
+#define LATENCY_SCOPE(name) \
+	static Histogram& latency_histogram_ = Latency::get(name); \
+	LatencyTimer latency_timer_(latency_histogram_)
+
+#endif /* CORE_LATENCY_H */
@@ -108,12 +108,13 @@ std::string Log::formatLoggedFlags() const
 
 void Log::setLoggedFlags(std::string s, bool _to_syslog)
 {
+	StringTokenizer tok(s, " ");
 	std::string token;
 
 	to_syslog = _to_syslog;
 	logged_flags = 0;
 
-	while((token = stringtok(s, " ")).empty() == false)
+	while(tok.next(token))
 	{
 		int i;
 		if(token == "ALL")
@@ -0,0 +1,73 @@
+/*
+ * Minbif - IRC instant messaging gateway
+ * Copyright(C) 2009 Romain Bignon
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <sstream>
+
+#include "metrics.h"
+
+Metrics::values_t& Metrics::values()
+{
+	/* Never freed, as references are kept in static variables. */
+	static values_t* all = new values_t;
+	return *all;
+}
+
+uint64_t& Metrics::get(const string& series)
+{
+	return values()[series];
+}
+
+void Metrics::reset()
+{
+	for(values_t::iterator it = values().begin(); it != values().end(); ++it)
+		it->second = 0;
+}
+
+string Metrics::series(const string& name, const string& label, const string& value)
+{
+	string s = name + "{" + label + "=\"";
+	for(string::const_iterator c = value.begin(); c != value.end(); ++c)
+		switch(*c)
+		{
+			case '\\': s += "\\\\"; break;
+			case '"':  s += "\\\""; break;
+			case '\n': s += "\\n";  break;
+			default:   s += *c;     break;
+		}
+	return s + "\"}";
+}
+
+string Metrics::format(const values_t& values)
+{
+	std::ostringstream oss;
+	string last;
+
+	/* The map is sorted, so series of a metric are together. */
+	for(values_t::const_iterator it = values.begin(); it != values.end(); ++it)
+	{
+		string name = it->first.substr(0, it->first.find('{'));
+		if(name != last)
+		{
+			bool counter = name.size() > 6 && name.compare(name.size() - 6, 6, "_total") == 0;
+			oss << "# TYPE " << name << (counter ? " counter" : " gauge") << "\n";
+			last = name;
+		}
+		oss << it->first << " " << it->second << "\n";
+	}
+	return oss.str();
+}
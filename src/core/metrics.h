@@ -0,0 +1,72 @@
+/*
+ * Minbif - IRC instant messaging gateway
+ * Copyright(C) 2009 Romain Bignon
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef CORE_METRICS_H
+#define CORE_METRICS_H
+
+#include <string>
+#include <map>
+#include <stdint.h>
+
+using std::string;
+using std::map;
+
+/** Counters of this process.
+ *
+ * A series is named as in the Prometheus text format, with its labels,
+ * for example 'minbif_auth_failures_total{mechanism="local"}'. Values
+ * are plain integers, as they are only updated from the main loop.
+ *
+ * In daemon fork mode, children send their counters to master, which
+ * exports the sum of them.
+ */
+class Metrics
+{
+public:
+
+	typedef map<string, uint64_t> values_t;
+
+	/** Get or create a series. The reference is valid until exit. */
+	static uint64_t& get(const string& series);
+
+	static const values_t& getAll() { return values(); }
+
+	/** Set every series to zero. */
+	static void reset();
+
+	/** Build the name of a series with one label. */
+	static string series(const string& name, const string& label, const string& value);
+
+	/** Format in the Prometheus text exposition format.
+	 *
+	 * Series whose name ends with "_total" are counters, the other
+	 * ones are gauges.
+	 */
+	static string format(const values_t& values);
+
+private:
+
+	static values_t& values();
+};
+
+/** Increment a series with a constant name. The lookup is done only once. */
+#define METRIC_ADD(name, n) \
+	do { static uint64_t& metric_ = Metrics::get(name); metric_ += (n); } while(0)
+#define METRIC_INC(name) METRIC_ADD(name, 1)
+
+#endif /* CORE_METRICS_H */
@@ -21,6 +21,7 @@
 #include <iostream>
 #include <fstream>
 #include <cstring>
+#include <climits>
 #include <sys/resource.h>
 #include <getopt.h>
 #include <sys/types.h>
@@ -32,6 +33,7 @@
 #include "log.h"
 #include "util.h"
 #include "im/im.h"
+#include "im/password_hash.h"
 #include "server_poll/poll.h"
 
 const char* infotxt[] = {
@@ -67,10 +69,16 @@ Minbif::Minbif()
 	add_server_block_common_params(sub);
 
 	sub = section->AddSection("daemon", "Daemon information", MyConfig::OPTIONAL);
-	sub->AddItem(new ConfigItem_string("bind", "IP address to listen on"));
+	sub->AddItem(new ConfigItem_string("bind", "IP addresses to listen on, separated by spaces"));
 	sub->AddItem(new ConfigItem_int("port", "Port to listen on", 1, 65535), true);
+	sub->AddItem(new ConfigItem_int("backlog", "Maximum length of the queue of pending connections", 1, 65535, "128"));
+	sub->AddItem(new ConfigItem_bool("reuseport", "Set SO_REUSEPORT on listening sockets", "false"));
 	sub->AddItem(new ConfigItem_bool("background", "Start minbif in background", "true"));
 	sub->AddItem(new ConfigItem_int("maxcon", "Maximum simultaneous connections", 0, 65535, "0"));
+	sub->AddItem(new ConfigItem_int("ratelimit", "Maximum connections per minute from one IP address", 0, 65535, "0"));
+	sub->AddItem(new ConfigItem_string("stats_socket", "Path to UNIX socket giving resources used by users", " "));
+	sub->AddItem(new ConfigItem_string("metrics_bind", "IP address of the Prometheus metrics exporter", "127.0.0.1"));
+	sub->AddItem(new ConfigItem_int("metrics_port", "Port of the Prometheus metrics exporter", 0, 65535, "0"));
 	add_server_block_common_params(sub);
 
 	sub = section->AddSection("oper", "Define an IRC operator", MyConfig::MULTIPLE);
@@ -85,17 +93,21 @@ Minbif::Minbif()
 	section->AddItem(new ConfigItem_bool("pam_setuid", "Child process setuid with the pam user (needs root and pam auth)", "false"));
 #endif
 	section->AddItem(new ConfigItem_bool("use_connection", "Use connection information to authenticate/authorize users", "false"));
+	section->AddItem(new ConfigItem_int("password_iterations", "Number of PBKDF2 iterations to hash local passwords", 1000, 100000000, "50000"));
 
 	section = conf.AddSection("file_transfers", "File transfers parameters", MyConfig::OPTIONAL);
 	section->AddItem(new ConfigItem_bool("enabled", "Enable file transfers", "true"));
 	section->AddItem(new ConfigItem_bool("dcc", "Send files to IRC user with DCC", "true"));
 	section->AddItem(new ConfigItem_string("dcc_own_ip", "Force minbif to always send DCC requests from a particular IP address", " "));
 	section->AddItem(new ConfigItem_intrange("port_range", "Port range to listen on for DCC", 1024, 65535, "1024-65535"));
+	section->AddItem(new ConfigItem_bool("dcc_passive", "Ask IRC user to listen for DCC SEND (passive DCC)", "false"));
 
 	section = conf.AddSection("logging", "Log information", MyConfig::NORMAL);
 	section->AddItem(new ConfigItem_string("level", "Logging level"));
 	section->AddItem(new ConfigItem_bool("to_syslog", "Log error and warnings to syslog"));
 	section->AddItem(new ConfigItem_bool("conv_logs", "Enable conversation logging", "false"));
+	section->AddItem(new ConfigItem_int("stall_threshold", "Log callbacks taking more milliseconds than that", 0, 3600000, "500"));
+	section->AddItem(new ConfigItem_int("latency_dump", "Seconds between two dumps of latency histograms to syslog", 0, 86400, "0"));
 
 }
 
@@ -134,6 +146,32 @@ void Minbif::remove_pidfile(void)
 
 }
 
+bool Minbif::write_pidfile(void)
+{
+	if(pidfile.empty())
+		return true;
+
+	std::ofstream fo(pidfile.c_str());
+	if(!fo)
+	{
+		std::cerr << "Unable to create file '" << pidfile << "': " << strerror(errno) << std::endl;
+		return false;
+	}
+	fo << getpid() << std::endl;
+	fo.close();
+	return true;
+}
+
+/* Daemon changes its directory, so relative paths can't be used again. */
+static string absolute_path(const string& path)
+{
+	char cwd[PATH_MAX];
+
+	if(path.empty() || path[0] == '/' || !getcwd(cwd, sizeof cwd))
+		return path;
+	return string(cwd) + "/" + path;
+}
+
 void Minbif::usage(int argc, char** argv)
 {
 	std::cerr << "Usage: " << argv[0] << " [OPTIONS]... CONFIG_PATH" << std::endl << std::endl;
@@ -142,6 +180,7 @@ void Minbif::usage(int argc, char** argv)
 	std::cerr << "  -v, --version          Version of minbif" << std::endl;
 	std::cerr << "  -m, --mode=MODE        Mode to run (MODE is a number)" << std::endl;
 	std::cerr << "  -p, --pidfile=PIDFILE  Path to pid file" << std::endl;
+	std::cerr << "  -b, --bench-password   Measure the cost of password hashing and exit" << std::endl;
 }
 
 void Minbif::version(void)
@@ -150,6 +189,23 @@ void Minbif::version(void)
 		std::cout << infotxt[i] << std::endl;
 }
 
+void Minbif::bench_password(void)
+{
+	static const unsigned targets[] = { 50, 100, 250, 500 };
+	unsigned iterations = im::PasswordHash::getIterations();
+
+	/* The first run warms up caches. */
+	im::PasswordHash::benchmark(iterations);
+	double ms = im::PasswordHash::benchmark(iterations);
+	if(ms <= 0)
+		ms = 1;
+
+	std::cout << "PBKDF2-SHA256, " << iterations << " iterations: " << ms << " ms per login" << std::endl;
+	for(size_t i = 0; i < sizeof targets / sizeof *targets; ++i)
+		std::cout << "  password_iterations = " << (unsigned)(iterations * targets[i] / ms)
+		          << "\t# about " << targets[i] << " ms per login" << std::endl;
+}
+
 int Minbif::main(int argc, char** argv)
 {
 	static struct option long_options[] =
@@ -158,13 +214,18 @@ int Minbif::main(int argc, char** argv)
 		{ "help",          0, NULL, 'h' },
 		{ "version",       0, NULL, 'v' },
 		{ "mode",          1, NULL, 'm' },
+		{ "bench-password", 0, NULL, 'b' },
 		{ NULL,            0, NULL, 0   }
 	};
 	int option_index = 0, c;
 	int mode = -1;
-	while((c = getopt_long(argc, argv, "m:p:hv", long_options, &option_index)) != -1)
+	bool bench = false;
+	while((c = getopt_long(argc, argv, "m:p:hvb", long_options, &option_index)) != -1)
 		switch(c)
 		{
+		case 'b':
+			bench = true;
+			break;
 		case 'm':
 			mode = atoi(optarg);
 			break;
@@ -200,6 +261,11 @@ int Minbif::main(int argc, char** argv)
 		return EXIT_FAILURE;
 	}
 
+	/* A program name without any slash is searched in PATH. */
+	exec_args.push_back(strchr(argv[0], '/') ? absolute_path(argv[0]) : argv[0]);
+	for(int i = 1; i < argc; ++i)
+		exec_args.push_back(i == optind ? absolute_path(argv[i]) : argv[i]);
+
 	try
 	{
 		struct rlimit rlim;
@@ -217,6 +283,12 @@ int Minbif::main(int argc, char** argv)
 		}
 		b_log.setLoggedFlags(conf.GetSection("logging")->GetItem("level")->String(), conf.GetSection("logging")->GetItem("to_syslog")->Boolean());
 
+		if(bench)
+		{
+			bench_password();
+			return EXIT_SUCCESS;
+		}
+
 		/* Set users directory path and if I have rights to write in. */
 		im::IM::setPath(conf.GetSection("path")->GetItem("users")->String());
 
@@ -226,17 +298,8 @@ int Minbif::main(int argc, char** argv)
 		server_poll = ServerPoll::build((ServerPoll::poll_type_t)mode, this);
 		b_log.setServerPoll(server_poll);
 
-		if(!pidfile.empty())
-		{
-			std::ofstream fo(pidfile.c_str());
-			if(!fo)
-			{
-				std::cerr << "Unable to create file '" << pidfile << "': " << strerror(errno) << std::endl;
-				return EXIT_FAILURE;
-			}
-			fo << getpid() << std::endl;
-			fo.close();
-		}
+		if(!write_pidfile())
+			return EXIT_FAILURE;
 		sighandler.setApplication(this);
 
 /* g_thread_init() has been deprecated since glib 2.32 */
@@ -282,8 +345,26 @@ void Minbif::quit()
 	g_main_quit(loop);
 }
 
-int main(int argc, char** argv)
+void Minbif::upgrade()
+{
+	if(!server_poll || !server_poll->upgrade())
+		b_log[W_ERR] << "Upgrade is only available in daemon fork mode";
+}
+
+bool Minbif::exec()
 {
-	Minbif minbif;
-	return minbif.main(argc, argv);
+	vector<char*> args;
+	for(vector<string>::iterator it = exec_args.begin(); it != exec_args.end(); ++it)
+		args.push_back(const_cast<char*>(it->c_str()));
+	args.push_back(NULL);
+
+	/* The new process writes it again, and refuses to start if it exists. */
+	remove_pidfile();
+
+	b_log[W_INFO] << "Executing " << exec_args[0];
+	execvp(args[0], &args[0]);
+
+	b_log[W_ERR] << "Unable to execute " << exec_args[0] << ": " << strerror(errno);
+	write_pidfile();
+	return false;
 }
@@ -20,9 +20,11 @@
 #define MINBIF_H
 
 #include <string>
+#include <vector>
 #include "config.h"
 
 using std::string;
+using std::vector;
 
 class ServerPoll;
 struct _GMainLoop;
@@ -32,10 +34,13 @@ class Minbif
 	struct _GMainLoop *loop;
 	ServerPoll* server_poll;
 	string pidfile;
+	vector<string> exec_args;   /**< command line to execute on upgrade */
 
 	void add_server_block_common_params(ConfigSection* section);
 	void usage(int argc, char** argv);
 	void version(void);
+	void bench_password(void);
+	bool write_pidfile(void);
 	void remove_pidfile(void);
 
 public:
@@ -48,6 +53,16 @@ public:
 	void rehash();
 	void quit();
 
+	/** Ask server poll to replace this process with a new binary. */
+	void upgrade();
+
+	/** Execute minbif again, with the same command line.
+	 *
+	 * The process keeps its PID and every fds without FD_CLOEXEC.
+	 * @return  false if it has failed. Otherwise it doesn't return.
+	 */
+	bool exec();
+
 };
 
 #endif /* MINBIF_H */
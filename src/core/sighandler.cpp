@@ -47,6 +47,7 @@ void SigHandler::setApplication(Minbif* app)
 	sigaction(SIGCHLD, &sig, &old);
 	sigaction(SIGPIPE, &sig, &old);
 	sigaction(SIGHUP,  &sig, &old);
+	sigaction(SIGUSR2, &sig, &old);
 	sig.sa_flags = SA_RESETHAND;
 	sigaction(SIGINT,  &sig, &old);
 	sigaction(SIGILL,  &sig, &old);
@@ -70,6 +71,12 @@ bool SigHandler::quit(void*)
 	return false;
 }
 
+bool SigHandler::upgrade(void*)
+{
+	app->upgrade();
+	return false;
+}
+
 void SigHandler::handler(int r)
 {
 	/* A signal handler MUST NOT take time, and call any else function
@@ -91,6 +98,9 @@ void SigHandler::handler(int r)
 		case SIGHUP:
 			g_timeout_add(0, g_callback_delete, new CallBack<SigHandler>(&sighandler, &SigHandler::rehash));
 			break;
+		case SIGUSR2:
+			g_timeout_add(0, g_callback_delete, new CallBack<SigHandler>(&sighandler, &SigHandler::upgrade));
+			break;
 		case SIGTERM:
 			g_timeout_add(0, g_callback_delete, new CallBack<SigHandler>(&sighandler, &SigHandler::quit));
 			break;
@@ -30,6 +30,7 @@ class SigHandler
 
 	bool rehash(void*);    /**< rehash callback */
 	bool quit(void*);      /**< quit callback */
+	bool upgrade(void*);   /**< upgrade callback */
 
 public:
 
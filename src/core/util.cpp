@@ -25,33 +25,51 @@
 #include <cstdarg>
 
 #include "util.h"
-
-string stringtok(string &in, const char * const delimiters)
+#include "callback.h"
+#include "latency.h"
+#include "watchdog.h"
+
+StringTokenizer::StringTokenizer(const string& s, const char* _delimiters)
+	: str(s),
+	  delimiters(_delimiters),
+	  pos(0)
 {
-	string::size_type i = 0;
-	string s;
-
-	// eat leading whitespace
-	i = in.find_first_not_of (delimiters, i);
+}
 
-	// find the end of the token
-	string::size_type j = in.find_first_of (delimiters, i);
+bool StringTokenizer::next(string& token)
+{
+	string::size_type i = str.find_first_not_of(delimiters, pos);
+	if(i == string::npos)
+	{
+		pos = str.size();
+		token.clear();
+		return false;
+	}
 
-	if (j == string::npos)
+	string::size_type j = str.find_first_of(delimiters, i);
+	if(j == string::npos)
 	{
-		if(i == string::npos)
-			s = "";
-		else
-			s = in.substr(i);
-		in = "";
-		return s;			  // nothing left but white space
+		token.assign(str, i, string::npos);
+		pos = str.size();
+	}
+	else
+	{
+		token.assign(str, i, j - i);
+		pos = j + 1;
 	}
+	return true;
+}
 
-	// push token
-	s = in.substr(i, j-i);
-	in = in.substr(j+1);
+string StringTokenizer::next()
+{
+	string token;
+	next(token);
+	return token;
+}
 
-	return s;
+string StringTokenizer::rest() const
+{
+	return pos < str.size() ? str.substr(pos) : string();
 }
 
 typedef struct _PurpleGLibIOClosure {
@@ -70,16 +88,30 @@ static void purple_glib_io_destroy(gpointer data)
 
 static gboolean purple_glib_io_invoke(GIOChannel *source, GIOCondition condition, gpointer data)
 {
+        static Histogram& latency = Latency::get("glib.purple_input");
         PurpleGLibIOClosure *closure = (PurpleGLibIOClosure*)data;
         PurpleInputCondition purple_cond = (PurpleInputCondition)0;
+        gint fd = g_io_channel_unix_get_fd(source);
+        guint source_id = closure->result;
 
         if (condition & PURPLE_GLIB_READ_COND)
                 purple_cond = (PurpleInputCondition)(purple_cond|PURPLE_INPUT_READ);
         if (condition & PURPLE_GLIB_WRITE_COND)
                 purple_cond = (PurpleInputCondition)(purple_cond|PURPLE_INPUT_WRITE);
 
-        closure->function(closure->data, g_io_channel_unix_get_fd(source),
-                          purple_cond);
+        /* g_callback_input() watches our own callbacks. */
+        if (closure->function == g_callback_input)
+        {
+                closure->function(closure->data, fd, purple_cond);
+                return TRUE;
+        }
+
+        uint64_t start = Latency::now();
+        closure->function(closure->data, fd, purple_cond);
+        uint64_t elapsed = Latency::now() - start;
+
+        latency.record(elapsed);
+        Watchdog::check(elapsed, "purple input", fd, NULL, source_id);
 
         return TRUE;
 }
@@ -107,6 +139,36 @@ guint glib_input_add(gint fd, PurpleInputCondition condition, PurpleInputFunctio
         return closure->result;
 }
 
+typedef struct _PurpleGLibTimeoutClosure {
+	GSourceFunc function;
+	gpointer data;
+} PurpleGLibTimeoutClosure;
+
+static gboolean purple_glib_timeout_invoke(gpointer data)
+{
+	static Histogram& latency = Latency::get("glib.purple_timeout");
+	PurpleGLibTimeoutClosure *closure = (PurpleGLibTimeoutClosure*)data;
+	uint64_t start = Latency::now();
+
+	gboolean ret = closure->function(closure->data);
+
+	uint64_t elapsed = Latency::now() - start;
+	latency.record(elapsed);
+	Watchdog::check(elapsed, "purple timeout");
+	return ret;
+}
+
+guint glib_timeout_add(guint interval, GSourceFunc function, gpointer data)
+{
+	PurpleGLibTimeoutClosure *closure = g_new0(PurpleGLibTimeoutClosure, 1);
+
+	closure->function = function;
+	closure->data = data;
+
+	return g_timeout_add_full(G_PRIORITY_DEFAULT, interval, purple_glib_timeout_invoke,
+	                          closure, purple_glib_io_destroy);
+}
+
 
 string strupper(string s)
 {
@@ -190,43 +252,86 @@ static struct
 	{ "15", "light grey" },
 };
 
+/* Classes of chars which need a special processing by the converters. */
+enum
+{
+	C_MARKUP = 1 << 0,  /**< markup2irc(): tags, entities and spaces */
+	C_IRC    = 1 << 1,  /**< irc2markup(): IRC formatting codes */
+	C_ESCAPE = 1 << 2,  /**< irc2markup(): chars to escape */
+};
+
+static struct CharClasses
+{
+	unsigned char c[256];
+
+	CharClasses()
+	{
+		memset(c, 0, sizeof c);
+
+		const char* markup = "<&\n\r\t\v\f";
+		const char* irc = "\002\003\007\017\026\037";
+		const char* escape = "<>&\"";
+
+		for(const char* p = markup; *p; ++p)
+			c[(unsigned char)*p] |= C_MARKUP;
+		for(const char* p = irc; *p; ++p)
+			c[(unsigned char)*p] |= C_IRC;
+		for(const char* p = escape; *p; ++p)
+			c[(unsigned char)*p] |= C_ESCAPE;
+	}
+
+	bool is(char ch, int cls) const { return c[(unsigned char)ch] & cls; }
+} char_classes;
+
 /* Stolen from prpl-irc */
 gchar* irc2markup(const gchar* string)
 {
-	const char *cur, *end;
+	const char *cur;
 	char fg[3] = "\0\0", bg[3] = "\0\0";
 	int fgnum, bgnum;
-	int font = 0, bold = 0, underline = 0, italic = 0;
+	int font = 0, bold = 0, underline = 0;
 	GString *decoded;
 
 	if (string == NULL)
 		return NULL;
 
-	decoded = g_string_sized_new(strlen(string));
-
-	cur = string;
-	do {
-		char* tmp;
-		end = strpbrk(cur, "\002\003\007\017\026\037");
-
-		tmp = g_markup_escape_text(cur, end ? end - cur : -1);
-		decoded = g_string_append(decoded, tmp);
-		g_free(tmp);
-		cur = end ? end : cur + strlen(cur);
+	/* Fast path: nothing to escape nor to convert. */
+	for (cur = string; *cur && !char_classes.is(*cur, C_IRC|C_ESCAPE); ++cur)
+		;
+	if (!*cur)
+		return g_strdup(string);
+
+	decoded = g_string_sized_new(cur - string + strlen(cur) + 16);
+	g_string_append_len(decoded, string, cur - string);
+
+	while (*cur) {
+		const char* end = cur;
+		while (*end && !char_classes.is(*end, C_IRC|C_ESCAPE))
+			++end;
+		if (end != cur) {
+			g_string_append_len(decoded, cur, end - cur);
+			cur = end;
+			continue;
+		}
 
-		switch (*cur) {
+		switch (*cur++) {
+		case '&':
+			g_string_append_len(decoded, "&amp;", 5);
+			break;
+		case '<':
+			g_string_append_len(decoded, "&lt;", 4);
+			break;
+		case '>':
+			g_string_append_len(decoded, "&gt;", 4);
+			break;
+		case '"':
+			g_string_append_len(decoded, "&quot;", 6);
+			break;
 		case '\002':
-			cur++;
-			if (!bold) {
-				decoded = g_string_append(decoded, "<B>");
-				bold = TRUE;
-			} else {
-				decoded = g_string_append(decoded, "</B>");
-				bold = FALSE;
-			}
+			g_string_append(decoded, bold ? "</B>" : "<B>");
+			bold = !bold;
 			break;
 		case '\003':
-			cur++;
 			fg[0] = fg[1] = bg[0] = bg[1] = '\0';
 			if (isdigit(*cur))
 				fg[0] = *cur++;
@@ -240,170 +345,382 @@ gchar* irc2markup(const gchar* string)
 					bg[1] = *cur++;
 			}
 			if (font) {
-				decoded = g_string_append(decoded, "</FONT>");
+				g_string_append(decoded, "</FONT>");
 				font = FALSE;
 			}
 
 			if (fg[0]) {
 				fgnum = atoi(fg);
 				if (fgnum < 0 || fgnum > 15)
-					continue;
+					break;
 				font = TRUE;
-				g_string_append_printf(decoded, "<FONT COLOR=\"%s\"", irc_colors[fgnum].name);
+				g_string_append(decoded, "<FONT COLOR=\"");
+				g_string_append(decoded, irc_colors[fgnum].name);
+				g_string_append_c(decoded, '"');
 				if (bg[0]) {
 					bgnum = atoi(bg);
-					if (bgnum >= 0 && bgnum < 16)
-						g_string_append_printf(decoded, " BACK=\"%s\"", irc_colors[bgnum].name);
+					if (bgnum >= 0 && bgnum < 16) {
+						g_string_append(decoded, " BACK=\"");
+						g_string_append(decoded, irc_colors[bgnum].name);
+						g_string_append_c(decoded, '"');
+					}
 				}
-				decoded = g_string_append_c(decoded, '>');
-			}
-			break;
-		case '\011':
-			cur++;
-			if (!italic) {
-				decoded = g_string_append(decoded, "<I>");
-				italic = TRUE;
-			} else {
-				decoded = g_string_append(decoded, "</I>");
-				italic = FALSE;
+				g_string_append_c(decoded, '>');
 			}
 			break;
 		case '\037':
-			cur++;
-			if (!underline) {
-				decoded = g_string_append(decoded, "<U>");
-				underline = TRUE;
-			} else {
-				decoded = g_string_append(decoded, "</U>");
-				underline = FALSE;
-			}
-			break;
-		case '\007':
-		case '\026':
-			cur++;
+			g_string_append(decoded, underline ? "</U>" : "<U>");
+			underline = !underline;
 			break;
 		case '\017':
-			cur++;
-			/* fallthrough */
-		case '\000':
 			if (bold)
-				decoded = g_string_append(decoded, "</B>");
-			if (italic)
-				decoded = g_string_append(decoded, "</I>");
+				g_string_append(decoded, "</B>");
 			if (underline)
-				decoded = g_string_append(decoded, "</U>");
+				g_string_append(decoded, "</U>");
 			if (font)
-				decoded = g_string_append(decoded, "</FONT>");
+				g_string_append(decoded, "</FONT>");
+			bold = underline = font = FALSE;
 			break;
+		case '\007':
+		case '\026':
 		default:
-			purple_debug(PURPLE_DEBUG_ERROR, "irc", "Unexpected mIRC formatting character %d\n", *cur);
+			break;
 		}
-	} while (*cur);
+	}
+
+	if (bold)
+		g_string_append(decoded, "</B>");
+	if (underline)
+		g_string_append(decoded, "</U>");
+	if (font)
+		g_string_append(decoded, "</FONT>");
 
 	return g_string_free(decoded, FALSE);
 }
 
-gchar* markup2irc(const gchar* markup)
+/* Tags handled by markup2irc(). */
+enum tag_t
+{
+	TAG_UNKNOWN,
+	TAG_BOLD,
+	TAG_ITALIC,
+	TAG_UNDERLINE,
+	TAG_FONT,
+	TAG_BR,
+	TAG_BLOCK,   /**< new line, except at start of text */
+	TAG_TABLE,
+	TAG_TD,
+	TAG_A,
+	TAG_SCRIPT,
+	TAG_STYLE,
+};
+
+static struct
+{
+	const char* name;
+	tag_t tag;
+} markup_tags[] = {
+	{ "a",      TAG_A         },
+	{ "b",      TAG_BOLD      },
+	{ "br",     TAG_BR        },
+	{ "div",    TAG_BLOCK     },
+	{ "font",   TAG_FONT      },
+	{ "hr",     TAG_BLOCK     },
+	{ "i",      TAG_ITALIC    },
+	{ "li",     TAG_BLOCK     },
+	{ "p",      TAG_BLOCK     },
+	{ "script", TAG_SCRIPT    },
+	{ "style",  TAG_STYLE     },
+	{ "table",  TAG_TABLE     },
+	{ "td",     TAG_TD        },
+	{ "tr",     TAG_BLOCK     },
+	{ "u",      TAG_UNDERLINE },
+};
+
+static tag_t markup_find_tag(const char* name, size_t len)
+{
+	for(size_t i = 0; i < sizeof markup_tags / sizeof *markup_tags; ++i)
+		if(!g_ascii_strncasecmp(name, markup_tags[i].name, len) && markup_tags[i].name[len] == '\0')
+			return markup_tags[i].tag;
+	return TAG_UNKNOWN;
+}
+
+static const char* markup_find_color(const char* name, size_t len)
+{
+	for(size_t i = 0; i < sizeof irc_colors / sizeof *irc_colors; ++i)
+		if(!g_ascii_strncasecmp(name, irc_colors[i].name, len) && irc_colors[i].name[len] == '\0')
+			return irc_colors[i].num;
+	return NULL;
+}
+
+static struct
+{
+	const char* name;
+	const char* value;
+} markup_entities[] = {
+	{ "amp;",  "&"        },
+	{ "apos;", "'"        },
+	{ "copy;", "\302\251" },
+	{ "gt;",   ">"        },
+	{ "lt;",   "<"        },
+	{ "nbsp;", " "        },
+	{ "quot;", "\""       },
+	{ "reg;",  "\302\256" },
+};
+
+/** Decode an HTML entity.
+ *
+ * @param s  pointer on the '&' char
+ * @param out  string where the decoded entity is appended
+ * @return  length of the entity in \a s, or 0 if this isn't an entity.
+ */
+static size_t markup_unescape_entity(const char* s, GString* out)
 {
-	char* newline = purple_strdup_withhtml(markup);
-	GString* s = g_string_sized_new(strlen(newline));
-	gchar *ptr, *next, *buf;
+	if(s[1] == '#')
+	{
+		const char* p = s + 2;
+		char* end;
+		unsigned long c;
+
+		if(*p == 'x' || *p == 'X')
+			c = strtoul(++p, &end, 16);
+		else
+			c = strtoul(p, &end, 10);
+
+		/* Out of range values and surrogates would give invalid UTF-8. */
+		if(end == p || *end != ';' || c == 0 || c > 0x10FFFF || !g_unichar_validate((gunichar)c))
+			return 0;
+
+		g_string_append_unichar(out, (gunichar)c);
+		return end + 1 - s;
+	}
 
-	for(ptr = newline; *ptr; ptr = next)
+	for(size_t i = 0; i < sizeof markup_entities / sizeof *markup_entities; ++i)
 	{
-		next = g_utf8_next_char(ptr);
-		if(*ptr == '<')
+		size_t len = strlen(markup_entities[i].name);
+		if(!g_ascii_strncasecmp(s + 1, markup_entities[i].name, len))
 		{
-			bool closed = false;
+			g_string_append(out, markup_entities[i].value);
+			return len + 1;
+		}
+	}
+	return 0;
+}
+
+/** Parse the next attribute of a tag.
+ *
+ * @param p  pointer in the tag
+ * @param end  end of the tag
+ * @param name  will be set to the attribute name
+ * @param name_len  will be set to length of name
+ * @param value  will be set to the value (NULL if there isn't)
+ * @param value_len  will be set to length of value
+ * @return  pointer after this attribute.
+ */
+static const char* markup_next_attr(const char* p, const char* end,
+                                    const char** name, size_t* name_len,
+                                    const char** value, size_t* value_len)
+{
+	while(p < end && (g_ascii_isspace(*p) || *p == '/'))
+		++p;
+
+	*name = p;
+	while(p < end && !g_ascii_isspace(*p) && *p != '=')
+		++p;
+	*name_len = p - *name;
+
+	*value = NULL;
+	*value_len = 0;
+	if(p < end && *p == '=')
+	{
+		++p;
+		if(p < end && (*p == '"' || *p == '\''))
+		{
+			char delim = *p++;
+			*value = p;
+			while(p < end && *p != delim)
+				++p;
+			*value_len = p - *value;
+			if(p < end)
+				++p;
+		}
+		else
+		{
+			*value = p;
+			while(p < end && !g_ascii_isspace(*p))
+				++p;
+			*value_len = p - *value;
+		}
+	}
+	return p;
+}
+
+static bool markup_attr_is(const char* name, size_t len, const char* expected)
+{
+	return !g_ascii_strncasecmp(name, expected, len) && expected[len] == '\0';
+}
+
+gchar* markup2irc(const gchar* markup)
+{
+	const char *ptr;
+
+	if (markup == NULL)
+		return NULL;
+
+	/* Fast path: plain text. */
+	for(ptr = markup; *ptr && !char_classes.is(*ptr, C_MARKUP); ++ptr)
+		;
+	if(!*ptr)
+		return g_strdup(markup);
+
+	GString* s = g_string_sized_new(ptr - markup + strlen(ptr));
+	g_string_append_len(s, markup, ptr - markup);
+
+	const char* cdata_close = NULL;   /* skip until this closing tag (script, style) */
+	bool visible = true;              /* are spaces displayed? */
+	bool closing_td = false;
+	GString* href = NULL;
+	size_t href_start = 0;
+
+	while(*ptr)
+	{
+		const char* run = ptr;
+		while(*ptr && !char_classes.is(*ptr, C_MARKUP))
 			++ptr;
-			if(*ptr == '/')
+		if(ptr != run)
+		{
+			if(!visible)
+				while(run < ptr && *run == ' ')
+					++run;
+			if(!cdata_close && run < ptr)
 			{
-				closed = true;
-				++ptr;
+				g_string_append_len(s, run, ptr - run);
+				visible = true;
 			}
-			while(*next && *next != '>')
-				next = g_utf8_next_char(next);
-			if(*next)
-				next = g_utf8_next_char(next);
+			continue;
+		}
 
-			switch(*ptr)
+		switch(*ptr)
+		{
+			case '\r':
+				++ptr;
+				break;
+			case '\n':
+				++ptr;
+				if(!cdata_close)
+				{
+					g_string_append_c(s, '\n');
+					visible = true;
+					closing_td = false;
+				}
+				break;
+			case '&':
 			{
-				case 'i':
-				case 'I':
-					if(ptr+2 == next)
-						g_string_append(s, "\037\002");
-					break;
-				case 'u':
-				case 'U':
-					if(ptr+2 == next)
-						g_string_append_c(s, '\037');
-					break;
-				case 'B':
-				case 'b':
-					if(ptr+2 == next)
-						g_string_append_c(s, '\002');
-					else
+				size_t len = cdata_close ? 0 : markup_unescape_entity(ptr, s);
+				if(len)
+					ptr += len;
+				else
+				{
+					if(!cdata_close)
+						g_string_append_c(s, '&');
+					++ptr;
+				}
+				visible = true;
+				break;
+			}
+			case '<':
+			{
+				const char* tag = ptr + 1;
+				bool closed = false;
+
+				if(cdata_close)
+				{
+					size_t len = strlen(cdata_close);
+					if(!g_ascii_strncasecmp(tag, cdata_close, len))
 					{
-						g_string_append_c(s, '<');
-						if(closed)
-							g_string_append_c(s, '/');
-						g_string_append_len(s, ptr, next-ptr);
+						ptr = tag + len;
+						cdata_close = NULL;
 					}
+					else
+						++ptr;
 					break;
-				case 'F':
-				case 'f':
-					if(closed && !strncasecmp(ptr, "FONT", 4))
+				}
+
+				if(*tag == '\0' || g_ascii_isspace(*tag))
+				{
+					/* Not a tag. */
+					g_string_append_c(s, '<');
+					visible = true;
+					++ptr;
+					break;
+				}
+
+				if(*tag == '/')
+				{
+					closed = true;
+					++tag;
+				}
+
+				/* Find end of tag, skipping quoted values. */
+				const char* end = tag;
+				while(*end && *end != '<' && *end != '>')
+				{
+					if(*end == '"' || *end == '\'')
 					{
-						g_string_append_c(s, '\003');
-						break;
+						char delim = *end++;
+						while(*end && *end != delim)
+							++end;
+						if(!*end)
+							break;
 					}
-					else if(!closed && !strncasecmp(ptr, "FONT ", 5))
+					++end;
+				}
+
+				const char* name_end = tag;
+				while(name_end < end && (g_ascii_isalnum(*name_end)))
+					++name_end;
+
+				/* Formatting of unterminated tags is ignored. */
+				tag_t t = (*end == '>') ? markup_find_tag(tag, name_end - tag) : TAG_UNKNOWN;
+
+				if(t == TAG_TD && !closed && closing_td)
+					g_string_append_c(s, '\t');
+				closing_td = (t == TAG_TD && closed);
+				visible = !closing_td;
+
+				switch(t)
+				{
+					case TAG_BOLD:
+						g_string_append_c(s, '\002');
+						break;
+					case TAG_ITALIC:
+						g_string_append(s, "\037\002");
+						break;
+					case TAG_UNDERLINE:
+						g_string_append_c(s, '\037');
+						break;
+					case TAG_FONT:
 					{
-						const char *foreground = NULL, *background = NULL;
-						bool is_foreground;
-						gchar* space;
-
-						ptr += 5;
-						/* loop on all attributes of the FONT tag to get
-						 * IRC colors.
-						 */
-						while(*ptr && *ptr != '>')
+						if(closed)
 						{
-							unsigned i;
-							if(!strncasecmp(ptr, "color=", 6))
-							{
-								ptr += 6;
-								if(*ptr == '"') ++ptr;
-								is_foreground = true;
-							}
-							else if(!strncasecmp(ptr, "back=", 5))
-							{
-								ptr += 5;
-								if(*ptr == '"') ++ptr;
-								is_foreground = false;
-							}
-							else
-								break;
-
-							space = ptr;
-							while(*space && *space != '"')
-								space = g_utf8_next_char(space);
-							for(i = 0; i < sizeof irc_colors / sizeof *irc_colors; ++i)
-								if(!strncasecmp(ptr, irc_colors[i].name, space-ptr))
-								{
-									if(is_foreground)
-										foreground = irc_colors[i].num;
-									else
-										background = irc_colors[i].num;
-									break;
-								}
+							g_string_append_c(s, '\003');
+							break;
+						}
 
-							if(*space == '"')
-								++space;
+						/* Look for colors in the FONT attributes. */
+						const char *foreground = NULL, *background = NULL;
+						const char *attr = name_end, *name, *value;
+						size_t name_len, value_len;
 
-							ptr = space;
-							while(*ptr && *ptr == ' ')
-								ptr = g_utf8_next_char(ptr);
+						while(attr < end)
+						{
+							attr = markup_next_attr(attr, end, &name, &name_len, &value, &value_len);
+							if(!value)
+								continue;
+							if(markup_attr_is(name, name_len, "color"))
+								foreground = markup_find_color(value, value_len);
+							else if(markup_attr_is(name, name_len, "back"))
+								background = markup_find_color(value, value_len);
 						}
 
 						if(foreground)
@@ -418,25 +735,89 @@ gchar* markup2irc(const gchar* markup)
 						}
 						break;
 					}
-				default:
-					g_string_append_c(s, '<');
-					if(closed)
-						g_string_append_c(s, '/');
-					g_string_append_len(s, ptr, next-ptr);
-					continue;
+					case TAG_BR:
+						g_string_append_c(s, '\n');
+						break;
+					case TAG_BLOCK:
+						if(!closed && s->len > 0)
+							g_string_append_c(s, '\n');
+						break;
+					case TAG_TABLE:
+						if(closed)
+							g_string_append_c(s, '\n');
+						break;
+					case TAG_A:
+						if(!closed)
+						{
+							const char *attr = name_end, *name, *value = NULL;
+							size_t name_len, len = 0;
+
+							while(attr < end && !value)
+							{
+								attr = markup_next_attr(attr, end, &name, &name_len, &value, &len);
+								if(!markup_attr_is(name, name_len, "href"))
+									value = NULL;
+							}
+							if(value)
+							{
+								/* Save the address to display it after the link text. */
+								if(!href)
+									href = g_string_sized_new(len);
+								g_string_truncate(href, 0);
+								for(const char* p = value; p < value + len; )
+								{
+									size_t elen = (*p == '&') ? markup_unescape_entity(p, href) : 0;
+									if(elen)
+										p += elen;
+									else
+										g_string_append_c(href, *p++);
+								}
+								href_start = s->len;
+							}
+						}
+						else if(href && href->len > 0)
+						{
+							const char* text = s->str + href_start;
+							size_t text_len = s->len - href_start;
+
+							/* Only insert the address if it differs from the link text. */
+							if((href->len != text_len || strncmp(text, href->str, text_len)) &&
+							   (href->len != text_len + 7 || strncmp(text, href->str + 7, text_len)))
+							{
+								g_string_append(s, " (");
+								g_string_append_len(s, href->str, href->len);
+								g_string_append_c(s, ')');
+							}
+							g_string_truncate(href, 0);
+						}
+						break;
+					case TAG_SCRIPT:
+						if(!closed)
+							cdata_close = "/script>";
+						break;
+					case TAG_STYLE:
+						if(!closed)
+							cdata_close = "/style>";
+						break;
+					case TAG_TD:
+					case TAG_UNKNOWN:
+						break;
+				}
+
+				ptr = (*end == '>') ? end + 1 : end;
+				break;
 			}
+			default:
+				/* Other spaces */
+				if(!cdata_close && visible)
+					g_string_append_c(s, ' ');
+				++ptr;
+				break;
 		}
-		else
-			g_string_append_len(s, ptr, next-ptr);
 	}
-	g_free(newline);
 
-	/* Strip all other html tags */
-	newline = g_string_free(s, FALSE);
-	buf = purple_markup_strip_html(newline);
+	if(href)
+		g_string_free(href, TRUE);
 
-	g_free(newline);
-	return buf;
+	return g_string_free(s, FALSE);
 }
-
-
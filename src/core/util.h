@@ -23,7 +23,39 @@
 #include <sstream>
 using std::string;
 
-string stringtok(string &in, const char * const delimiters);
+/** Split a string into tokens separated by any of the delimiters.
+ *
+ * Only the position of the next token is kept: the string is neither
+ * modified nor copied, so splitting a whole buffer is linear. It is
+ * referenced, and must outlive the tokenizer. Empty tokens are skipped.
+ *
+ *   StringTokenizer tok(line, " ");
+ *   for(string word; tok.next(word);)
+ *       ...
+ */
+class StringTokenizer
+{
+	const string& str;
+	const char* delimiters;
+	string::size_type pos;
+
+public:
+
+	StringTokenizer(const string& s, const char* delimiters);
+
+	/** Get the next token.
+	 *
+	 * @param token  set to the token. Its buffer is reused.
+	 * @return  false if there isn't any token left.
+	 */
+	bool next(string& token);
+
+	/** Get the next token, or an empty string if there isn't any left. */
+	string next();
+
+	/** Get what follows the delimiter after the last token. */
+	string rest() const;
+};
 
 template<typename T>
 T s2t(const std::string & Str)
@@ -49,10 +81,29 @@ static inline string p2s(const char* s) { return s ? s : ""; }
 guint glib_input_add(gint fd, PurpleInputCondition condition, PurpleInputFunction function,
                                                            gpointer data);
 
+/** Same as g_timeout_add(), but the time taken by each call is checked
+ * by the Watchdog. Used for libpurple timeouts. */
+guint glib_timeout_add(guint interval, GSourceFunc function, gpointer data);
+
 string strupper(string s);
 string strlower(string s);
 
+/** Convert a libpurple HTML message to an IRC one.
+ *
+ * Known formatting tags are translated to IRC codes, entities are decoded
+ * and other tags are stripped, in a single pass.
+ *
+ * @return  a newly allocated string, to free with g_free().
+ */
 gchar* markup2irc(const gchar* markup);
+
+/** Convert an IRC message to libpurple HTML.
+ *
+ * IRC codes are translated to tags, and only '&', '<', '>' and '"' are
+ * escaped.
+ *
+ * @return  a newly allocated string, to free with g_free().
+ */
 gchar* irc2markup(const gchar* string);
 
 bool is_ip(const char *ip);
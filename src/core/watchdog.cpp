@@ -0,0 +1,135 @@
+/*
+ * Minbif - IRC instant messaging gateway
+ * Copyright(C) 2009 Romain Bignon
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <cstdlib>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <purple.h>
+#ifdef __GNUC__
+#include <cxxabi.h>
+#endif
+
+#include "watchdog.h"
+#include "latency.h"
+#include "config.h"
+#include "log.h"
+#include "util.h"
+
+static ConfigIntHandle stall_threshold(&conf, "logging", "stall_threshold");
+
+vector<Watchdog::stall_t> Watchdog::top;
+unsigned long Watchdog::count = 0;
+
+static string demangle(const char* name)
+{
+#ifdef __GNUC__
+	int status;
+	char* s = abi::__cxa_demangle(name, NULL, NULL, &status);
+	if(s)
+	{
+		string r = s;
+		free(s);
+		return r;
+	}
+#endif
+	return name;
+}
+
+string Watchdog::describe(const char* type, int fd, const char* object, unsigned source_id)
+{
+	string s = type;
+
+	if(object)
+		s += " " + demangle(object);
+
+	if(fd >= 0)
+	{
+		struct sockaddr_storage addr;
+		socklen_t len = sizeof addr;
+		char host[NI_MAXHOST], serv[NI_MAXSERV];
+
+		s += " fd=" + t2s(fd);
+		if(getpeername(fd, (struct sockaddr*)&addr, &len) == 0 &&
+		   getnameinfo((struct sockaddr*)&addr, len, host, sizeof host, serv, sizeof serv,
+			       NI_NUMERICHOST|NI_NUMERICSERV) == 0)
+			s += string(" peer=") + host + ":" + serv;
+	}
+
+	/* Most of protocols keep the id of their input watcher in the
+	 * connection. */
+	if(source_id)
+		for(GList* l = purple_connections_get_all(); l; l = l->next)
+		{
+			PurpleConnection* gc = (PurpleConnection*)l->data;
+			if(gc->inpa != source_id)
+				continue;
+
+			PurpleAccount* account = purple_connection_get_account(gc);
+			s += string(" account=") + purple_account_get_protocol_id(account) + ":"
+			                         + purple_account_get_username(account);
+			break;
+		}
+
+	return s;
+}
+
+void Watchdog::check(uint64_t us, const char* type, int fd, const char* object, unsigned source_id)
+{
+	int threshold = stall_threshold;
+	if(threshold <= 0 || us < (uint64_t)threshold * 1000)
+		return;
+
+	stall_t stall;
+	stall.when = time(NULL);
+	stall.us = us;
+	stall.source = describe(type, fd, object, source_id);
+	count++;
+
+	b_log[W_WARNING] << "Main loop stalled " << Latency::formatDuration(us) << " in " << stall.source;
+
+	/* Forget old ones, and insert this one at its place. */
+	vector<stall_t>::iterator it;
+	for(it = top.begin(); it != top.end();)
+		if(it->when + WINDOW < stall.when)
+			it = top.erase(it);
+		else
+			++it;
+
+	for(it = top.begin(); it != top.end() && it->us >= us; ++it)
+		;
+	top.insert(it, stall);
+	if(top.size() > TOP_SIZE)
+		top.pop_back();
+}
+
+const vector<Watchdog::stall_t>& Watchdog::getTop()
+{
+	time_t now = time(NULL);
+	for(vector<stall_t>::iterator it = top.begin(); it != top.end();)
+		if(it->when + WINDOW < now)
+			it = top.erase(it);
+		else
+			++it;
+	return top;
+}
+
+void Watchdog::reset()
+{
+	top.clear();
+	count = 0;
+}
@@ -0,0 +1,85 @@
+/*
+ * Minbif - IRC instant messaging gateway
+ * Copyright(C) 2009 Romain Bignon
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef CORE_WATCHDOG_H
+#define CORE_WATCHDOG_H
+
+#include <string>
+#include <vector>
+#include <time.h>
+#include <stdint.h>
+
+using std::string;
+using std::vector;
+
+/** Detection of main loop stalls.
+ *
+ * Every work of a minbif process is done in callbacks of the glib main
+ * loop, so one slow callback freezes the whole session. Dispatchers
+ * give the time taken by each callback; when it exceeds the
+ * logging/stall_threshold configuration item, the callback is logged
+ * and kept in a list of the slowest ones.
+ */
+class Watchdog
+{
+public:
+
+	struct stall_t
+	{
+		time_t when;
+		uint64_t us;
+		string source;
+	};
+
+	/** Number of slowest callbacks kept. */
+	static const size_t TOP_SIZE = 10;
+
+	/** Seconds a stall stays in the list. */
+	static const time_t WINDOW = 3600;
+
+	/** Check the duration of a callback.
+	 *
+	 * Nothing is done below the threshold, and the source is described
+	 * only above it.
+	 *
+	 * @param us  time taken, in microseconds
+	 * @param type  kind of callback ("timeout", "input", ...)
+	 * @param fd  watched fd, or -1
+	 * @param object  mangled type name of the object called, or NULL
+	 * @param source_id  glib source id, used to find the account
+	 */
+	static void check(uint64_t us, const char* type, int fd = -1,
+	                  const char* object = NULL, unsigned source_id = 0);
+
+	/** Slowest callbacks of the last hour, the slowest first. */
+	static const vector<stall_t>& getTop();
+
+	/** Number of stalls since start or reset. */
+	static unsigned long getCount() { return count; }
+
+	static void reset();
+
+private:
+
+	static vector<stall_t> top;
+	static unsigned long count;
+
+	static string describe(const char* type, int fd, const char* object, unsigned source_id);
+};
+
+#endif /* CORE_WATCHDOG_H */
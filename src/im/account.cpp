@@ -28,6 +28,10 @@
 #include "im/conversation.h"
 #include "im/buddy.h"
 #include "im/purple.h"
+#include "core/caca_image.h"
+#include "core/latency.h"
+#include "core/metrics.h"
+#include "core/mutex.h"
 #include "core/log.h"
 #include "core/version.h"
 #include "irc/irc.h"
@@ -259,40 +263,46 @@ void Account::setBuddyIcon(string filename)
 		{
 			GError* temp_error = NULL;
 #ifdef HAVE_IMLIB
-			Imlib_Image img = imlib_load_image(filename.c_str());
 			char* temp_filename = NULL;
+			{
+				/* The imlib2 context is shared with the render thread. */
+				BlockLockMutex lock(&CacaImage::imlibMutex());
+				Imlib_Image img = imlib_load_image(filename.c_str());
 
-			if (img) {
-				int temp_fd;
-
-				/* Create a stupid tmp file, write it, close it. Save image as png in it. Fuck it. */
-				temp_fd = g_file_open_tmp("minbif_new_icon_XXXXXX", &temp_filename, &temp_error);
-				if (temp_error) {
-					b_log[W_ERR] << "Unable to create a temporary file: " << temp_error->message;
-					g_error_free(temp_error);
-					temp_filename = NULL;
-				}
-				else
-				{
-					char** prpl_formats = g_strsplit(prplinfo->icon_spec.format,",",0);
-					Imlib_Load_Error err = IMLIB_LOAD_ERROR_UNKNOWN;
+				if (img) {
+					int temp_fd;
 
-					close(temp_fd);
-					/* Try to encode in a supported format. */
 					imlib_context_set_image(img);
-					for (size_t i = 0; prpl_formats[i] && err != IMLIB_LOAD_ERROR_NONE; ++i)
-					{
-						imlib_image_set_format(prpl_formats[i]);
-						imlib_save_image_with_error_return(temp_filename, &err);
-					}
 
-					if (err != IMLIB_LOAD_ERROR_NONE)
-						b_log[W_ERR] << "Unable to encode image for " << getID();
+					/* Create a stupid tmp file, write it, close it. Save image as png in it. Fuck it. */
+					temp_fd = g_file_open_tmp("minbif_new_icon_XXXXXX", &temp_filename, &temp_error);
+					if (temp_error) {
+						b_log[W_ERR] << "Unable to create a temporary file: " << temp_error->message;
+						g_error_free(temp_error);
+						temp_error = NULL;
+						temp_filename = NULL;
+					}
 					else
-						filename = temp_filename;
-					g_strfreev(prpl_formats);
+					{
+						char** prpl_formats = g_strsplit(prplinfo->icon_spec.format,",",0);
+						Imlib_Load_Error err = IMLIB_LOAD_ERROR_UNKNOWN;
+
+						close(temp_fd);
+						/* Try to encode in a supported format. */
+						for (size_t i = 0; prpl_formats[i] && err != IMLIB_LOAD_ERROR_NONE; ++i)
+						{
+							imlib_image_set_format(prpl_formats[i]);
+							imlib_save_image_with_error_return(temp_filename, &err);
+						}
+
+						if (err != IMLIB_LOAD_ERROR_NONE)
+							b_log[W_ERR] << "Unable to encode image for " << getID();
+						else
+							filename = temp_filename;
+						g_strfreev(prpl_formats);
+					}
+					imlib_free_image();
 				}
-				imlib_free_image();
 			}
 
 #endif /* HAVE_IMLIB */
@@ -454,8 +464,9 @@ void Account::flushChannelJoins()
 {
 	assert(isValid());
 	string list = purple_account_get_ui_string(account, MINBIF_VERSION_NAME, "join_queue", "");
+	StringTokenizer tok(list, ",");
 	string cname;
-	while((cname = stringtok(list, ",")).empty() == false)
+	while(tok.next(cname))
 		this->joinChat(cname, "");
 	purple_account_set_ui_string(account, MINBIF_VERSION_NAME, "join_queue", "");
 }
@@ -468,9 +479,10 @@ void Account::abortChannelJoins()
 	{
 		irc::IRC* irc = Purple::getIM()->getIRC();
 		string list = purple_account_get_ui_string(account, MINBIF_VERSION_NAME, "join_queue", "");
+		StringTokenizer tok(list, ",");
 		string cname;
 
-		while((cname = stringtok(list, ",")).empty() == false)
+		while(tok.next(cname))
 			irc->getUser()->send(irc::Message(ERR_NOSUCHCHANNEL).setSender(irc)
 									    .setReceiver(irc->getUser())
 									    .addArg("#" + cname + ":" + getID())
@@ -505,34 +517,66 @@ bool Account::isConnecting() const
 	return purple_account_is_connecting(account);
 }
 
-vector<Buddy> Account::getBuddies() const
+void Account::foreachBuddy(BuddyFunc func, void* data) const
 {
 	assert(isValid());
-	vector<Buddy> buddies;
-	if(!purple_get_blist())
-		return buddies;
-
-	GSList* bl = purple_find_buddies(account, NULL);
-	GSList* cur;
+	PurpleBuddyList* blist = purple_get_blist();
+	if(!blist)
+		return;
 
-	for(cur = bl; cur != NULL; cur = cur->next)
+	for(PurpleBlistNode* gnode = blist->root; gnode; gnode = gnode->next)
 	{
-		if(!PURPLE_BLIST_NODE_IS_BUDDY((PurpleBlistNode*)cur->data))
+		if(!PURPLE_BLIST_NODE_IS_GROUP(gnode))
 			continue;
-		PurpleBuddy* b = (PurpleBuddy*)cur->data;
-		buddies.push_back(Buddy(b));
+
+		for(PurpleBlistNode* cnode = gnode->child; cnode; cnode = cnode->next)
+		{
+			if(!PURPLE_BLIST_NODE_IS_CONTACT(cnode))
+				continue;
+
+			for(PurpleBlistNode* bnode = cnode->child; bnode; bnode = bnode->next)
+			{
+				if(!PURPLE_BLIST_NODE_IS_BUDDY(bnode) || ((PurpleBuddy*)bnode)->account != account)
+					continue;
+
+				if(!func(Buddy((PurpleBuddy*)bnode), data))
+					return;
+			}
+		}
 	}
-	g_slist_free(bl);
+}
+
+static bool buddy_push_back(const Buddy& buddy, void* data)
+{
+	static_cast<vector<Buddy>*>(data)->push_back(buddy);
+	return true;
+}
 
+vector<Buddy> Account::getBuddies() const
+{
+	vector<Buddy> buddies;
+	foreachBuddy(buddy_push_back, &buddies);
 	return buddies;
 }
 
+static bool buddy_enqueue_update(const Buddy& buddy, void*)
+{
+	buddy.enqueueUpdate();
+	return true;
+}
+
+static bool buddy_part(const Buddy& buddy, void* data)
+{
+	irc::Buddy* n = buddy.getNick();
+	if(n)
+		n->part(static_cast<irc::StatusChannel*>(data), "Leaving status channel");
+	return true;
+}
+
 void Account::updatedAllBuddies() const
 {
 	assert(isValid());
-	vector<Buddy> buddies = getBuddies();
-	for(vector<Buddy>::iterator it = buddies.begin(); it != buddies.end(); ++it)
-		it->updated();
+	foreachBuddy(buddy_enqueue_update);
 }
 
 void Account::displayRoomList() const
@@ -634,9 +678,7 @@ void Account::createStatusChannel()
 
 	chan->addAccount(*this);
 
-	vector<Buddy> buddies = getBuddies();
-	for(vector<Buddy>::iterator b = buddies.begin(); b != buddies.end(); ++b)
-		b->updated();
+	foreachBuddy(buddy_enqueue_update);
 }
 
 void Account::leaveStatusChannel()
@@ -650,13 +692,14 @@ void Account::leaveStatusChannel()
 
 	chan->removeAccount(*this);
 
-	vector<Buddy> buddies = getBuddies();
-	for(vector<Buddy>::iterator b = buddies.begin(); b != buddies.end(); ++b)
-		if(b->getNick())
-			b->getNick()->part(chan, "Leaving status channel");
-
+	/* When the channel is destroyed, every users leave it anyway. */
 	if(chan->countAccounts() == 0)
+	{
+		chan->setPartReason("Leaving status channel");
 		irc->removeChannel(chan->getName());
+	}
+	else
+		foreachBuddy(buddy_part, chan);
 }
 
 vector<string> Account::getDenyList() const
@@ -848,14 +891,16 @@ bool Account::joinChat(const string& name, const string& parameters) const
 		hash = info->chat_info_defaults(gc, name.c_str());
 
 	/* Parse parameters */
-	string param, params = parameters;
-	while((param = stringtok(params, ";")).empty() == false)
+	StringTokenizer params(parameters, ";");
+	string param;
+	while(params.next(param))
 	{
-		string key = stringtok(param, "=");
+		StringTokenizer key_value(param, "=");
+		string key = key_value.next();
 		if(key.empty()) continue;
 		g_hash_table_replace(hash,
 				g_strdup(key.c_str()),
-				g_strdup(param.c_str()));
+				g_strdup(key_value.rest().c_str()));
 	}
 
 	chat = purple_chat_new(account, name.c_str(), hash);
@@ -963,6 +1008,7 @@ void Account::uninit()
 gboolean Account::reconnect(void* data)
 {
 	Account acc((PurpleAccount*)data);
+	Metrics::get(Metrics::series("minbif_account_reconnects_total", "protocol", purple_account_get_protocol_id(acc.account)))++;
 	purple_account_set_ui_int(acc.account, MINBIF_VERSION_NAME, "id-reconnect", -1);
 	acc.connect();
 	return FALSE;
@@ -1185,7 +1231,9 @@ void Account::connecting(PurpleConnection *gc,
 
 void Account::connected(PurpleConnection* gc)
 {
+	LATENCY_SCOPE("purple.connected");
 	Account account = Account(gc->account);
+	Metrics::get(Metrics::series("minbif_account_connects_total", "protocol", purple_account_get_protocol_id(gc->account)))++;
 	account.removeReconnection();
 	irc::IRC* irc = Purple::getIM()->getIRC();
 
@@ -1196,6 +1244,7 @@ void Account::connected(PurpleConnection* gc)
 
 void Account::account_signed_on_cb(PurpleConnection *gc, gpointer event)
 {
+	LATENCY_SCOPE("purple.signed_on");
 	Account account = Account(gc->account);
 	GList* list = purple_get_chats();
 
@@ -1230,7 +1279,9 @@ void Account::account_signed_on_cb(PurpleConnection *gc, gpointer event)
 
 void Account::disconnected(PurpleConnection* gc)
 {
+	LATENCY_SCOPE("purple.disconnected");
 	Account account = Account(gc->account);
+	Metrics::get(Metrics::series("minbif_account_disconnects_total", "protocol", purple_account_get_protocol_id(gc->account)))++;
 	GList* list = purple_get_chats();
 	GList* next = NULL;
 
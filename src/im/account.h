@@ -190,10 +190,31 @@ namespace im
 		/** Call a command. */
 		bool callCommand(const string& command) const;
 
-		/** \todo TODO implement it */
+		/** Function called on buddies by foreachBuddy().
+		 *
+		 * @return  false to stop iteration.
+		 */
+		typedef bool (*BuddyFunc)(const Buddy& buddy, void* data);
+
+		/** Call a function on every buddies of this account.
+		 *
+		 * Buddies are read directly from the buddy list, without
+		 * building any temporary list. The function must not remove
+		 * any node from the buddy list.
+		 *
+		 * @param func  function to call
+		 * @param data  user data given to function
+		 */
+		void foreachBuddy(BuddyFunc func, void* data = NULL) const;
+
+		/** Get a copy of the list of buddies. */
 		vector<Buddy> getBuddies() const;
 
-		/** All buddiers are updated */
+		/** All buddiers are updated.
+		 *
+		 * The IRC status of buddies is changed progressively, to
+		 * not freeze the session with large buddy lists.
+		 */
 		void updatedAllBuddies() const;
 
 		/** Connect account */
@@ -202,7 +223,10 @@ namespace im
 		/** Disconnect account */
 		void disconnect() const;
 
-		/** Create the status channel on the IRC network */
+		/** Create the status channel on the IRC network.
+		 *
+		 * Buddies join it progressively.
+		 */
 		void createStatusChannel();
 
 		/** Leave the status channel */
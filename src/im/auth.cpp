@@ -21,6 +21,7 @@
 #include <vector>
 #include "auth.h"
 #include "core/log.h"
+#include "core/metrics.h"
 #include "core/util.h"
 #include "core/config.h"
 #include "irc/irc.h"
@@ -64,18 +65,32 @@ Auth* Auth::validate(irc::IRC* irc, const string& username, const string& passwo
 {
 	vector<Auth*> mechanisms = getMechanisms(irc, username);
 	Auth* mech_ok = NULL;
+	string tried;
 
 	if (mechanisms.empty())
 		throw IMError("Login disabled (please consult your administrator)");
 
 	for (vector<Auth*>::iterator m = mechanisms.begin(); m != mechanisms.end(); ++m)
 	{
-		if ((mech_ok == NULL) && (*m)->exists() && (*m)->authenticate(password))
-			mech_ok = *m;
-		else
-			delete *m;
+		if ((mech_ok == NULL) && (*m)->exists())
+		{
+			if ((*m)->authenticate(password))
+			{
+				mech_ok = *m;
+				continue;
+			}
+			if (!tried.empty())
+				tried += ",";
+			tried += (*m)->getName();
+		}
+		delete *m;
 	}
 
+	/* A mechanism may reject the password while a next one accepts it,
+	 * so this is a failure only if every one has rejected it. */
+	if (!mech_ok && !tried.empty())
+		Metrics::get(Metrics::series("minbif_auth_failures_total", "mechanism", tried))++;
+
 	return mech_ok;
 }
 
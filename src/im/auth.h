@@ -44,6 +44,7 @@ namespace im
 
 		Auth(irc::IRC* _irc, const string& _username);
 		virtual ~Auth() {}
+		virtual const char* getName() const = 0;  /**< name of mechanism */
 		virtual bool exists() = 0;
 		virtual bool authenticate(const string& password) = 0;
 		virtual im::IM* create(const string& password);
@@ -25,6 +25,7 @@
 #include "irc/irc.h"
 #include "irc/user.h"
 #include "auth_local.h"
+#include "password_hash.h"
 
 namespace im
 {
@@ -43,10 +44,31 @@ bool AuthLocal::authenticate(const string& password)
 	if (!im::IM::exists(username))
 		return false;
 
-	im = new im::IM(irc, username);
-
 	b_log[W_DEBUG] << "Authenticating user " << username << " using local database";
-	return im->getPassword() == password;
+
+	/* Check password before loading the whole libpurple stuff, so
+	 * wrong passwords are cheap. */
+	string stored;
+	if (im::IM::readPassword(username, stored))
+	{
+		if (!PasswordHash::verify(password, stored))
+			return false;
+
+		im = new im::IM(irc, username);
+	}
+	else
+	{
+		im = new im::IM(irc, username);
+		stored = im->getPassword();
+		if (!PasswordHash::verify(password, stored))
+			return false;
+	}
+
+	/* Plaintext password, or hash parameters have changed. */
+	if (PasswordHash::needsRehash(stored))
+		im->setPassword(PasswordHash::hash(password));
+
+	return true;
 }
 
 bool AuthLocal::setPassword(const string& password)
@@ -56,13 +78,17 @@ bool AuthLocal::setPassword(const string& password)
 		irc->notice(irc->getUser(), "Password must be at least 8 characters, and cannot contain whitespaces.");
 		return false;
 	}
-	im->setPassword(password);
+	im->setPassword(PasswordHash::hash(password));
 	return true;
 }
 
 string AuthLocal::getPassword() const
 {
-	return im->getPassword();
+	/* The password can't be retrieved from its hash. */
+	string stored = im->getPassword();
+	if (PasswordHash::isHashed(stored))
+		return "";
+	return stored;
 }
 
 im::IM* AuthLocal::create(const string& password)
@@ -30,6 +30,7 @@ namespace im
 	{
 	public:
 		AuthLocal(irc::IRC* _irc, const string& _username);
+		const char* getName() const { return "local"; }
 		bool exists();
 		bool authenticate(const string& password);
 		im::IM* create(const string& password);
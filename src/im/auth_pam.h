@@ -39,6 +39,7 @@ namespace im
 	public:
 		AuthPAM(irc::IRC* _irc, const string& _username);
 		~AuthPAM();
+		const char* getName() const { return "pam"; }
 		bool exists();
 		bool authenticate(const string& password);
 		im::IM* create(const string& password);
@@ -17,12 +17,15 @@
  */
 
 #include <cassert>
+#include <map>
+#include <vector>
 
 #include "im/purple.h"
 #include "im/buddy.h"
 #include "im/account.h"
 #include "im/im.h"
 #include "core/util.h"
+#include "core/latency.h"
 #include "core/log.h"
 #include "irc/buddy.h"
 #include "irc/irc.h"
@@ -31,6 +34,9 @@
 
 namespace im {
 
+using std::map;
+using std::vector;
+
 Buddy::Buddy()
 	: buddy(NULL)
 {}
@@ -130,35 +136,51 @@ void Buddy::sendFile(string filename)
 		       filename.c_str());
 }
 
-void Buddy::updated() const
+irc::ChanUser* Buddy::syncStatus(irc::StatusChannel* chan, bool voiced) const
 {
-	irc::StatusChannel* chan = getAccount().getStatusChannel();
-	if(!chan)
-		return;
-
 	irc::Buddy* n = getNick();
 	if(!n)
 		n = dynamic_cast<irc::Buddy*>(Purple::getIM()->getIRC()->getNick(*this));
 	if(!n)
-		return;
+		return NULL;
 	if(isOnline())
 	{
-		bool available = isAvailable() && Purple::getIM()->hasVoicedBuddies();
+		bool available = voiced && isAvailable();
 		irc::ChanUser* chanuser = n->getChanUser(chan);
 
 		if(!chanuser)
 			n->join(chan, available ? irc::ChanUser::VOICE : 0);
 		else if(available ^ chanuser->hasStatus(irc::ChanUser::VOICE))
-		{
-			if(available)
-				chan->setMode(Purple::getIM()->getIRC(), irc::ChanUser::VOICE, chanuser);
-			else
-				chan->delMode(Purple::getIM()->getIRC(), irc::ChanUser::VOICE, chanuser);
-		}
-
+			return chanuser;
 	}
 	else if(n->isOn(chan))
 		n->quit("Signed-Off");
+
+	return NULL;
+}
+
+void Buddy::updated() const
+{
+	irc::StatusChannel* chan = getAccount().getStatusChannel();
+	if(!chan)
+		return;
+
+	irc::ChanUser* chanuser = syncStatus(chan, Purple::getIM()->hasVoicedBuddies());
+	if(!chanuser)
+		return;
+
+	if(chanuser->hasStatus(irc::ChanUser::VOICE))
+		chan->delMode(Purple::getIM()->getIRC(), irc::ChanUser::VOICE, chanuser);
+	else
+		chan->setMode(Purple::getIM()->getIRC(), irc::ChanUser::VOICE, chanuser);
+}
+
+void Buddy::enqueueUpdate() const
+{
+	assert(isValid());
+	pending_updates.insert(buddy);
+	if(!pending_updates_id)
+		pending_updates_id = g_timeout_add(UPDATES_DELAY, Buddy::flush_updates, NULL);
 }
 
 string Buddy::getRealName() const
@@ -264,6 +286,52 @@ PurpleGroup* Buddy::getPurpleGroup() const
 
 /* STATIC */
 
+set<PurpleBuddy*> Buddy::pending_updates;
+guint Buddy::pending_updates_id = 0;
+
+gboolean Buddy::flush_updates(void*)
+{
+	irc::IRC* irc = Purple::getIM()->getIRC();
+	bool voiced = Purple::getIM()->hasVoicedBuddies();
+	map<PurpleAccount*, irc::StatusChannel*> chans;
+	map<irc::StatusChannel*, vector<irc::ChanUser*> > voice, devoice;
+
+	for(size_t count = 0; count < UPDATES_CHUNK && !pending_updates.empty(); ++count)
+	{
+		Buddy buddy(*pending_updates.begin());
+		pending_updates.erase(pending_updates.begin());
+
+		/* Resolve the status channel only once per account. */
+		PurpleAccount* account = buddy.buddy->account;
+		map<PurpleAccount*, irc::StatusChannel*>::iterator chan = chans.find(account);
+		if(chan == chans.end())
+			chan = chans.insert(std::make_pair(account, buddy.getAccount().getStatusChannel())).first;
+		if(!chan->second)
+			continue;
+
+		irc::ChanUser* chanuser = buddy.syncStatus(chan->second, voiced);
+		if(!chanuser)
+			continue;
+
+		if(chanuser->hasStatus(irc::ChanUser::VOICE))
+			devoice[chan->second].push_back(chanuser);
+		else
+			voice[chan->second].push_back(chanuser);
+	}
+
+	for(map<irc::StatusChannel*, vector<irc::ChanUser*> >::iterator it = devoice.begin(); it != devoice.end(); ++it)
+		it->first->changeModes(irc, false, irc::ChanUser::VOICE, it->second);
+	for(map<irc::StatusChannel*, vector<irc::ChanUser*> >::iterator it = voice.begin(); it != voice.end(); ++it)
+		it->first->changeModes(irc, true, irc::ChanUser::VOICE, it->second);
+
+	/* Keep the timer while there are still updates to process. */
+	if(!pending_updates.empty())
+		return TRUE;
+
+	pending_updates_id = 0;
+	return FALSE;
+}
+
 PurpleBlistUiOps Buddy::blist_ui_ops =
 {
         NULL,//new_list,
@@ -292,6 +360,10 @@ void Buddy::init()
 void Buddy::uninit()
 {
 	purple_blist_set_ui_ops(NULL);
+	if(pending_updates_id)
+		g_source_remove(pending_updates_id);
+	pending_updates_id = 0;
+	pending_updates.clear();
 }
 
 void* Buddy::getHandler()
@@ -308,6 +380,7 @@ void Buddy::buddy_signonoff_cb(PurpleBuddy* buddy)
 
 void Buddy::update_node(PurpleBuddyList *list, PurpleBlistNode *node)
 {
+	LATENCY_SCOPE("purple.update_node");
 	if (PURPLE_BLIST_NODE_IS_BUDDY(node))
 	{
 		Buddy buddy = Buddy((PurpleBuddy*)node);
@@ -333,12 +406,13 @@ void Buddy::update_node(PurpleBuddyList *list, PurpleBlistNode *node)
 		if(buddy.getAlias() != n->getNickname())
 			buddy.setAlias(n->getNickname(), false);
 
-		buddy.updated();
+		buddy.enqueueUpdate();
 	}
 }
 
 void Buddy::removed_node(PurpleBuddyList *list, PurpleBlistNode *node)
 {
+	LATENCY_SCOPE("purple.removed_node");
 	purple_request_close_with_handle(node);
 
 	if (node->parent)
@@ -347,6 +421,8 @@ void Buddy::removed_node(PurpleBuddyList *list, PurpleBlistNode *node)
 	if (PURPLE_BLIST_NODE_IS_BUDDY(node))
 	{
 		Buddy buddy = Buddy((PurpleBuddy*)node);
+		pending_updates.erase(buddy.buddy);
+
 		irc::Buddy* n = buddy.getNick();
 		if(!n)
 			n = dynamic_cast<irc::Buddy*>(Purple::getIM()->getIRC()->getNick(buddy));
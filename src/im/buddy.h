@@ -21,17 +21,21 @@
 
 #include <purple.h>
 #include <string>
+#include <set>
 
 #include "core/caca_image.h"
 
 namespace irc
 {
 	class Buddy;
+	class ChanUser;
+	class StatusChannel;
 };
 
 namespace im
 {
 	using std::string;
+	using std::set;
 
 	class Account;
 
@@ -50,6 +54,22 @@ namespace im
 		static void update_node(PurpleBuddyList *list, PurpleBlistNode *node);
 		static void removed_node(PurpleBuddyList *list, PurpleBlistNode *node);
 
+		/** Delay (in ms) used to merge buddies updates. */
+		static const int UPDATES_DELAY = 100;
+		/** Maximum number of updates processed before going back to main loop. */
+		static const size_t UPDATES_CHUNK = 500;
+		static set<PurpleBuddy*> pending_updates;
+		static guint pending_updates_id;
+		static gboolean flush_updates(void*);
+
+		/** Synchronize the IRC nick with buddy's state on a status channel.
+		 *
+		 * @param chan  status channel of the buddy's account
+		 * @param voiced  are available buddies voiced?
+		 * @return  the ChanUser whose voice has to be toggled, or NULL.
+		 */
+		irc::ChanUser* syncStatus(irc::StatusChannel* chan, bool voiced) const;
+
 	public:
 
 		/** Initialization of libpurple buddies' stuffs. */
@@ -101,6 +121,16 @@ namespace im
 		/** Buddy has been updated, so change his IRC status. */
 		void updated() const;
 
+		/** Buddy has been updated, but change his IRC status later.
+		 *
+		 * Updates are merged and flushed after a short delay, so
+		 * a storm of presence changes (at login for example) only
+		 * resolves the status channels once and sends grouped
+		 * MODE lines. Large sets of updates are processed by
+		 * chunks, going back to the main loop between them.
+		 */
+		void enqueueUpdate() const;
+
 		/** Send a file to this buddy. */
 		void sendFile(string filename);
 
@@ -30,6 +30,7 @@
 #include "irc/buddy.h"
 #include "irc/chat_buddy.h"
 #include "irc/unknown_buddy.h"
+#include "core/latency.h"
 #include "core/log.h"
 
 namespace im {
@@ -397,9 +398,6 @@ void Conversation::sendMessage(string text)
 
 	char *utf8 = purple_utf8_try_convert(text.c_str());
 	char *escape = irc2markup(utf8);
-	char *apos = purple_strreplace(escape, "&apos;", "'");
-	g_free(escape);
-	escape = apos;
 
 	switch(getType())
 	{
@@ -452,8 +450,9 @@ void Conversation::recvMessage(string from, string text, bool action)
 				n->setConversation(*this);
 			}
 
+			StringTokenizer tok(text, "\n\r");
 			string line;
-			while((line = stringtok(text, "\n\r")).empty() == false)
+			while(tok.next(line))
 				n->sendMessage(irc->getUser(), line, action);
 			break;
 		}
@@ -479,8 +478,9 @@ void Conversation::recvMessage(string from, string text, bool action)
 					from += "_";
 			}
 
+			StringTokenizer tok(text, "\n\r");
 			string line;
-			while((line = stringtok(text, "\n\r")).empty() == false)
+			while(tok.next(line))
 			{
 				if(action)
 					line = "\001ACTION " + line + "\001";
@@ -605,6 +605,7 @@ void Conversation::conv_present(PurpleConversation* c)
 void Conversation::write_im(PurpleConversation *c, const char *who,
 		const char *message, PurpleMessageFlags flags, time_t mtime)
 {
+	LATENCY_SCOPE("purple.write_im");
 	if(flags & PURPLE_MESSAGE_RECV)
 	{
 		PurpleAccount *account = purple_conversation_get_account(c);
@@ -619,6 +620,7 @@ void Conversation::write_im(PurpleConversation *c, const char *who,
 void Conversation::write_conv(PurpleConversation *c, const char *who, const char* alias,
 		const char *message, PurpleMessageFlags flags, time_t mtime)
 {
+	LATENCY_SCOPE("purple.write_conv");
 	if ((flags & PURPLE_MESSAGE_SYSTEM) && !(flags & PURPLE_MESSAGE_NOTIFY))
 		flags = (PurpleMessageFlags)(flags & ~(PURPLE_MESSAGE_SEND | PURPLE_MESSAGE_RECV));
 
@@ -673,6 +675,7 @@ void Conversation::write_conv(PurpleConversation *c, const char *who, const char
 void Conversation::add_users(PurpleConversation *c, GList *cbuddies,
 			     gboolean new_arrivals)
 {
+	LATENCY_SCOPE("purple.add_users");
 	Conversation conv(c);
 	GList* l = cbuddies;
 	for (; l != NULL; l = l->next)
@@ -30,6 +30,8 @@
 
 namespace im {
 
+static ConfigBoolHandle dcc_enabled(&conf, "file_transfers", "dcc");
+
 FileTransfert::FileTransfert()
 	: xfer(NULL)
 {}
@@ -112,7 +114,7 @@ void FileTransfert::destroy(PurpleXfer* xfer)
 	{
 		if(ft.isSending())
 			b_log[W_INFO|W_SNO] << "File " << ft.getFileName() << " sent to " << ft.getRemoteUser();
-		else if(conf.GetSection("file_transfers")->GetItem("dcc")->Boolean() == false)
+		else if(dcc_enabled.Value() == false)
 			b_log[W_INFO|W_SNO] << "File saved as: " << ft.getLocalFileName();
 	}
 }
@@ -135,7 +137,7 @@ void FileTransfert::add_xfer(PurpleXfer* xfer)
 		b_log[W_INFO|W_SNO] << "Starting receiving file " << ft.getFileName() << " from " << ft.getRemoteUser();
 
 		/* Do not send file to IRC user with DCC if this feature is disabled. */
-		if(conf.GetSection("file_transfers")->GetItem("dcc")->Boolean() == false)
+		if(dcc_enabled.Value() == false)
 			return;
 
 		try
@@ -156,7 +158,7 @@ void FileTransfert::add_xfer(PurpleXfer* xfer)
 void FileTransfert::update_progress(PurpleXfer* xfer, double percent)
 {
 	/* Note: 0 <= percent <= 1 */
-	if(conf.GetSection("file_transfers")->GetItem("dcc")->Boolean())
+	if(dcc_enabled.Value())
 		Purple::getIM()->getIRC()->updateDCC(FileTransfert(xfer));
 }
 
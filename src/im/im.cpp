@@ -58,6 +58,71 @@ bool IM::exists(const string& username)
 	return true;
 }
 
+struct prefs_parser
+{
+	vector<string> names;
+	bool found;
+	string password;
+};
+
+static void prefs_start_element(GMarkupParseContext*, const gchar* element_name,
+				const gchar** attribute_names, const gchar** attribute_values,
+				gpointer user_data, GError**)
+{
+	prefs_parser* p = static_cast<prefs_parser*>(user_data);
+	const gchar* name = "";
+	const gchar* value = NULL;
+
+	for(size_t i = 0; attribute_names[i]; ++i)
+		if(!strcmp(attribute_names[i], "name"))
+			name = attribute_values[i];
+		else if(!strcmp(attribute_names[i], "value"))
+			value = attribute_values[i];
+
+	p->names.push_back(name);
+
+	/* <pref name='/'><pref name='minbif'><pref name='password' value='...'/> */
+	if(!strcmp(element_name, "pref") && value && p->names.size() == 3 &&
+	   p->names[1] == "minbif" && p->names[2] == "password")
+	{
+		p->found = true;
+		p->password = value;
+	}
+}
+
+static void prefs_end_element(GMarkupParseContext*, const gchar*, gpointer user_data, GError**)
+{
+	prefs_parser* p = static_cast<prefs_parser*>(user_data);
+	if(!p->names.empty())
+		p->names.pop_back();
+}
+
+bool IM::readPassword(const string& username, string& password)
+{
+	string filename = path + "/" + username + "/prefs.xml";
+	gchar* contents;
+	gsize len;
+
+	if(!g_file_get_contents(filename.c_str(), &contents, &len, NULL))
+		return false;
+
+	GMarkupParser parser = { prefs_start_element, prefs_end_element, NULL, NULL, NULL };
+	prefs_parser p;
+	p.found = false;
+
+	GMarkupParseContext* ctx = g_markup_parse_context_new(&parser, (GMarkupParseFlags)0, &p, NULL);
+	bool ok = g_markup_parse_context_parse(ctx, contents, len, NULL) &&
+		  g_markup_parse_context_end_parse(ctx, NULL);
+	g_markup_parse_context_free(ctx);
+	g_free(contents);
+
+	if(!ok || !p.found)
+		return false;
+
+	password = p.password;
+	return true;
+}
+
 /* METHODS */
 
 IM::IM(irc::IRC* _irc, string _username)
@@ -54,6 +54,16 @@ namespace im
 		static void setPath(const string& path);
 		static bool exists(const string& username);
 
+		/** Read user password from its prefs file, without
+		 * initializing libpurple.
+		 *
+		 * @param username  user name
+		 * @param password  set to the stored password
+		 * @return  false if the prefs file can't be read or doesn't
+		 *          contain any password.
+		 */
+		static bool readPassword(const string& username, string& password);
+
 	private:
 
 		string username;
@@ -17,6 +17,7 @@
  */
 
 #include <cstring>
+#include <time.h>
 #include "im/media.h"
 #include "im/im.h"
 #include "im/purple.h"
@@ -81,11 +82,11 @@ void MediaList::removeMedia(const Media& media)
 			++it;
 }
 
-void MediaList::enqueueBuffer(const Media& media, const CacaImage& buf)
+void MediaList::setFrame(PurpleMedia* m, const void* data, size_t size, unsigned width, unsigned height, unsigned bpp)
 {
-	BlockLockMutex m(this);
+	BlockLockMutex lock(this);
 	vector<Media>::iterator it;
-	for(it = medias.begin(); it != medias.end() && *it != media; ++it)
+	for(it = medias.begin(); it != medias.end() && it->getPurpleMedia() != m; ++it)
 		;
 
 	if(it == medias.end())
@@ -94,7 +95,7 @@ void MediaList::enqueueBuffer(const Media& media, const CacaImage& buf)
 		return;
 	}
 
-	it->enqueueBuffer(buf);
+	it->setFrame(data, size, width, height, bpp);
 }
 
 bool MediaList::check(void*)
@@ -109,26 +110,34 @@ bool MediaList::check(void*)
 
 Media::Media()
 	: media(0),
-	  dcc(NULL)
+	  dcc(NULL),
+	  new_frame(false),
+	  last_frame(0)
 {
 }
 
 Media::Media(PurpleMedia* m)
 	: media(m),
-	  dcc(NULL)
+	  dcc(NULL),
+	  new_frame(false),
+	  last_frame(0)
 {}
 
 Media::Media(PurpleMedia* m, const Buddy& b)
 	: media(m),
 	  buddy(b),
-	  dcc(NULL)
+	  dcc(NULL),
+	  new_frame(false),
+	  last_frame(0)
 {
 }
 
 Media::Media(const Media& m)
 	: media(m.media),
 	  buddy(m.buddy),
-	  dcc(NULL)
+	  dcc(NULL),
+	  new_frame(false),
+	  last_frame(0)
 {
 
 }
@@ -139,6 +148,9 @@ Media& Media::operator=(const Media& m)
 	buddy = m.buddy;
 	delete dcc;
 	dcc = NULL;
+	frame = CacaImage();
+	new_frame = false;
+	last_frame = 0;
 	return *this;
 }
 
@@ -157,31 +169,43 @@ bool Media::operator!=(const Media& m) const
 	return !this->media || this->media != m.media;
 }
 
-void Media::enqueueBuffer(const CacaImage& buf)
+static unsigned long get_time_ms()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void Media::setFrame(const void* data, size_t size, unsigned width, unsigned height, unsigned bpp)
 {
-	queue.push_back(buf);
+	unsigned long now = get_time_ms();
+	if(last_frame && now - last_frame < 1000 / VIDEO_FPS)
+		return;
+
+	frame.setPixels(data, size, width, height, bpp, VIDEO_MAX_WIDTH);
+	new_frame = true;
+	last_frame = now;
 }
 
 void Media::checkBuffer()
 {
-	vector<CacaImage>::iterator it;
-	for(it = queue.begin(); it != queue.end(); it = queue.erase(it))
+	if(!new_frame)
+		return;
+
+	new_frame = false;
+	try
 	{
-		try
+		if(!dcc)
 		{
-			if(!dcc)
-			{
-				irc::IRC* irc = Purple::getIM()->getIRC();
-				irc::Buddy* sender = irc->getNick(buddy);
-				dcc = new irc::DCCChat(sender, irc->getUser());
-			}
-			string buf = it->getIRCBuffer(0, 20, "ansi"), line;
-			dcc->dcc_send(buf);
-		}
-		catch(CacaError &e)
-		{
-			b_log[W_ERR] << "Caca error while sending to user";
+			irc::IRC* irc = Purple::getIM()->getIRC();
+			irc::Buddy* sender = irc->getNick(buddy);
+			dcc = new irc::DCCChat(sender, irc->getUser());
 		}
+		dcc->dcc_send(frame.draw(CacaContext::main_thread, 0, 20, "ansi"));
+	}
+	catch(CacaError &e)
+	{
+		b_log[W_ERR] << "Caca error while sending to user";
 	}
 }
 
@@ -410,8 +434,7 @@ void Media::got_data(GstElement* object,
 		if(!bpp)
 			bpp = 8;
 
-		CacaImage img(GST_BUFFER_DATA(buffer), GST_BUFFER_SIZE(buffer), w, h, bpp);
-		Media::media_list.enqueueBuffer(Media((PurpleMedia*)user_data), img);
+		Media::media_list.setFrame((PurpleMedia*)user_data, GST_BUFFER_DATA(buffer), GST_BUFFER_SIZE(buffer), w, h, bpp);
 	}
 	catch(CacaError& e)
 	{
@@ -57,7 +57,9 @@ namespace im {
 		void addMedia(const Media& media);
 		void removeMedia(const Media& media);
 		Media getMedia(PurpleMedia* m);
-		void enqueueBuffer(const Media& media, const CacaImage& buf);
+
+		/** Give a new frame to a media, from a streaming thread. */
+		void setFrame(PurpleMedia* m, const void* data, size_t size, unsigned width, unsigned height, unsigned bpp);
 
 		bool check(void*);
 	};
@@ -68,9 +70,17 @@ namespace im {
 #ifdef HAVE_VIDEO
 		PurpleMedia* media;
 		Buddy buddy;
-		vector<CacaImage> queue;
 		irc::DCCChat* dcc;
 
+		/** Only the latest frame is kept; when a frame isn't sent
+		 * before the next one, it is dropped. */
+		CacaImage frame;
+		bool new_frame;
+		unsigned long last_frame;  /**< time in ms when frame has been set */
+
+		static const unsigned VIDEO_FPS = 5;
+		static const unsigned VIDEO_MAX_WIDTH = 160;
+
 		static MediaList media_list;
 		static bool gstreamer_init_failed;
 
@@ -108,7 +118,15 @@ namespace im {
 
 		bool isValid() const { return media; }
 
-		void enqueueBuffer(const CacaImage& buf);
+		/** Replace the pending frame.
+		 *
+		 * The frame is dropped if the previous one has been set less
+		 * than 1/VIDEO_FPS second ago. Otherwise, it is downscaled
+		 * while copied.
+		 */
+		void setFrame(const void* data, size_t size, unsigned width, unsigned height, unsigned bpp);
+
+		/** Render the pending frame, if any, and send it to user. */
 		void checkBuffer();
 		Buddy getBuddy() const { return buddy; }
 		PurpleMedia* getPurpleMedia() const { return media; }
@@ -0,0 +1,255 @@
+/*
+ * Minbif - IRC instant messaging gateway
+ * Copyright(C) 2009 Romain Bignon
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <cstring>
+#include <cstdlib>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <glib.h>
+
+#include "password_hash.h"
+#include "core/config.h"
+
+namespace im
+{
+
+static ConfigIntHandle password_iterations(&conf, "aaa", "password_iterations");
+
+static const char HASH_PREFIX[] = "pbkdf2-sha256$";
+static const size_t HASH_LEN = 32;
+static const size_t BLOCK_LEN = 64;
+static const size_t SALT_LEN = 16;
+
+/** HMAC-SHA256 with a fixed key.
+ *
+ * The inner and outer states are computed once, and copied for
+ * each message.
+ */
+class hmac_sha256
+{
+	GChecksum* inner;
+	GChecksum* outer;
+
+	hmac_sha256(const hmac_sha256&);
+	hmac_sha256& operator=(const hmac_sha256&);
+
+	static void finish(GChecksum* state, const guchar* data, size_t len, guchar* out)
+	{
+		GChecksum* c = g_checksum_copy(state);
+		gsize out_len = HASH_LEN;
+
+		g_checksum_update(c, data, len);
+		g_checksum_get_digest(c, out, &out_len);
+		g_checksum_free(c);
+	}
+
+public:
+
+	hmac_sha256(const string& key)
+		: inner(g_checksum_new(G_CHECKSUM_SHA256)),
+		  outer(g_checksum_new(G_CHECKSUM_SHA256))
+	{
+		guchar block[BLOCK_LEN], pad[BLOCK_LEN];
+
+		memset(block, 0, sizeof block);
+		if(key.size() > BLOCK_LEN)
+		{
+			GChecksum* c = g_checksum_new(G_CHECKSUM_SHA256);
+			gsize len = HASH_LEN;
+			g_checksum_update(c, (const guchar*)key.data(), key.size());
+			g_checksum_get_digest(c, block, &len);
+			g_checksum_free(c);
+		}
+		else
+			memcpy(block, key.data(), key.size());
+
+		for(size_t i = 0; i < BLOCK_LEN; ++i)
+			pad[i] = block[i] ^ 0x36;
+		g_checksum_update(inner, pad, BLOCK_LEN);
+
+		for(size_t i = 0; i < BLOCK_LEN; ++i)
+			pad[i] = block[i] ^ 0x5c;
+		g_checksum_update(outer, pad, BLOCK_LEN);
+	}
+
+	~hmac_sha256()
+	{
+		g_checksum_free(inner);
+		g_checksum_free(outer);
+	}
+
+	/** @param out  HASH_LEN bytes, may be the same buffer than data. */
+	void digest(const guchar* data, size_t len, guchar* out) const
+	{
+		guchar tmp[HASH_LEN];
+
+		finish(inner, data, len, tmp);
+		finish(outer, tmp, HASH_LEN, out);
+	}
+};
+
+/* PBKDF2 (RFC 2898) with HMAC-SHA256, for one block of output. */
+static void pbkdf2_sha256(const string& password, const string& salt, unsigned iterations, guchar* out)
+{
+	hmac_sha256 hmac(password);
+	string msg = salt + string("\0\0\0\1", 4);
+	guchar u[HASH_LEN];
+
+	hmac.digest((const guchar*)msg.data(), msg.size(), u);
+	memcpy(out, u, HASH_LEN);
+
+	for(unsigned i = 1; i < iterations; ++i)
+	{
+		hmac.digest(u, HASH_LEN, u);
+		for(size_t j = 0; j < HASH_LEN; ++j)
+			out[j] ^= u[j];
+	}
+}
+
+static string random_salt()
+{
+	guchar salt[SALT_LEN];
+	size_t len = 0;
+	int fd = open("/dev/urandom", O_RDONLY);
+
+	if(fd >= 0)
+	{
+		ssize_t r;
+		while(len < SALT_LEN && (r = read(fd, salt + len, SALT_LEN - len)) > 0)
+			len += r;
+		close(fd);
+	}
+
+	/* Not as good, but better than nothing. */
+	for(; len < SALT_LEN; ++len)
+		salt[len] = g_random_int() & 0xff;
+
+	return string((const char*)salt, SALT_LEN);
+}
+
+static string base64_encode(const string& data)
+{
+	gchar* enc = g_base64_encode((const guchar*)data.data(), data.size());
+	string s = enc;
+	g_free(enc);
+	return s;
+}
+
+static string base64_decode(const string& text)
+{
+	gsize len;
+	guchar* dec = g_base64_decode(text.c_str(), &len);
+	string s((const char*)dec, len);
+	g_free(dec);
+	return s;
+}
+
+/* Compare without stopping at first difference. */
+static bool equals(const string& a, const string& b)
+{
+	unsigned char diff = a.size() != b.size();
+
+	for(size_t i = 0; i < a.size(); ++i)
+		diff |= a[i] ^ b[i % (b.size() ? b.size() : 1)];
+
+	return diff == 0;
+}
+
+static bool parse(const string& stored, unsigned* iterations, string* salt, string* hash)
+{
+	if(stored.compare(0, sizeof HASH_PREFIX - 1, HASH_PREFIX))
+		return false;
+
+	size_t p1 = sizeof HASH_PREFIX - 1;
+	size_t p2 = stored.find('$', p1);
+	if(p2 == string::npos)
+		return false;
+	size_t p3 = stored.find('$', p2 + 1);
+	if(p3 == string::npos)
+		return false;
+
+	*iterations = strtoul(stored.substr(p1, p2 - p1).c_str(), NULL, 10);
+	*salt = base64_decode(stored.substr(p2 + 1, p3 - p2 - 1));
+	*hash = base64_decode(stored.substr(p3 + 1));
+
+	return *iterations > 0 && hash->size() == HASH_LEN;
+}
+
+string PasswordHash::hash(const string& password, unsigned iterations)
+{
+	if(!iterations)
+		iterations = getIterations();
+
+	string salt = random_salt();
+	guchar out[HASH_LEN];
+	pbkdf2_sha256(password, salt, iterations, out);
+
+	std::ostringstream oss;
+	oss << HASH_PREFIX << iterations << '$' << base64_encode(salt) << '$'
+	    << base64_encode(string((const char*)out, HASH_LEN));
+	return oss.str();
+}
+
+bool PasswordHash::verify(const string& password, const string& stored)
+{
+	if(!isHashed(stored))
+		return equals(password, stored);
+
+	unsigned iterations;
+	string salt, hash;
+	if(!parse(stored, &iterations, &salt, &hash))
+		return false;
+
+	guchar out[HASH_LEN];
+	pbkdf2_sha256(password, salt, iterations, out);
+
+	return equals(string((const char*)out, HASH_LEN), hash);
+}
+
+bool PasswordHash::needsRehash(const string& stored)
+{
+	unsigned iterations;
+	string salt, hash;
+
+	return !parse(stored, &iterations, &salt, &hash) || iterations != getIterations();
+}
+
+bool PasswordHash::isHashed(const string& stored)
+{
+	return stored.compare(0, sizeof HASH_PREFIX - 1, HASH_PREFIX) == 0;
+}
+
+unsigned PasswordHash::getIterations()
+{
+	return password_iterations.Value();
+}
+
+double PasswordHash::benchmark(unsigned iterations)
+{
+	struct timespec start, end;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	hash("benchmark", iterations);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0;
+}
+
+}; /* namespace im */
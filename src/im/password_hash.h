@@ -0,0 +1,78 @@
+/*
+ * Minbif - IRC instant messaging gateway
+ * Copyright(C) 2009 Romain Bignon
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef IM_PASSWORD_HASH_H
+#define IM_PASSWORD_HASH_H
+
+#include <string>
+
+namespace im
+{
+	using std::string;
+
+	/** Hash of local passwords.
+	 *
+	 * Passwords are stored as "pbkdf2-sha256$<iterations>$<salt>$<hash>",
+	 * with salt and hash encoded in base64. The number of iterations is
+	 * read from the aaa/password_iterations configuration item.
+	 *
+	 * Stored values without this prefix are plaintext passwords of
+	 * previous versions.
+	 */
+	class PasswordHash
+	{
+	public:
+
+		/** Hash a password with a new random salt.
+		 *
+		 * @param password  plaintext password
+		 * @param iterations  number of iterations, if null the
+		 *                    configured one is used
+		 * @return  value to store.
+		 */
+		static string hash(const string& password, unsigned iterations = 0);
+
+		/** Check a password against a stored value, in constant time.
+		 *
+		 * @param password  plaintext password given by user
+		 * @param stored  value returned by hash(), or a plaintext
+		 *                password
+		 */
+		static bool verify(const string& password, const string& stored);
+
+		/** Is the stored value a plaintext password, or a hash with
+		 * an other number of iterations than the configured one?
+		 */
+		static bool needsRehash(const string& stored);
+
+		/** Is the stored value a hash? */
+		static bool isHashed(const string& stored);
+
+		/** Get the configured number of iterations. */
+		static unsigned getIterations();
+
+		/** Measure the time taken to hash a password.
+		 *
+		 * @param iterations  number of iterations
+		 * @return  time in milliseconds.
+		 */
+		static double benchmark(unsigned iterations);
+	};
+};
+
+#endif /* IM_PASSWORD_HASH_H */
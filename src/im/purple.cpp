@@ -18,6 +18,7 @@
 
 #include <purple.h>
 #include <cassert>
+#include <cstdlib>
 
 #include "purple.h"
 #include "im.h"
@@ -40,7 +41,7 @@ IM* Purple::im = NULL;
 
 PurpleEventLoopUiOps Purple::eventloop_ops =
 {
-	/* timeout_add */    g_timeout_add,
+	/* timeout_add */    glib_timeout_add,
 	/* timeout_remove */ g_source_remove,
 	/* input_add */      glib_input_add,
 	/* input_remove */   g_source_remove,
@@ -129,12 +130,23 @@ PurpleCoreUiOps Purple::core_ops =
         NULL
 };
 
+/** Environment variable giving an extra directory of plugins. */
+static const char PLUGIN_PATH_ENV[] = "MINBIF_PLUGIN_PATH";
+
 void Purple::init(IM* im)
 {
 	if(Purple::im)
 		throw PurpleError("These is already a purple instance!");
 	purple_util_set_user_dir(im->getUserPath().c_str());
 
+	/* The purple core only looks for plugins in LIBDIR. An other
+	 * directory can be given for tests and benchmarks, which load
+	 * plugins from the build tree. It has to be added before the core
+	 * initialization, which probes plugins. */
+	const char* search_path = getenv(PLUGIN_PATH_ENV);
+	if(search_path && *search_path)
+		purple_plugins_add_search_path(search_path);
+
 	purple_core_set_ui_ops(&core_ops);
 	purple_eventloop_set_ui_ops(&eventloop_ops);
 
@@ -33,6 +33,8 @@
 
 namespace im {
 
+static ConfigBoolHandle file_transfers_enabled(&conf, "file_transfers", "enabled");
+
 class RequestNick : public irc::Nick
 {
 public:
@@ -336,7 +338,8 @@ void* Request::notify_message(PurpleNotifyMsgType type, const char *title,
 				continue;
 			}
 		}
-		while((line = stringtok(txt, "\r\n")).empty() == false)
+		StringTokenizer tok(txt, "\r\n");
+		while(tok.next(line))
 			nick->privmsg(irc->getUser(), line);
 	}
 
@@ -366,7 +369,8 @@ void* Request::notify_formatted(const char *title, const char *primary, const ch
 				continue;
 			}
 		}
-		while((line = stringtok(txt, "\r\n")).empty() == false)
+		StringTokenizer tok(txt, "\r\n");
+		while(tok.next(line))
 			nick->privmsg(irc->getUser(), line);
 	}
 
@@ -408,8 +412,9 @@ void* Request::notify_userinfo(PurpleConnection *gc, const char *who, PurpleNoti
 		else
 			text = string(":: ") + label + " ::";
 
+		StringTokenizer tok(text, "\r\n");
 		string line;
-		while((line = stringtok(text, "\r\n")).empty() == false)
+		while(tok.next(line))
 			user->send(irc::Message(RPL_WHOISACTUALLY).setSender(irc)
 						       .setReceiver(user)
 						       .addArg(b.getAlias())
@@ -476,7 +481,7 @@ void* Request::request_action(const char *title, const char *primary,
 		string tmp = text;
 		PurpleRequestActionCb callback = va_arg(actions, PurpleRequestActionCb);
 
-		request->addField(new RequestFieldAction<PurpleRequestActionCb>((int)i, strlower(stringtok(tmp, "_ ")), text, callback, user_data));
+		request->addField(new RequestFieldAction<PurpleRequestActionCb>((int)i, strlower(StringTokenizer(tmp, "_ ").next()), text, callback, user_data));
 	}
 	return addRequest(request);
 }
@@ -496,7 +501,7 @@ void* Request::request_choice(const char *title, const char *primary,
 		int val = va_arg(choices, int);
 		string tmp = text;
 
-		request->addField(new RequestFieldAction<PurpleRequestChoiceCb>(val, strlower(stringtok(tmp, "_ ")), text, (PurpleRequestChoiceCb)ok_cb, user_data));
+		request->addField(new RequestFieldAction<PurpleRequestChoiceCb>(val, strlower(StringTokenizer(tmp, "_ ").next()), text, (PurpleRequestChoiceCb)ok_cb, user_data));
 	}
 	request->addField(new RequestFieldAction<PurpleRequestChoiceCb>(0, "cancel", "Cancel", (PurpleRequestChoiceCb)cancel_cb, user_data));
 
@@ -585,7 +590,8 @@ public:
 #ifdef HAVE_CACA
 			CacaImage img(temp_filename);
 			string line, buf = img.getIRCBuffer(60);
-			while((line = stringtok(buf, "\r\n")).empty() == false)
+			StringTokenizer tok(buf, "\r\n");
+			while(tok.next(line))
 			{
 				nick->privmsg(irc->getUser(), line);
 			}
@@ -783,7 +789,7 @@ void* Request::request_file(const char *title, const char *filename,
 			  PurpleAccount *account, const char *who, PurpleConversation *conv,
 			  void *user_data)
 {
-	if(conf.GetSection("file_transfers")->GetItem("enabled")->Boolean() == false)
+	if(file_transfers_enabled.Value() == false)
 	{
 		b_log[W_ERR] << "File transfers are disabled on this server.";
 		((PurpleRequestFileCb)cancel_cb)(user_data, NULL);
@@ -35,14 +35,18 @@
 
 namespace irc {
 
+static ConfigBoolHandle file_transfers_enabled(&conf, "file_transfers", "enabled");
+
 Buddy::Buddy(Server* server, im::Buddy _buddy)
 	: ConvNick(server, im::Conversation(), "","","",_buddy.getRealName()),
 	  im_buddy(_buddy),
 	  public_msgs(false),
 	  public_msgs_last(0)
 {
-	string hostname = im_buddy.getName();
-	string identname = stringtok(hostname, "@");
+	string name = im_buddy.getName();
+	StringTokenizer tok(name, "@");
+	string identname = tok.next();
+	string hostname = tok.rest();
 	string nickname = im_buddy.getAlias();
 	if(nickname.find('@') != string::npos || nickname.find(' ') != string::npos)
 		nickname = nickize(identname);
@@ -79,7 +83,10 @@ void Buddy::send(Message m)
 			if(chan && chan->isStatusChannel())
 			{
 				public_msgs = true;
-				stringtok(text, " ");
+				/* Remove the "nick: " prefix. */
+				StringTokenizer tok(text, " ");
+				tok.next();
+				text = tok.rest();
 			}
 			else
 				public_msgs = false;
@@ -139,23 +146,38 @@ void Buddy::setConversation(const im::Conversation& c)
 
 bool Buddy::process_dcc_get(const string& text)
 {
-	if(conf.GetSection("file_transfers")->GetItem("enabled")->Boolean() == false)
+	if(file_transfers_enabled.Value() == false)
 	{
 		b_log[W_ERR] << "File transfers are disabled on this server.";
 		return true;
 	}
 
-	string filename;
-	uint32_t addr;
+	string filename, addr, token;
 	uint16_t port;
 	ssize_t size;
 
-	if(DCCGet::parseDCCSEND(text, &filename, &addr, &port, &size))
+	if(DCCGet::parseDCCACCEPT(text, &port, &size, &token))
+	{
+		RemoteServer* rm = dynamic_cast<RemoteServer*>(getServer());
+		if(rm)
+			rm->getIRC()->acceptDCCResume(this, port, size, token);
+		return true;
+	}
+
+	if(DCCGet::parseDCCSEND(text, &filename, &addr, &port, &size, &token))
 	{
 		RemoteServer* rm = dynamic_cast<RemoteServer*>(getServer());
 		if(!rm)
 			return true;
 
+		/* Answer to a passive DCC SEND of a file sent by this buddy. */
+		if(port != 0 && !token.empty())
+		{
+			if(!rm->getIRC()->connectDCCPassive(this, token, addr, port))
+				b_log[W_ERR] << "Unknown passive DCC token: " << token;
+			return true;
+		}
+
 		string path = rm->getIRC()->getIM()->getUserPath() + "/upload/";
 		if(!check_write_file(path, filename))
 		{
@@ -165,7 +187,7 @@ bool Buddy::process_dcc_get(const string& text)
 		try
 		{
 			filename = path + "/" + filename;
-			rm->getIRC()->createDCCGet(this, filename, addr, port, size, new CallBack<Buddy>(this, &Buddy::received_file, strdup(filename.c_str())));
+			rm->getIRC()->createDCCGet(this, filename, addr, port, size, token, new CallBack<Buddy>(this, &Buddy::received_file, strdup(filename.c_str())));
 
 		}
 		catch(const DCCGetError&)
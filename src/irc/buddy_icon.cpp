@@ -42,12 +42,16 @@ void BuddyIcon::send(Message m)
 {
 	if(m.getCommand() == MSG_PRIVMSG && m.getReceiver() == this && m.countArgs() > 0)
 	{
-		string filename;
-		uint32_t addr;
+		string filename, addr, token;
 		uint16_t port;
 		ssize_t size;
 
-		if(DCCGet::parseDCCSEND(m.getArg(0), &filename, &addr, &port, &size))
+		if(DCCGet::parseDCCACCEPT(m.getArg(0), &port, &size, &token))
+		{
+			IRC* irc = dynamic_cast<IRC*>(getServer());
+			irc->acceptDCCResume(this, port, size, token);
+		}
+		else if(DCCGet::parseDCCSEND(m.getArg(0), &filename, &addr, &port, &size, &token))
 		{
 			string path = im->getBuddyIconPath();
 			if(!check_write_file(path, filename))
@@ -59,7 +63,7 @@ void BuddyIcon::send(Message m)
 			{
 				IRC* irc = dynamic_cast<IRC*>(getServer());
 				filename = path + "/" + filename;
-				irc->createDCCGet(this, filename, addr, port, size, new CallBack<BuddyIcon>(this, &BuddyIcon::receivedIcon, strdup(filename.c_str())));
+				irc->createDCCGet(this, filename, addr, port, size, token, new CallBack<BuddyIcon>(this, &BuddyIcon::receivedIcon, strdup(filename.c_str())));
 			}
 			catch(const DCCGetError&)
 			{
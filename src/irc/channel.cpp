@@ -113,8 +113,11 @@ Channel::~Channel()
 {
 	for(vector<ChanUser*>::iterator it = users.begin(); it != users.end(); ++it)
 	{
-		(*it)->getNick()->send(Message(MSG_PART).setSender(*it)
-							.setReceiver(this));
+		Message m = Message(MSG_PART).setSender(*it)
+					     .setReceiver(this);
+		if(!part_reason.empty())
+			m.addArg(part_reason);
+		(*it)->getNick()->send(m);
 		(*it)->getNick()->removeChanUser(*it);
 		delete *it;
 	}
@@ -270,6 +273,33 @@ void Channel::delMode(const Entity* sender, int modes, ChanUser* chanuser)
 
 }
 
+void Channel::changeModes(const Entity* sender, bool add, ChanUser::mode_t mode, const vector<ChanUser*>& chanusers)
+{
+	char c = ChanUser::mode2c(mode);
+	if(!c) return;
+
+	for(vector<ChanUser*>::const_iterator it = chanusers.begin(); it != chanusers.end(); )
+	{
+		Message m(MSG_MODE);
+		string modes_str = add ? "+" : "-";
+
+		m.setSender(sender ? sender : irc);
+		m.setReceiver(this);
+		m.addArg(modes_str);
+		for(size_t i = 0; i < MAX_MODES && it != chanusers.end(); ++i, ++it)
+		{
+			if(add)
+				(*it)->setStatus(mode);
+			else
+				(*it)->delStatus(mode);
+			modes_str += c;
+			m.addArg((*it)->getName());
+		}
+		m.setArg(0, modes_str);
+		broadcast(m);
+	}
+}
+
 bool Channel::setTopic(Entity* chanuser, const string& topic)
 {
 	string new_topic = topic.substr(0, topic.find('\n'));
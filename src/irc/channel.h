@@ -109,19 +109,28 @@ namespace irc
 	private:
 		vector<ChanUser*> users;
 		string topic;
+		string part_reason;
 
 	public:
 
 		static const char *CHMODES;
 
+		/** Maximum number of user modes sent in one MODE line. */
+		static const size_t MAX_MODES = 4;
+
 		/** Build the Channel object.
 		 *
 		 * @param irc  the IRC object of main server
 		 * @param name  channel name.
 		 */
 		Channel(IRC* irc, string name);
+
+		/** Every users leave the channel. */
 		virtual ~Channel();
 
+		/** Set the reason of PARTs sent when the channel is destroyed. */
+		void setPartReason(const string& reason) { part_reason = reason; }
+
 		/** Check the validity of a channel name
 		 *
 		 * @param name  name to check
@@ -218,6 +227,18 @@ namespace irc
 		 */
 		void delMode(const Entity* sender, int modes, ChanUser* chanuser);
 
+		/** Set or remove a mode on several channel users.
+		 *
+		 * Changes are aggregated in as few MODE lines as possible
+		 * (for example "+vvvv a b c d").
+		 *
+		 * @param sender  entity which changes mode.
+		 * @param add  add or remove the mode.
+		 * @param mode  flag set or removed.
+		 * @param chanusers  channel users impacted.
+		 */
+		void changeModes(const Entity* sender, bool add, ChanUser::mode_t mode, const vector<ChanUser*>& chanusers);
+
 		/** Broadcast a message to all channel users.
 		 *
 		 * @param m  message sent to all channel users
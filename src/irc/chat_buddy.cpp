@@ -30,11 +30,13 @@ ChatBuddy::ChatBuddy(Server* server, im::ChatBuddy _cbuddy)
 	: ConvNick(server, im::Conversation(), "","","",""),
 	  im_cbuddy(_cbuddy)
 {
-	string hostname = im_cbuddy.getRealName();
-	string identname = stringtok(hostname, "@");
+	string realname = im_cbuddy.getRealName();
+	StringTokenizer tok(realname, "@");
+	string identname = tok.next();
+	string hostname = tok.rest();
 	string nickname = im_cbuddy.getName();
 	if(nickname.find('@') != string::npos)
-		nickname = nickize(stringtok(nickname, "@"));
+		nickname = nickize(StringTokenizer(nickname, "@").next());
 	else
 		nickname = nickize(nickname);
 	if(hostname.empty())
@@ -24,6 +24,8 @@
 #include "irc/channel.h"
 #include "server_poll/poll.h"
 #include "core/version.h"
+#include "core/latency.h"
+#include "core/watchdog.h"
 #include "core/util.h"
 
 namespace irc {
@@ -374,6 +376,23 @@ void IRC::m_stats(Message message)
 			}
 			break;
 		}
+		case 'l':
+		{
+			if(message.countArgs() > 1 && message.getArg(1) == "reset")
+			{
+				Latency::reset();
+				notice(user, "Latency histograms have been reset");
+				break;
+			}
+			const map<string, Histogram*>& all = Latency::getAll();
+			for(map<string, Histogram*>::const_iterator it = all.begin(); it != all.end(); ++it)
+				if(it->second->getCount())
+					user->send(Message(RPL_STATSDEBUG).setSender(this)
+									  .setReceiver(user)
+									  .addArg("l")
+									  .addArg(it->first + " " + it->second->format()));
+			break;
+		}
 		case 'm':
 			for(size_t i = 0; commands[i].cmd != NULL; ++i)
 				user->send(Message(RPL_STATSCOMMANDS).setSender(this)
@@ -474,6 +493,49 @@ void IRC::m_stats(Message message)
 			}
 			break;
 		}
+		case 'U':
+			if(!user->hasFlag(Nick::OPER))
+			{
+				user->send(Message(ERR_NOPRIVILEGES).setSender(this)
+								    .setReceiver(user)
+								    .addArg("Permission Denied: Insufficient privileges"));
+				return;
+			}
+			/* Master replies with every STATS lines, and with the end of report. */
+			if(poll->ipc_send(Message(MSG_STATS).addArg("U")))
+				return;
+			notice(user, "Users stats are only available in daemon fork mode");
+			break;
+		case 's':
+		{
+			if(!user->hasFlag(Nick::OPER))
+			{
+				user->send(Message(ERR_NOPRIVILEGES).setSender(this)
+								    .setReceiver(user)
+								    .addArg("Permission Denied: Insufficient privileges"));
+				return;
+			}
+			if(message.countArgs() > 1 && message.getArg(1) == "reset")
+			{
+				Watchdog::reset();
+				notice(user, "Stalls list has been reset");
+				break;
+			}
+			const vector<Watchdog::stall_t>& top = Watchdog::getTop();
+			for(vector<Watchdog::stall_t>::const_iterator it = top.begin(); it != top.end(); ++it)
+			{
+				char date[32];
+				struct tm tm;
+				localtime_r(&it->when, &tm);
+				strftime(date, sizeof date, "%Y-%m-%d %H:%M:%S", &tm);
+				user->send(Message(RPL_STATSDEBUG).setSender(this)
+								  .setReceiver(user)
+								  .addArg("s")
+								  .addArg(string(date) + " " + Latency::formatDuration(it->us) + " " + it->source));
+			}
+			notice(user, t2s(Watchdog::getCount()) + " stalls since start");
+			break;
+		}
 		case 'u':
 		{
 			unsigned now = time(NULL) - uptime;
@@ -488,11 +550,14 @@ void IRC::m_stats(Message message)
 			arg = "*";
 			notice(user, "a (aways) - List all away messages availables");
 			notice(user, "c (chat params) - List all chat parameters for a specific account");
+			notice(user, "l (latency) - Display time taken by commands and callbacks ('reset' to clear)");
 			notice(user, "m (commands) - List all IRC commands");
 			notice(user, "o (opers) - List all opers accounts");
 			notice(user, "p (protocols) - List all protocols");
 			notice(user, "P (plugins) - List, load and configure plugins");
+			notice(user, "s (stalls) - List the slowest callbacks of the last hour (oper only, 'reset' to clear)");
 			notice(user, "u (uptime) - Display the server uptime");
+			notice(user, "U (users) - Display resources used by every users (oper only)");
 			break;
 	}
 	user->send(Message(RPL_ENDOFSTATS).setSender(this)
@@ -17,9 +17,11 @@
  */
 
 #include <cstring>
+#include <algorithm>
 #include <fnmatch.h>
 
 #include "core/caca_image.h"
+#include "core/config.h"
 #include "irc/irc.h"
 #include "irc/user.h"
 #include "irc/buddy.h"
@@ -27,6 +29,21 @@
 
 namespace irc {
 
+static ConfigStringHandle buddy_icons_url(&conf, "irc", "buddy_icons_url");
+
+/** Icon to render for a WHOIS reply. */
+struct WhoisIcon : public CacaRender
+{
+	WhoisIcon(string path, string _nickname, bool _extended)
+		: CacaRender(path, 0, _extended ? 15 : 10),
+		  nickname(_nickname),
+		  extended(_extended)
+	{}
+
+	string nickname;
+	bool extended;
+};
+
 /** WHO */
 void IRC::m_who(Message message)
 {
@@ -166,45 +183,58 @@ void IRC::m_whois(Message message)
 						     .addArg("is an IRC Operator"));
 
 
-	CacaImage icon = n->getIcon();
-	try
+	/* The rest of reply is sent once icon is rendered. */
+	WhoisIcon* icon = new WhoisIcon(n->getIconPath(), n->getNickname(), extended_whois);
+	renders.push_back(icon);
+	CacaImage::render(icon, new CallBack<IRC>(this, &IRC::whois_icon_rendered, icon));
+}
+
+bool IRC::whois_icon_rendered(void* data)
+{
+	WhoisIcon* icon = static_cast<WhoisIcon*>(data);
+
+	renders.erase(std::remove(renders.begin(), renders.end(), icon), renders.end());
+
+	switch(icon->status)
 	{
-		string buf = icon.getIRCBuffer(0, extended_whois ? 15 : 10);
-		string line;
-		user->send(Message(RPL_WHOISACTUALLY).setSender(this)
-					       .setReceiver(user)
-					       .addArg(n->getNickname())
-					       .addArg("Icon:"));
-		while((line = stringtok(buf, "\r\n")).empty() == false)
+		case CacaRender::RENDERED:
 		{
+			StringTokenizer tok(icon->buf, "\r\n");
+			string line;
 			user->send(Message(RPL_WHOISACTUALLY).setSender(this)
 						       .setReceiver(user)
-						       .addArg(n->getNickname())
-						       .addArg(line));
+						       .addArg(icon->nickname)
+						       .addArg("Icon:"));
+			while(tok.next(line))
+			{
+				user->send(Message(RPL_WHOISACTUALLY).setSender(this)
+							       .setReceiver(user)
+							       .addArg(icon->nickname)
+							       .addArg(line));
+			}
+			break;
 		}
+		case CacaRender::NOT_LOADED:
+			user->send(Message(RPL_WHOISACTUALLY).setSender(this)
+						       .setReceiver(user)
+						       .addArg(icon->nickname)
+						       .addArg("libcaca and imlib2 are required to display icon"));
+			break;
+		default:
+			user->send(Message(RPL_WHOISACTUALLY).setSender(this)
+						       .setReceiver(user)
+						       .addArg(icon->nickname)
+						       .addArg("No icon"));
+			break;
 	}
-	catch(CacaError &e)
-	{
-		user->send(Message(RPL_WHOISACTUALLY).setSender(this)
-					       .setReceiver(user)
-					       .addArg(n->getNickname())
-					       .addArg("No icon"));
-	}
-	catch(CacaNotLoaded &e)
-	{
-		user->send(Message(RPL_WHOISACTUALLY).setSender(this)
-					       .setReceiver(user)
-					       .addArg(n->getNickname())
-					       .addArg("libcaca and imlib2 are required to display icon"));
-	}
-	string url = conf.GetSection("irc")->GetItem("buddy_icons_url")->String();
-	string icon_path = n->getIconPath();
+	string url = buddy_icons_url.Value();
+	string icon_path = icon->path;
 	if(url != " " && !icon_path.empty())
 	{
 		icon_path = icon_path.substr(im->getUserPath().size());
 		user->send(Message(RPL_WHOISACTUALLY).setSender(this)
 						       .setReceiver(user)
-						       .addArg(n->getNickname())
+						       .addArg(icon->nickname)
 						       .addArg("Icon URL: " + url + im->getUsername() + icon_path));
 	}
 
@@ -212,12 +242,15 @@ void IRC::m_whois(Message message)
 	 * whois. In this case, do not send a ENDOFWHOIS because this
 	 * is an asynchronous call.
 	 */
-	if(!extended_whois || !n->retrieveInfo())
+	Nick* n = getNick(icon->nickname);
+	if(!icon->extended || !n || !n->retrieveInfo())
 		user->send(Message(RPL_ENDOFWHOIS).setSender(this)
 						  .setReceiver(user)
-						  .addArg(n->getNickname())
+						  .addArg(icon->nickname)
 						  .addArg("End of /WHOIS list"));
 
+	delete icon;
+	return false;
 }
 
 /** WHOWAS nick
@@ -241,8 +274,9 @@ void IRC::m_privmsg(Message message)
 {
 	Message relayed(message.getCommand());
 	string targets = message.getArg(0), target;
+	StringTokenizer tok(targets, ",");
 
-	while ((target = stringtok(targets, ",")).empty() == false)
+	while (tok.next(target))
 	{
 		relayed.setSender(user);
 		relayed.addArg(message.getArg(1));
@@ -289,7 +323,8 @@ void IRC::m_join(Message message)
 	string names = message.getArg(0);
 	string channame;
 	string parameters = message.countArgs() > 1 ? message.getArg(1) : "";
-	while((channame = stringtok(names, ",")).empty() == false)
+	StringTokenizer names_tok(names, ","), parameters_tok(parameters, ",");
+	while(names_tok.next(channame))
 	{
 		if(!Channel::isChanName(channame))
 		{
@@ -324,10 +359,12 @@ void IRC::m_join(Message message)
 				if(chan)
 					continue;
 
-				string accid = channame.substr(1);
+				string name = channame.substr(1);
+				StringTokenizer tok(name, ":");
 				/* purple_url_decode() returns a static buffer, no free needed. */
-				string convname = purple_url_decode(stringtok(accid, ":").c_str());
-				string param = purple_url_decode(stringtok(parameters, ",").c_str());
+				string convname = purple_url_decode(tok.next().c_str());
+				string accid = tok.rest();
+				string param = purple_url_decode(parameters_tok.next().c_str());
 				if(accid.empty() || convname.empty())
 				{
 					user->send(Message(ERR_NOSUCHCHANNEL).setSender(this)
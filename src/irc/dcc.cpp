@@ -21,9 +21,15 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <string.h>
+#include <stdlib.h>
 #include <sys/types.h>
 #include <netinet/in.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#ifdef HAVE_SENDFILE
+#include <sys/sendfile.h>
+#endif
+#include <algorithm>
 
 #include "dcc.h"
 #include "nick.h"
@@ -32,10 +38,153 @@
 #include "core/util.h"
 #include "core/log.h"
 #include "core/config.h"
+#include "core/metrics.h"
 
 namespace irc {
 
-DCCServer::DCCServer(string _type, string _filename, size_t _total_size, Nick* _sender, Nick* _receiver)
+static ConfigItemHandle port_range(&conf, "file_transfers", "port_range");
+static ConfigStringHandle dcc_own_ip(&conf, "file_transfers", "dcc_own_ip");
+static ConfigBoolHandle dcc_passive(&conf, "file_transfers", "dcc_passive");
+
+/** Socket buffers size, to keep the link busy during file transfers. */
+static const int SOCKET_BUFFER_SIZE = 512 * 1024;
+
+/** Token of the last passive DCC request. */
+static unsigned int last_token = 0;
+
+/** Quote a filename for a DCC request.
+ *
+ * As there isn't any way to escape correctly strings in the DCC SEND
+ * sequence, it replaces every '"' with a '\''.
+ */
+static string dcc_quote(string filename)
+{
+	for(string::iterator c = filename.begin(); c != filename.end(); ++c)
+		if(*c == '"') *c = '\'';
+	return "\"" + filename + "\"";
+}
+
+/** Start listening on a port of the configured range.
+ *
+ * An IPv6 socket is used when the advertised address is an IPv6 one.
+ */
+static PurpleNetworkListenData* dcc_listen(PurpleNetworkListenCallback cb, gpointer data)
+{
+	uint16_t min = (uint16_t)port_range->MinInteger(), max = (uint16_t)port_range->MaxInteger();
+#if PURPLE_VERSION_CHECK(2,7,0)
+	struct in6_addr addr6;
+	int family = AF_INET;
+	if(inet_pton(AF_INET6, dcc_own_ip.Value().c_str(), &addr6) == 1)
+		family = AF_INET6;
+	return purple_network_listen_range_family(min, max, family, SOCK_STREAM, cb, data);
+#else
+	return purple_network_listen_range(min, max, SOCK_STREAM, cb, data);
+#endif
+}
+
+/** Get the address to put in a DCC request, encoded as an integer for
+ * IPv4, or in its textual form for IPv6.
+ */
+static bool dcc_own_address(int sock, string* encoded)
+{
+	struct in_addr addr;
+	struct in6_addr addr6;
+	string bind_addr = dcc_own_ip.Value();
+	if (bind_addr == " ")
+		bind_addr = purple_network_get_my_ip(sock);
+
+	if (inet_aton(bind_addr.c_str(), &addr))
+		*encoded = t2s(ntohl(addr.s_addr));
+	else if (inet_pton(AF_INET6, bind_addr.c_str(), &addr6) == 1)
+		*encoded = bind_addr;
+	else
+	{
+		b_log[W_ERR] << "Unable to parse this IP address: [" << bind_addr << "]: Unable to send DCC request.";
+		return false;
+	}
+	return true;
+}
+
+static void dcc_setup_socket(int sock)
+{
+	int flags = fcntl(sock, F_GETFL);
+	fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+	fcntl(sock, F_SETFD, FD_CLOEXEC);
+
+	flags = SOCKET_BUFFER_SIZE;
+	setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &flags, sizeof flags);
+	setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &flags, sizeof flags);
+}
+
+/** Accept a connection on a listening DCC socket. */
+static int dcc_accept(int fd)
+{
+	int conn = accept(fd, NULL, 0);
+	if(conn < 0)
+	{
+		b_log[W_ERR] << "DCC connection failed: " << strerror(errno);
+		return -1;
+	}
+
+	dcc_setup_socket(conn);
+	return conn;
+}
+
+/** Connect to the address of a DCC request.
+ *
+ * The socket is non-blocking, so the connection may still be in
+ * progress when this function returns. It is established when the
+ * socket becomes writable, and errors are reported by SO_ERROR.
+ *
+ * @param addr  an integer for IPv4, or the textual form of an IPv6 address.
+ * @param port  port
+ * @return  the socket, or -1
+ */
+static int dcc_connect(const string& addr, uint16_t port)
+{
+	struct sockaddr_storage ss;
+	socklen_t len;
+	int sock;
+
+	memset(&ss, 0, sizeof ss);
+	if(addr.find(':') != string::npos)
+	{
+		struct sockaddr_in6* sin6 = (struct sockaddr_in6*)&ss;
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_port = htons(port);
+		if(inet_pton(AF_INET6, addr.c_str(), &sin6->sin6_addr) != 1)
+		{
+			b_log[W_ERR] << "Unable to parse this IP address: [" << addr << "]";
+			return -1;
+		}
+		len = sizeof *sin6;
+	}
+	else
+	{
+		struct sockaddr_in* sin = (struct sockaddr_in*)&ss;
+		sin->sin_family = AF_INET;
+		sin->sin_addr.s_addr = htonl(s2t<uint32_t>(addr));
+		sin->sin_port = htons(port);
+		len = sizeof *sin;
+	}
+
+	sock = socket(ss.ss_family, SOCK_STREAM, IPPROTO_TCP);
+	if(sock >= 0)
+		dcc_setup_socket(sock);
+
+	/* An unreachable peer must not block the main loop. */
+	if(sock < 0 || (connect(sock, (struct sockaddr*) &ss, len) < 0 && errno != EINPROGRESS))
+	{
+		b_log[W_ERR] << "Unable to establish DCC connection: " << strerror(errno);
+		if(sock >= 0)
+			close(sock);
+		return -1;
+	}
+
+	return sock;
+}
+
+DCCServer::DCCServer(string _type, string _filename, size_t _total_size, Nick* _sender, Nick* _receiver, bool passive)
 	: type(_type),
 	  filename(_filename),
 	  total_size(_total_size),
@@ -46,11 +195,22 @@ DCCServer::DCCServer(string _type, string _filename, size_t _total_size, Nick* _
 	  watcher(0),
 	  fd(-1),
 	  port(0),
+	  connecting(false),
 	  finished(false)
 {
-	ConfigItem* item = conf.GetSection("file_transfers")->GetItem("port_range");
-	listen_data = purple_network_listen_range((uint16_t)item->MinInteger(), (uint16_t)item->MaxInteger(),
-	                                          SOCK_STREAM, &DCCServer::listen_cb, this);
+	if(passive)
+	{
+		/* The IRC user will listen and answer with the same token. */
+		string addr;
+		if(!dcc_own_address(-1, &addr))
+			throw DCCListenError();
+
+		token = t2s(++last_token);
+		request(addr);
+		return;
+	}
+
+	listen_data = dcc_listen(&DCCServer::listen_cb, this);
 	if(!listen_data)
 		throw DCCListenError();
 }
@@ -70,9 +230,22 @@ void DCCServer::deinit()
 		purple_network_listen_cancel(listen_data);
 
 	finished = true;
+	connecting = false;
 	fd = -1;
 	watcher = 0;
 	listen_data = NULL;
+	token.clear();
+}
+
+void DCCServer::request(const string& addr)
+{
+	receiver->send(Message(MSG_PRIVMSG).setSender(sender ? sender->getLongName() : "some.one")
+			                   .setReceiver(receiver)
+					   .addArg("\001DCC " + type + " " + dcc_quote(filename) + " " +
+						   addr + " " + t2s(port) +
+						   (total_size || !token.empty() ? (" " + t2s(total_size)) : "") +
+						   (token.empty() ? "" : " " + token) +
+						   "\001"));
 }
 
 void DCCServer::dcc_read_cb(gpointer data, int source, PurpleInputCondition cond)
@@ -84,10 +257,9 @@ void DCCServer::dcc_read_cb(gpointer data, int source, PurpleInputCondition cond
 void DCCServer::connected(gpointer data, int source, PurpleInputCondition cond)
 {
 	DCCServer* dcc = static_cast<DCCServer*>(data);
-	int conn = accept(dcc->fd, NULL, 0), flags;
-	if(!conn)
+	int conn = dcc_accept(dcc->fd);
+	if(conn < 0)
 	{
-		b_log[W_ERR] << "DCC connection failed";
 		dcc->deinit();
 		return;
 	}
@@ -96,10 +268,6 @@ void DCCServer::connected(gpointer data, int source, PurpleInputCondition cond)
 	dcc->watcher = 0;
 	close(dcc->fd);
 	dcc->fd = conn;
-
-	flags = fcntl(conn, F_GETFL);
-	fcntl(conn, F_SETFL, flags | O_NONBLOCK);
-	fcntl(conn, F_SETFD, FD_CLOEXEC);
 	dcc->watcher = purple_input_add(conn, PURPLE_INPUT_READ, DCCServer::dcc_read_cb, dcc);
 
 	dcc->updated(false);
@@ -108,17 +276,20 @@ void DCCServer::connected(gpointer data, int source, PurpleInputCondition cond)
 void DCCServer::listen_cb(int sock, void* data)
 {
 	DCCServer* dcc = static_cast<DCCServer*>(data);
-	struct in_addr addr;
-	string bind_addr = conf.GetSection("file_transfers")->GetItem("dcc_own_ip")->String();
-	if (bind_addr == " ")
-		bind_addr = purple_network_get_my_ip(-1);
+	string addr;
 
-	dcc->fd = sock;
 	dcc->listen_data = NULL;
+	if (sock < 0)
+	{
+		b_log[W_ERR] << "Unable to listen for DCC";
+		dcc->deinit();
+		return;
+	}
+
+	dcc->fd = sock;
 	dcc->port = purple_network_get_port_from_fd(sock);
-	if (!inet_aton(bind_addr.c_str(), &addr))
+	if (!dcc_own_address(sock, &addr))
 	{
-		b_log[W_ERR] << "Unable to parse this IP address: [" << bind_addr << "]: Unable to send DCC request.";
 		dcc->deinit();
 		return;
 	}
@@ -126,30 +297,57 @@ void DCCServer::listen_cb(int sock, void* data)
 	dcc->watcher = purple_input_add(sock, PURPLE_INPUT_READ,
 					connected, dcc);
 
-	/* As there isn't any way to escape correctly strings in the DCC SEND
-	 * sequence, it replaces every '"' with a '\''.
-	 */
-	string filename = dcc->filename;
-	for(string::iterator c = filename.begin(); c != filename.end(); ++c)
-		if(*c == '"') *c = '\'';
+	dcc->request(addr);
+}
+
+bool DCCServer::connectPassive(const string& _token, const string& addr, uint16_t _port)
+{
+	if(token.empty() || _token != token || fd >= 0 || finished)
+		return false;
+
+	fd = dcc_connect(addr, _port);
+	if(fd < 0)
+	{
+		deinit();
+		return true;
+	}
 
-	dcc->receiver->send(Message(MSG_PRIVMSG).setSender(dcc->sender ? dcc->sender->getLongName() : "some.one")
-			                 .setReceiver(dcc->receiver)
-					 .addArg("\001DCC " + dcc->type + " \"" + dcc->filename + "\" " +
-						 t2s(ntohl(addr.s_addr)) + " " +
-						 t2s(dcc->port) +
-						 (dcc->total_size ? (" " + t2s(dcc->total_size)) : "") +
-						 "\001"));
+	token.clear();
+	connecting = true;
+	watcher = purple_input_add(fd, PURPLE_INPUT_WRITE, DCCServer::connect_cb, this);
+	return true;
+}
+
+void DCCServer::connect_cb(gpointer data, int source, PurpleInputCondition cond)
+{
+	DCCServer* dcc = static_cast<DCCServer*>(data);
+	int err = 0;
+	socklen_t len = sizeof err;
+
+	if(getsockopt(source, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+		err = errno;
+	if(err)
+	{
+		b_log[W_ERR] << "Unable to establish DCC connection: " << strerror(err);
+		dcc->deinit();
+		return;
+	}
+
+	purple_input_remove(dcc->watcher);
+	dcc->connecting = false;
+	dcc->watcher = purple_input_add(source, PURPLE_INPUT_READ, DCCServer::dcc_read_cb, dcc);
+	dcc->updated(false);
 }
 
 DCCSend::DCCSend(const im::FileTransfert& _ft, Nick* _sender, Nick* _receiver)
-	: DCCServer("SEND", _ft.getFileName(), _ft.getSize(), _sender, _receiver),
+	: DCCServer("SEND", _ft.getFileName(), _ft.getSize(), _sender, _receiver, dcc_passive.Value()),
 	  ft(_ft),
 	  local_filename(_ft.getLocalFileName()),
 	  bytes_sent(0),
-	  fp(NULL),
-	  rxlen(0),
-	  rxqueue(NULL)
+	  bytes_acked(0),
+	  file_fd(-1),
+	  write_watcher(0),
+	  rxlen(0)
 {
 }
 
@@ -160,13 +358,16 @@ DCCSend::~DCCSend()
 
 void DCCSend::deinit()
 {
+	if(write_watcher > 0)
+		purple_input_remove(write_watcher);
+
 	DCCServer::deinit();
 
-	if(fp != NULL)
-		fclose(fp);
-	g_free(rxqueue);
-	fp = NULL;
-	rxqueue = NULL;
+	if(file_fd >= 0)
+		close(file_fd);
+	write_watcher = 0;
+	file_fd = -1;
+	rxlen = 0;
 }
 
 void DCCSend::updated(bool destroy)
@@ -174,46 +375,115 @@ void DCCSend::updated(bool destroy)
 	if(destroy)
 		this->ft = im::FileTransfert(); /* No-valid object */
 
-	if((fd < 0 || listen_data) && (start_time + TIMEOUT < time(NULL)))
+	if((fd < 0 || listen_data || connecting) && (start_time + TIMEOUT < time(NULL)))
 		deinit();
 	else
 		dcc_send();
 }
 
+void DCCSend::dcc_write_cb(gpointer data, int source, PurpleInputCondition cond)
+{
+	DCCSend* dcc = static_cast<DCCSend*>(data);
+	dcc->dcc_send();
+}
+
+ssize_t DCCSend::send_chunk(size_t count)
+{
+#ifdef HAVE_SENDFILE
+	off_t offset = bytes_sent;
+	return sendfile(fd, file_fd, &offset, count);
+#else
+	static char buf[64 * 1024];
+	ssize_t len = pread(file_fd, buf, std::min(count, sizeof buf), bytes_sent);
+
+	if(len <= 0)
+		return len;
+
+	/* Only what has been accepted by socket is counted, the rest
+	 * will be read again from file. */
+	return send(fd, buf, len, 0);
+#endif
+}
+
 void DCCSend::dcc_send()
 {
-	if(finished || listen_data || fd < 0)
+	if(finished || listen_data || connecting || fd < 0)
 		return;
 
-	if(!fp)
+	if(file_fd < 0)
 	{
-		fp = fopen(local_filename.c_str(), "r");
-		if(!fp)
+		file_fd = open(local_filename.c_str(), O_RDONLY);
+		if(file_fd < 0)
 			return; /* File isn't written yet. */
+		fcntl(file_fd, F_SETFD, FD_CLOEXEC);
 	}
 
-	/* It does not add any \0 on buffer */
-	static char buf[512];
-	size_t len = fread(buf, sizeof(char), sizeof buf, fp);
+	/* Only send what libpurple has already written in file. */
+	struct stat st;
+	if(fstat(file_fd, &st) < 0)
+	{
+		b_log[W_ERR] << "Unable to read " << local_filename << ": " << strerror(errno);
+		deinit();
+		return;
+	}
 
-	if(len > 0)
-		send(fd, buf, len, 0);
+	size_t available = (size_t)st.st_size > bytes_sent ? (size_t)st.st_size - bytes_sent : 0;
+	size_t burst = SEND_BURST;
+	ssize_t len = 0;
 
-	bytes_sent += len;
+	while(available > 0 && burst > 0)
+	{
+		len = send_chunk(std::min(available, burst));
+		if(len < 0 && errno == EINTR)
+			continue;
+		if(len <= 0)
+			break;
+
+		bytes_sent += len;
+		available -= len;
+		METRIC_ADD("minbif_dcc_bytes_total{direction=\"send\"}", len);
+		burst -= len;
+	}
+
+	if(len < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+	{
+		b_log[W_ERR] << "Unable to send " << filename << " with DCC: " << strerror(errno);
+		deinit();
+		return;
+	}
+	if(len == 0)
+		available = 0; /* File has been truncated? Wait for an update. */
+
+	/* Keep pumping while there is remaining data, and sleep until
+	 * the next update otherwise. */
+	if(available > 0 && write_watcher <= 0)
+		write_watcher = purple_input_add(fd, PURPLE_INPUT_WRITE, DCCSend::dcc_write_cb, this);
+	else if(available == 0 && write_watcher > 0)
+	{
+		purple_input_remove(write_watcher);
+		write_watcher = 0;
+	}
 }
 
 void DCCSend::dcc_read(int source)
 {
-	static char buffer[64];
 	ssize_t len;
 
-	len = read(source, buffer, sizeof(buffer));
+	/* The incomplete ACK from the previous read (at most 3 bytes)
+	 * stays at the beginning of buffer. */
+	len = read(source, rxbuf + rxlen, RXBUF_SIZE - rxlen);
 
 	if (len < 0 && errno == EAGAIN)
 		return;
 	else if (len <= 0) {
-		/* DCC user has closed connection.
-		 * fd is already closed, do not let deinit()
+		/* DCC user has closed connection. In the "turbo" mode,
+		 * it does not send any ACK, and this is the only way
+		 * to know the file has been received.
+		 */
+		if (total_size > 0 && bytes_sent >= total_size)
+			terminated();
+
+		/* fd is already closed, do not let deinit()
 		 * reclose it.
 		 */
 		this->fd = -1;
@@ -221,38 +491,53 @@ void DCCSend::dcc_read(int source)
 		return;
 	}
 
-	this->rxqueue = (guchar*)g_realloc(this->rxqueue, len + this->rxlen);
-	memcpy(this->rxqueue + this->rxlen, buffer, len);
-	this->rxlen += (guint)len;
-
-	while (1) {
-		size_t acked;
-
-		if (this->rxlen < 4)
-			break;
+	rxlen += len;
 
-		acked = ntohl(*((gint32 *)this->rxqueue));
+	/* ACKs are cumulative, so only the last complete one matters. */
+	size_t end = rxlen - rxlen % 4;
+	if (end > 0)
+	{
+		uint32_t ack;
+		memcpy(&ack, rxbuf + end - 4, sizeof ack);
 
-		this->rxlen -= 4;
-		if (this->rxlen) {
-			unsigned char *tmp = (unsigned char*)g_memdup(this->rxqueue + 4, (guint)this->rxlen);
-			g_free(this->rxqueue);
-			this->rxqueue = tmp;
-		} else {
-			g_free(this->rxqueue);
-			this->rxqueue = NULL;
-		}
+		rxlen -= end;
+		memmove(rxbuf, rxbuf + end, rxlen);
 
-		if (acked >= this->total_size) {
-			/* DCC send terminated \o/ */
-			this->deinit();
+		dcc_ack(ntohl(ack));
+		if (finished)
 			return;
-		}
 	}
 
 	this->dcc_send();
 }
 
+void DCCSend::dcc_ack(uint32_t ack)
+{
+	/* ACKs are the 32 lower bits of the position. Rebuild the real
+	 * position from what has been sent, for files larger than 4 GiB. */
+	uint64_t acked = ((uint64_t)bytes_sent & ~(uint64_t)0xffffffff) | ack;
+	if (acked > bytes_sent && acked >= ((uint64_t)1 << 32))
+		acked -= (uint64_t)1 << 32;
+
+	if (acked > bytes_acked)
+		bytes_acked = (size_t)acked;
+
+	if (bytes_acked >= total_size) {
+		/* DCC send terminated \o/ */
+		terminated();
+		this->deinit();
+	}
+}
+
+void DCCSend::terminated()
+{
+	time_t duration = time(NULL) - start_time;
+	size_t bytes = std::max(bytes_acked, bytes_sent);
+
+	b_log[W_INFO] << "File " << filename << " sent with DCC: " << bytes << " bytes in "
+	              << duration << "s (" << (bytes / 1024 / (duration > 0 ? duration : 1)) << " KiB/s)";
+}
+
 DCCChat::DCCChat(Nick* sender, Nick* receiver)
 	: DCCServer("CHAT", "CHAT", 0, sender, receiver)
 {}
@@ -274,54 +559,78 @@ void DCCChat::dcc_read(int source)
 
 void DCCChat::updated(bool destroy)
 {
-	if((fd < 0 || listen_data) && (start_time + TIMEOUT < time(NULL)))
+	if((fd < 0 || listen_data || connecting) && (start_time + TIMEOUT < time(NULL)))
 		deinit();
 }
 
-void DCCChat::dcc_send(string buf)
+void DCCChat::dcc_send(const string& buf)
 {
-	if(finished || listen_data || fd < 0)
+	if(finished || listen_data || connecting || fd < 0)
 		return;
 
 	send(fd, buf.c_str(), buf.size(), 0);
 }
 
-DCCGet::DCCGet(Nick* _from, string _filename, uint32_t addr, uint16_t port,
-	       ssize_t size, _CallBack* _cb)
+const char DCCGet::PART_SUFFIX[] = ".part";
+
+DCCGet::DCCGet(Nick* _from, Nick* _user, string _filename, string _addr, uint16_t _port,
+	       ssize_t size, string _token, _CallBack* _cb)
 	: from(_from),
+	  user(_user),
 	  filename(_filename),
 	  callback(_cb),
 	  finished(false),
+	  addr(_addr),
+	  port(_port),
+	  token(_token),
+	  listen_data(NULL),
 	  sock(-1),
 	  watcher(0),
-	  fp(NULL),
+	  resume_timer(0),
+	  file_fd(-1),
+	  buffer(NULL),
+	  buffered(0),
 	  bytes_received(0),
 	  total_size(size)
 {
-	fp = fopen(filename.c_str(), "w");
-	if(!fp)
+	void* ptr;
+	if(posix_memalign(&ptr, BUFFER_ALIGN, BUFFER_SIZE) != 0)
 	{
-		b_log[W_ERR] << "Unable to create local file: " << filename;
+		b_log[W_ERR] << "Unable to allocate DCC buffer";
+		deinit();
 		throw DCCGetError();
 	}
+	buffer = static_cast<char*>(ptr);
 
-	struct sockaddr_in fsocket;
-
-	memset(&fsocket, 0, sizeof fsocket);
-	fsocket.sin_family = AF_INET;
-	fsocket.sin_addr.s_addr = htonl(addr);
-	fsocket.sin_port = htons(port);
+	/* Data is written in a temporary file, renamed once complete, so an
+	 * existing file is only resumed if it is known to be partial. */
+	file_fd = open((filename + PART_SUFFIX).c_str(), O_WRONLY|O_CREAT, 0666);
+	if(file_fd < 0)
+	{
+		b_log[W_ERR] << "Unable to create local file: " << filename << PART_SUFFIX;
+		deinit();
+		throw DCCGetError();
+	}
+	fcntl(file_fd, F_SETFD, FD_CLOEXEC);
 
-	sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	struct stat st;
+	if(user && total_size > 0 && fstat(file_fd, &st) == 0 && st.st_size > 0 && st.st_size < total_size)
+	{
+		/* A previous upload of this file has been interrupted. */
+		user->send(Message(MSG_PRIVMSG).setSender(from)
+					       .setReceiver(user)
+					       .addArg("\001DCC RESUME " + dcc_quote(filename.substr(filename.rfind('/') + 1)) + " " +
+						       t2s(port) + " " + t2s(st.st_size) +
+						       (isPassive() ? " " + token : "") + "\001"));
+		resume_timer = g_timeout_add(RESUME_TIMEOUT, DCCGet::resume_timeout, this);
+		return;
+	}
 
-	if(connect(sock, (struct sockaddr*) &fsocket, sizeof fsocket) < 0)
+	if(!start(0))
 	{
-		b_log[W_ERR] << "Unable to receive file: " << strerror(errno);
-		delete callback;
+		deinit();
 		throw DCCGetError();
 	}
-
-	watcher = purple_input_add(sock, PURPLE_INPUT_READ, DCCGet::dcc_read, this);
 }
 
 DCCGet::~DCCGet()
@@ -335,61 +644,227 @@ void DCCGet::deinit()
 		close(sock);
 	if(watcher > 0)
 		purple_input_remove(watcher);
-	if(fp != NULL)
-		fclose(fp);
+	if(resume_timer > 0)
+		g_source_remove(resume_timer);
+	if(listen_data != NULL)
+		purple_network_listen_cancel(listen_data);
+	if(file_fd >= 0)
+		close(file_fd);
 	if(callback)
 		delete callback;
+	free(buffer);
 
 	finished = true;
 	sock = -1;
 	watcher = 0;
-	fp = NULL;
+	resume_timer = 0;
+	listen_data = NULL;
+	file_fd = -1;
 	callback = NULL;
+	buffer = NULL;
+	buffered = 0;
 }
 
-void DCCGet::dcc_read(gpointer data, int source, PurpleInputCondition cond)
+bool DCCGet::start(ssize_t position)
 {
-	DCCGet* dcc = static_cast<DCCGet*>(data);
-	static char buffer[1024];
-	ssize_t len;
+	/* Data after this position will be received again. */
+	if(ftruncate(file_fd, position) < 0)
+	{
+		b_log[W_ERR] << "Unable to resize local file " << filename << ": " << strerror(errno);
+		return false;
+	}
+	bytes_received = position;
 
-	len = read(source, buffer, sizeof(buffer));
+	if(isPassive())
+	{
+		/* IRC user can't listen, so listen and answer with our address. */
+		listen_data = dcc_listen(&DCCGet::listen_cb, this);
+		if(!listen_data)
+		{
+			b_log[W_ERR] << "Unable to listen for DCC";
+			return false;
+		}
+		return true;
+	}
 
-	if (len < 0 && errno == EAGAIN)
+	sock = dcc_connect(addr, port);
+	if(sock < 0)
+	{
+		b_log[W_ERR] << "Unable to receive file " << filename;
+		return false;
+	}
+
+	watcher = purple_input_add(sock, PURPLE_INPUT_READ, DCCGet::dcc_read, this);
+	return true;
+}
+
+void DCCGet::listen_cb(int sock, void* data)
+{
+	DCCGet* dcc = static_cast<DCCGet*>(data);
+	string addr;
+
+	dcc->listen_data = NULL;
+	if(sock < 0)
+	{
+		b_log[W_ERR] << "Unable to listen for DCC";
+		dcc->deinit();
 		return;
-	else if (len <= 0) {
-		/* DCC user has closed connection.
-		 * fd is already closed, do not let deinit()
-		 * reclose it.
-		 */
-		dcc->sock = -1;
+	}
+
+	dcc->sock = sock;
+	if(!dcc_own_address(sock, &addr))
+	{
 		dcc->deinit();
 		return;
 	}
 
-	if(fwrite(buffer, sizeof(char), len, dcc->fp) < (size_t)len)
+	dcc->watcher = purple_input_add(sock, PURPLE_INPUT_READ, DCCGet::connected, dcc);
+
+	dcc->user->send(Message(MSG_PRIVMSG).setSender(dcc->from)
+					    .setReceiver(dcc->user)
+					    .addArg("\001DCC SEND " + dcc_quote(dcc->filename.substr(dcc->filename.rfind('/') + 1)) + " " +
+						    addr + " " + t2s(purple_network_get_port_from_fd(sock)) + " " +
+						    t2s(dcc->total_size) + " " + dcc->token + "\001"));
+}
+
+void DCCGet::connected(gpointer data, int source, PurpleInputCondition cond)
+{
+	DCCGet* dcc = static_cast<DCCGet*>(data);
+	int conn = dcc_accept(dcc->sock);
+
+	purple_input_remove(dcc->watcher);
+	dcc->watcher = 0;
+	close(dcc->sock);
+	dcc->sock = conn;
+
+	if(conn < 0)
 	{
-		b_log[W_ERR] << "Unable to write received data: " << strerror(errno);
 		dcc->deinit();
 		return;
 	}
 
-	dcc->bytes_received += len;
-	if(dcc->bytes_received >= dcc->total_size)
+	dcc->watcher = purple_input_add(conn, PURPLE_INPUT_READ, DCCGet::dcc_read, dcc);
+}
+
+bool DCCGet::accept(uint16_t _port, ssize_t position, const string& _token)
+{
+	if(resume_timer == 0 || _port != port || _token != token)
+		return false;
+
+	g_source_remove(resume_timer);
+	resume_timer = 0;
+
+	struct stat st;
+	if(position < 0 || fstat(file_fd, &st) < 0 || position > st.st_size)
+		position = 0;
+
+	b_log[W_INFO] << "Resuming reception of " << filename << " at " << position << " bytes";
+	if(!start(position))
+		deinit();
+	return true;
+}
+
+gboolean DCCGet::resume_timeout(gpointer data)
+{
+	DCCGet* dcc = static_cast<DCCGet*>(data);
+
+	dcc->resume_timer = 0;
+	b_log[W_INFO] << "No answer to DCC RESUME, receiving " << dcc->filename << " from the beginning";
+	if(!dcc->start(0))
+		dcc->deinit();
+	return FALSE;
+}
+
+bool DCCGet::flush()
+{
+	off_t offset = bytes_received - buffered;
+	size_t written = 0;
+
+	while(written < buffered)
 	{
-		unsigned long l = htonl(dcc->bytes_received);
-		size_t result = write(dcc->sock, &l, sizeof(l));
-		if(result != sizeof(l))
-			b_log[W_WARNING] << "Unable to send DCC ack";
+		ssize_t len = pwrite(file_fd, buffer + written, buffered - written, offset + written);
+		if(len < 0 && errno == EINTR)
+			continue;
+		if(len < 0)
+		{
+			b_log[W_ERR] << "Unable to write received data: " << strerror(errno);
+			return false;
+		}
+		written += len;
+	}
 
-		if(dcc->callback)
+	buffered = 0;
+	return true;
+}
+
+void DCCGet::ack()
+{
+	/* ACKs are cumulative, and only contain the 32 lower bits. */
+	uint32_t l = htonl((uint32_t)bytes_received);
+	if(write(sock, &l, sizeof(l)) != sizeof(l))
+		b_log[W_WARNING] << "Unable to send DCC ack";
+}
+
+void DCCGet::dcc_read(gpointer data, int source, PurpleInputCondition cond)
+{
+	DCCGet* dcc = static_cast<DCCGet*>(data);
+	ssize_t len = 0;
+	bool received = false;
+
+	while(dcc->buffered < BUFFER_SIZE)
+	{
+		len = read(source, dcc->buffer + dcc->buffered, BUFFER_SIZE - dcc->buffered);
+		if(len < 0 && errno == EINTR)
+			continue;
+		if(len <= 0)
+			break;
+
+		dcc->buffered += len;
+		dcc->bytes_received += len;
+		METRIC_ADD("minbif_dcc_bytes_total{direction=\"get\"}", len);
+		received = true;
+	}
+
+	if(received)
+		dcc->ack();
+
+	if(received && dcc->bytes_received >= dcc->total_size)
+	{
+		if(!dcc->flush())
 		{
-			fflush(dcc->fp);
-			dcc->callback->run();
+			dcc->deinit();
+			return;
 		}
+
+		/* File is closed before libpurple reads it. */
+		close(dcc->file_fd);
+		dcc->file_fd = -1;
+
+		if(rename((dcc->filename + PART_SUFFIX).c_str(), dcc->filename.c_str()) < 0)
+		{
+			b_log[W_ERR] << "Unable to rename " << dcc->filename << PART_SUFFIX << ": " << strerror(errno);
+			dcc->deinit();
+			return;
+		}
+
+		if(dcc->callback)
+			dcc->callback->run();
+		dcc->deinit();
+		return;
+	}
+
+	if(len == 0 || (len < 0 && errno != EAGAIN))
+	{
+		/* DCC user has closed connection. Keep what has been
+		 * received, to be able to resume the transfer. */
+		b_log[W_ERR] << "Reception of " << dcc->filename << " interrupted at " << dcc->bytes_received << " bytes";
+		dcc->flush();
 		dcc->deinit();
+		return;
 	}
 
+	if(dcc->buffered == BUFFER_SIZE && !dcc->flush())
+		dcc->deinit();
 }
 
 void DCCGet::updated(bool destroy)
@@ -407,27 +882,51 @@ void DCCGet::setPeer(Nick* n)
 		deinit();
 }
 
-bool DCCGet::parseDCCSEND(string line, string* filename, uint32_t* addr, uint16_t* port, ssize_t* size)
+/** Split a CTCP DCC message in arguments. */
+static bool parseDCC(string line, Message& args)
 {
-	if(line[0] != '\1' || line[line.size() - 1] != '\1')
+	if(line.size() < 2 || line[0] != '\1' || line[line.size() - 1] != '\1')
 		return false;
 
 	string word;
-	Message args;
 
 	/* Remove \1 chars. */
 	line = line.substr(1, line.size()-2);
 
-	while((word = stringtok(line, " ")).empty() == false)
+	StringTokenizer tok(line, " ");
+	while(tok.next(word))
 		args.addArg(word);
 	args.rebuildWithQuotes();
 
-	if(args.countArgs() == 6 && args.getArg(0) == "DCC" && args.getArg(1) == "SEND")
+	return args.countArgs() > 1 && args.getArg(0) == "DCC";
+}
+
+bool DCCGet::parseDCCSEND(string line, string* filename, string* addr, uint16_t* port, ssize_t* size, string* token)
+{
+	Message args;
+
+	if(parseDCC(line, args) && (args.countArgs() == 6 || args.countArgs() == 7) && args.getArg(1) == "SEND")
 	{
 		*filename = args.getArg(2);
-		*addr = s2t<uint32_t>(args.getArg(3));
+		*addr = args.getArg(3);
 		*port = s2t<uint16_t>(args.getArg(4));
 		*size = s2t<ssize_t>(args.getArg(5));
+		*token = args.countArgs() == 7 ? args.getArg(6) : "";
+		return true;
+	}
+
+	return false;
+}
+
+bool DCCGet::parseDCCACCEPT(string line, uint16_t* port, ssize_t* position, string* token)
+{
+	Message args;
+
+	if(parseDCC(line, args) && (args.countArgs() == 5 || args.countArgs() == 6) && args.getArg(1) == "ACCEPT")
+	{
+		*port = s2t<uint16_t>(args.getArg(3));
+		*position = s2t<ssize_t>(args.getArg(4));
+		*token = args.countArgs() == 6 ? args.getArg(5) : "";
 		return true;
 	}
 
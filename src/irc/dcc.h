@@ -65,19 +65,39 @@ namespace irc {
 		int watcher;
 		int fd;
 		unsigned port;
+		string token;
+		bool connecting;         /**< connection to a passive DCC in progress */
 		bool finished;
 
 		static void listen_cb(int sock, void* data);
 		static void connected(gpointer data, int source, PurpleInputCondition cond);
+		static void connect_cb(gpointer data, int source, PurpleInputCondition cond);
 		static void dcc_read_cb(gpointer data, int source, PurpleInputCondition cond);
 
+		/** Send the DCC request to IRC user. */
+		void request(const string& addr);
+
 		virtual void deinit();
 		virtual void dcc_read(int source) = 0;
 	public:
 
-		DCCServer(string type, string filename, size_t total_size, Nick* sender, Nick* receiver);
+		/** Create a DCC server.
+		 *
+		 * @param passive  if true, do not listen, but ask IRC user to
+		 *                 listen (port 0 and a token in the request).
+		 */
+		DCCServer(string type, string filename, size_t total_size, Nick* sender, Nick* receiver, bool passive = false);
 		~DCCServer();
 
+		/** IRC user answered to a passive DCC request.
+		 *
+		 * @param token  token of the request
+		 * @param addr  address where IRC user listens
+		 * @param port  port where IRC user listens
+		 * @return  false if the token doesn't match this DCC.
+		 */
+		bool connectPassive(const string& token, const string& addr, uint16_t port);
+
 		bool isFinished() const { return finished; }
 
 		Nick* getPeer() const { return sender; }
@@ -90,34 +110,49 @@ namespace irc {
 	 * on im->minbif. It creates a DCC server on a random port.
 	 *
 	 * When IRC user is connected on server, try to open the file that
-	 * libpurple is currently writting. If success, read 512 bytes and
-	 * send it to IRC user with DCC connection.
+	 * libpurple is currently writting. If success, send everything
+	 * already written in it to IRC user with DCC connection, with
+	 * sendfile() when available.
 	 *
-	 * Everytimes we receive an ACK from IRC user on DCC connection, or
-	 * when libpurple sends us a percentage update, retry to send data
-	 * to DCC user.
+	 * As long as the socket is full, a write watcher pumps the data as
+	 * soon as the socket is writable again. When all available data is
+	 * sent, the watcher is removed, and this is a percentage update from
+	 * libpurple (or an ACK from IRC user) which asks to send the data
+	 * appended to the file since.
 	 *
 	 * When im->minbif transfert is finished, the minbif->irc transfert
-	 * isn't finished. So the 'ft' reference is removed, and this is the
-	 * read callback which ask to retry to send data to DCC user from
-	 * file.
+	 * isn't finished. So the 'ft' reference is removed, and the file
+	 * is sent until its end.
 	 *
 	 * The file descriptor keeps open.
 	 */
 	class DCCSend : public DCCServer
 	{
+		/** Maximum bytes sent in one call, to not starve the main loop. */
+		static const size_t SEND_BURST = 4 << 20;
+
 		im::FileTransfert ft;
 
 		string local_filename;
 
+		/** Size of the buffer where ACKs are received. */
+		static const size_t RXBUF_SIZE = 4096;
+
 		size_t bytes_sent;
-		FILE* fp;
-		guint rxlen;
-		guchar* rxqueue;
+		size_t bytes_acked;
+		int file_fd;
+		int write_watcher;
+		size_t rxlen;
+		guchar rxbuf[RXBUF_SIZE];
+
+		static void dcc_write_cb(gpointer data, int source, PurpleInputCondition cond);
 
 		virtual void deinit();
 		virtual void dcc_read(int source);
+		ssize_t send_chunk(size_t count);
 		void dcc_send();
+		void dcc_ack(uint32_t ack);
+		void terminated();
 
 	public:
 		DCCSend(const im::FileTransfert& ft, Nick* sender, Nick* receiver);
@@ -125,6 +160,9 @@ namespace irc {
 
 		im::FileTransfert getFileTransfert() const { return ft; }
 		void updated(bool destroy);
+
+		/** Bytes acknowledged by the IRC user. */
+		size_t getAckedBytes() const { return bytes_acked; }
 	};
 
 	class DCCChat : public DCCServer
@@ -138,31 +176,94 @@ namespace irc {
 
 		im::FileTransfert getFileTransfert() const { return im::FileTransfert(); }
 		void updated(bool destroy);
-		void dcc_send(string buf);
+		void dcc_send(const string& buf);
 	};
 
+	/** The DCC class used to receive a file from the IRC user.
+	 *
+	 * Received data is gathered in a large aligned buffer, and written
+	 * with pwrite() when it is full. Every read is acknowledged with
+	 * the cumulative position.
+	 *
+	 * Data is written in a file suffixed by PART_SUFFIX, renamed when
+	 * the transfer is complete. If this partial file already exists and
+	 * is smaller than the announced size, a previous upload has been
+	 * interrupted, and a DCC RESUME is asked to the IRC user. The connection is
+	 * established on the DCC ACCEPT answer, or from the beginning
+	 * of file if there is no answer.
+	 *
+	 * When the file is complete, it is closed before calling the
+	 * callback, which can give its path to libpurple.
+	 *
+	 * If the request is a passive one (port 0 and a token), the IRC user
+	 * can't listen, so minbif listens and answers with its address and
+	 * the same token.
+	 */
 	class DCCGet : public DCC
 	{
+		/** Size of the buffer where received data is gathered. */
+		static const size_t BUFFER_SIZE = 256 * 1024;
+		/** Suffix of the file while it is received. */
+		static const char PART_SUFFIX[];
+		/** Alignment of the buffer. */
+		static const size_t BUFFER_ALIGN = 4096;
+		/** Delay to wait for DCC ACCEPT (in milliseconds). */
+		static const guint RESUME_TIMEOUT = 15 * 1000;
+
 		Nick* from;
+		Nick* user;
 		string filename;
 		_CallBack* callback;
 
 		bool finished;
+		string addr;
+		uint16_t port;
+		string token;
+		PurpleNetworkListenData* listen_data;
 		int sock;
 		int watcher;
-		FILE* fp;
+		guint resume_timer;
+		int file_fd;
+		char* buffer;
+		size_t buffered;
 		ssize_t bytes_received;
 		ssize_t total_size;
 
 		void deinit();
+		bool start(ssize_t position);
+		bool flush();
+		void ack();
+		bool isPassive() const { return port == 0 && !token.empty(); }
+		static gboolean resume_timeout(gpointer data);
+		static void listen_cb(int sock, void* data);
+		static void connected(gpointer data, int source, PurpleInputCondition cond);
 		static void dcc_read(gpointer data, int source, PurpleInputCondition cond);
 	public:
 
-		/** Get a file from a user, and call a method when it is finished. */
-		DCCGet(Nick* from, string filename, uint32_t addr, uint16_t port, ssize_t size, _CallBack* callback);
+		/** Get a file from a user, and call a method when it is finished.
+		 *
+		 * @param from  nick to which the IRC user sends the file
+		 * @param user  the IRC user
+		 * @param addr  address of the request (an integer for IPv4, or an IPv6 address)
+		 * @param port  port of the request, 0 for a passive request
+		 * @param token  token of a passive request
+		 */
+		DCCGet(Nick* from, Nick* user, string filename, string addr, uint16_t port, ssize_t size,
+		       string token, _CallBack* callback);
 		~DCCGet();
 
-		static bool parseDCCSEND(string line, string* filename, uint32_t* addr, uint16_t* port, ssize_t* size);
+		/** The IRC user accepts to resume the transfer.
+		 *
+		 * @return  false if this DCC isn't waiting for this answer.
+		 */
+		bool accept(uint16_t port, ssize_t position, const string& token);
+
+		/** Parse a DCC SEND request.
+		 *
+		 * @param token  set to the token of a passive request, or cleared.
+		 */
+		static bool parseDCCSEND(string line, string* filename, string* addr, uint16_t* port, ssize_t* size, string* token);
+		static bool parseDCCACCEPT(string line, uint16_t* port, ssize_t* position, string* token);
 
 		virtual im::FileTransfert getFileTransfert() const { return im::FileTransfert(); }
 		virtual void updated(bool destroy);
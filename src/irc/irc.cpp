@@ -23,9 +23,12 @@
 #include <fstream>
 #include <fnmatch.h>
 
+#include "core/caca_image.h"
 #include "core/log.h"
+#include "core/latency.h"
 #include "core/util.h"
 #include "core/version.h"
+#include "core/config.h"
 #include "server_poll/poll.h"
 #include "irc/irc.h"
 #include "irc/buddy.h"
@@ -35,44 +38,46 @@
 
 namespace irc {
 
+static ConfigStringHandle motd_path(&conf, "path", "motd");
+
 IRC::command_t IRC::commands[] = {
-	{ MSG_NICK,    &IRC::m_nick,    0, 0, 0 },
-	{ MSG_USER,    &IRC::m_user,    4, 0, 0 },
-	{ MSG_PASS,    &IRC::m_pass,    1, 0, 0 },
-	{ MSG_QUIT,    &IRC::m_quit,    0, 0, 0 },
-	{ MSG_CMD,     &IRC::m_cmd,     2, 0, Nick::REGISTERED },
-	{ MSG_PRIVMSG, &IRC::m_privmsg, 2, 0, Nick::REGISTERED },
-	{ MSG_PING,    &IRC::m_ping,    0, 0, Nick::REGISTERED },
-	{ MSG_PONG,    &IRC::m_pong,    1, 0, Nick::REGISTERED },
-	{ MSG_VERSION, &IRC::m_version, 0, 0, Nick::REGISTERED },
-	{ MSG_INFO,    &IRC::m_info,    0, 0, Nick::REGISTERED },
-	{ MSG_WHO,     &IRC::m_who,     0, 0, Nick::REGISTERED },
-	{ MSG_WHOIS,   &IRC::m_whois,   1, 0, Nick::REGISTERED },
-	{ MSG_WHOWAS,  &IRC::m_whowas,  1, 0, Nick::REGISTERED },
-	{ MSG_STATS,   &IRC::m_stats,   0, 0, Nick::REGISTERED },
-	{ MSG_CONNECT, &IRC::m_connect, 1, 0, Nick::REGISTERED },
-	{ MSG_SCONNECT,&IRC::m_connect, 1, 0, Nick::REGISTERED },
-	{ MSG_SQUIT,   &IRC::m_squit,   1, 0, Nick::REGISTERED },
-	{ MSG_MAP,     &IRC::m_map,     0, 0, Nick::REGISTERED },
-	{ MSG_ADMIN,   &IRC::m_admin,   0, 0, Nick::REGISTERED },
-	{ MSG_JOIN,    &IRC::m_join,    1, 0, Nick::REGISTERED },
-	{ MSG_PART,    &IRC::m_part,    1, 0, Nick::REGISTERED },
-	{ MSG_NAMES,   &IRC::m_names,   1, 0, Nick::REGISTERED },
-	{ MSG_TOPIC,   &IRC::m_topic,   1, 0, Nick::REGISTERED },
-	{ MSG_LIST,    &IRC::m_list,    0, 0, Nick::REGISTERED },
-	{ MSG_MODE,    &IRC::m_mode,    1, 0, Nick::REGISTERED },
-	{ MSG_ISON,    &IRC::m_ison,    1, 0, Nick::REGISTERED },
-	{ MSG_INVITE,  &IRC::m_invite,  2, 0, Nick::REGISTERED },
-	{ MSG_KICK,    &IRC::m_kick,    2, 0, Nick::REGISTERED },
-	{ MSG_KILL,    &IRC::m_kill,    1, 0, Nick::REGISTERED },
-	{ MSG_SVSNICK, &IRC::m_svsnick, 2, 0, Nick::REGISTERED },
-	{ MSG_AWAY,    &IRC::m_away,    0, 0, Nick::REGISTERED },
-	{ MSG_MOTD,    &IRC::m_motd,    0, 0, Nick::REGISTERED },
-	{ MSG_OPER,    &IRC::m_oper,    2, 0, Nick::REGISTERED },
-	{ MSG_WALLOPS, &IRC::m_wallops, 1, 0, Nick::OPER },
-	{ MSG_REHASH,  &IRC::m_rehash,  0, 0, Nick::OPER },
-	{ MSG_DIE,     &IRC::m_die,     1, 0, Nick::OPER },
-	{ NULL,        NULL,            0, 0, 0 },
+	{ MSG_NICK,    &IRC::m_nick,    0, 0, 0, NULL },
+	{ MSG_USER,    &IRC::m_user,    4, 0, 0, NULL },
+	{ MSG_PASS,    &IRC::m_pass,    1, 0, 0, NULL },
+	{ MSG_QUIT,    &IRC::m_quit,    0, 0, 0, NULL },
+	{ MSG_CMD,     &IRC::m_cmd,     2, 0, Nick::REGISTERED, NULL },
+	{ MSG_PRIVMSG, &IRC::m_privmsg, 2, 0, Nick::REGISTERED, NULL },
+	{ MSG_PING,    &IRC::m_ping,    0, 0, Nick::REGISTERED, NULL },
+	{ MSG_PONG,    &IRC::m_pong,    1, 0, Nick::REGISTERED, NULL },
+	{ MSG_VERSION, &IRC::m_version, 0, 0, Nick::REGISTERED, NULL },
+	{ MSG_INFO,    &IRC::m_info,    0, 0, Nick::REGISTERED, NULL },
+	{ MSG_WHO,     &IRC::m_who,     0, 0, Nick::REGISTERED, NULL },
+	{ MSG_WHOIS,   &IRC::m_whois,   1, 0, Nick::REGISTERED, NULL },
+	{ MSG_WHOWAS,  &IRC::m_whowas,  1, 0, Nick::REGISTERED, NULL },
+	{ MSG_STATS,   &IRC::m_stats,   0, 0, Nick::REGISTERED, NULL },
+	{ MSG_CONNECT, &IRC::m_connect, 1, 0, Nick::REGISTERED, NULL },
+	{ MSG_SCONNECT,&IRC::m_connect, 1, 0, Nick::REGISTERED, NULL },
+	{ MSG_SQUIT,   &IRC::m_squit,   1, 0, Nick::REGISTERED, NULL },
+	{ MSG_MAP,     &IRC::m_map,     0, 0, Nick::REGISTERED, NULL },
+	{ MSG_ADMIN,   &IRC::m_admin,   0, 0, Nick::REGISTERED, NULL },
+	{ MSG_JOIN,    &IRC::m_join,    1, 0, Nick::REGISTERED, NULL },
+	{ MSG_PART,    &IRC::m_part,    1, 0, Nick::REGISTERED, NULL },
+	{ MSG_NAMES,   &IRC::m_names,   1, 0, Nick::REGISTERED, NULL },
+	{ MSG_TOPIC,   &IRC::m_topic,   1, 0, Nick::REGISTERED, NULL },
+	{ MSG_LIST,    &IRC::m_list,    0, 0, Nick::REGISTERED, NULL },
+	{ MSG_MODE,    &IRC::m_mode,    1, 0, Nick::REGISTERED, NULL },
+	{ MSG_ISON,    &IRC::m_ison,    1, 0, Nick::REGISTERED, NULL },
+	{ MSG_INVITE,  &IRC::m_invite,  2, 0, Nick::REGISTERED, NULL },
+	{ MSG_KICK,    &IRC::m_kick,    2, 0, Nick::REGISTERED, NULL },
+	{ MSG_KILL,    &IRC::m_kill,    1, 0, Nick::REGISTERED, NULL },
+	{ MSG_SVSNICK, &IRC::m_svsnick, 2, 0, Nick::REGISTERED, NULL },
+	{ MSG_AWAY,    &IRC::m_away,    0, 0, Nick::REGISTERED, NULL },
+	{ MSG_MOTD,    &IRC::m_motd,    0, 0, Nick::REGISTERED, NULL },
+	{ MSG_OPER,    &IRC::m_oper,    2, 0, Nick::REGISTERED, NULL },
+	{ MSG_WALLOPS, &IRC::m_wallops, 1, 0, Nick::OPER, NULL },
+	{ MSG_REHASH,  &IRC::m_rehash,  0, 0, Nick::OPER, NULL },
+	{ MSG_DIE,     &IRC::m_die,     1, 0, Nick::OPER, NULL },
+	{ NULL,        NULL,            0, 0, 0, NULL },
 };
 
 IRC::IRC(ServerPoll* _poll, sock::SockWrapper* _sockw, string _hostname, unsigned _ping_freq)
@@ -83,7 +88,10 @@ IRC::IRC(ServerPoll* _poll, sock::SockWrapper* _sockw, string _hostname, unsigne
 	  ping_id(-1),
 	  ping_freq(_ping_freq),
 	  uptime(time(NULL)),
+	  received(0),
 	  ping_cb(NULL),
+	  latency_dump_id(-1),
+	  latency_dump_cb(NULL),
 	  user(NULL),
 	  im(NULL),
 	  im_auth(NULL)
@@ -115,6 +123,13 @@ IRC::IRC(ServerPoll* _poll, sock::SockWrapper* _sockw, string _hostname, unsigne
 		ping_id = g_timeout_add((int)ping_freq * 1000, g_callback, ping_cb);
 	}
 
+	int dump_freq = conf.GetSection("logging")->GetItem("latency_dump")->Integer();
+	if(dump_freq > 0)
+	{
+		latency_dump_cb = new CallBack<IRC>(this, &IRC::latency_dump);
+		latency_dump_id = g_timeout_add(dump_freq * 1000, g_callback, latency_dump_cb);
+	}
+
 	rehash(false);
 
 	user->send(Message(MSG_NOTICE).setSender(this).setReceiver("AUTH").addArg("Minbif-IRCd initialized, please go on"));
@@ -122,6 +137,10 @@ IRC::IRC(ServerPoll* _poll, sock::SockWrapper* _sockw, string _hostname, unsigne
 
 IRC::~IRC()
 {
+	/* Their callbacks would be called on a deleted instance. */
+	for(vector<CacaRender*>::iterator it = renders.begin(); it != renders.end(); ++it)
+		CacaImage::cancel(*it);
+
 	delete im;
 	if (im_auth)
 		delete im_auth;
@@ -129,6 +148,9 @@ IRC::~IRC()
 	if(ping_id >= 0)
 		g_source_remove(ping_id);
 	delete ping_cb;
+	if(latency_dump_id >= 0)
+		g_source_remove(latency_dump_id);
+	delete latency_dump_cb;
 	if(sockw)
 		delete sockw;
 	delete read_cb;
@@ -145,14 +167,36 @@ DCC* IRC::createDCCSend(const im::FileTransfert& ft, Nick* n)
 	return dcc;
 }
 
-DCC* IRC::createDCCGet(Nick* from, string filename, uint32_t addr,
-		       uint16_t port, ssize_t size, _CallBack* callback)
+DCC* IRC::createDCCGet(Nick* from, string filename, string addr,
+		       uint16_t port, ssize_t size, string token, _CallBack* callback)
 {
-	DCC* dcc = new DCCGet(from, filename, addr, port, size, callback);
+	DCC* dcc = new DCCGet(from, user, filename, addr, port, size, token, callback);
 	dccs.push_back(dcc);
 	return dcc;
 }
 
+bool IRC::acceptDCCResume(Nick* from, uint16_t port, ssize_t position, const string& token)
+{
+	for(vector<DCC*>::iterator it = dccs.begin(); it != dccs.end(); ++it)
+	{
+		DCCGet* dcc = dynamic_cast<DCCGet*>(*it);
+		if(dcc && !dcc->isFinished() && dcc->getPeer() == from && dcc->accept(port, position, token))
+			return true;
+	}
+	return false;
+}
+
+bool IRC::connectDCCPassive(Nick* from, const string& token, const string& addr, uint16_t port)
+{
+	for(vector<DCC*>::iterator it = dccs.begin(); it != dccs.end(); ++it)
+	{
+		DCCServer* dcc = dynamic_cast<DCCServer*>(*it);
+		if(dcc && dcc->getPeer() == from && dcc->connectPassive(token, addr, port))
+			return true;
+	}
+	return false;
+}
+
 void IRC::updateDCC(const im::FileTransfert& ft, bool destroy)
 {
 	for(vector<DCC*>::iterator it = dccs.begin(); it != dccs.end();)
@@ -379,7 +423,7 @@ void IRC::cleanUpServers()
 
 void IRC::rehash(bool verbose)
 {
-	setMotd(conf.GetSection("path")->GetItem("motd")->String());
+	setMotd(motd_path.Value());
 	if(verbose)
 		b_log[W_INFO|W_SNO] << "Server configuration rehashed.";
 }
@@ -484,6 +528,12 @@ void IRC::sendWelcome()
 	}
 }
 
+bool IRC::latency_dump(void*)
+{
+	Latency::dump(user->getNickname() + ": ");
+	return true;
+}
+
 bool IRC::ping(void*)
 {
 	if(user->getLastRead() + ping_freq > time(NULL))
@@ -504,8 +554,9 @@ bool IRC::ping(void*)
 
 void IRC::notice(Nick* nick, string msg)
 {
+	StringTokenizer tok(msg, "\n\r");
 	string tmp;
-	while((tmp = stringtok(msg, "\n\r")).empty() == false)
+	while(tok.next(tmp))
 		nick->send(Message(MSG_NOTICE).setSender(this)
 					      .setReceiver(user)
 					      .addArg(tmp));
@@ -513,8 +564,9 @@ void IRC::notice(Nick* nick, string msg)
 
 void IRC::privmsg(Nick* nick, string msg)
 {
+	StringTokenizer tok(msg, "\n\r");
 	string tmp;
-	while((tmp = stringtok(msg, "\n\r")).empty() == false)
+	while(tok.next(tmp))
 		nick->send(Message(MSG_PRIVMSG).setSender(this)
 					       .setReceiver(user)
 					       .addArg(tmp));
@@ -528,10 +580,12 @@ bool IRC::readIO(void*)
 
 		sbuf = sockw->Read();
 
-		while((line = stringtok(sbuf, "\r\n")).empty() == false)
+		StringTokenizer tok(sbuf, "\r\n");
+		while(tok.next(line))
 		{
 			Message m = Message::parse(line);
 			b_log[W_PARSE] << "<< " << line;
+			received++;
 			size_t i;
 			for(i = 0;
 			    commands[i].cmd != NULL && strcmp(commands[i].cmd, m.getCommand().c_str());
@@ -564,6 +618,10 @@ bool IRC::readIO(void*)
 			else
 			{
 				commands[i].count++;
+				if(!commands[i].latency)
+					commands[i].latency = &Latency::get(string("irc.") + commands[i].cmd);
+
+				LatencyTimer timer(*commands[i].latency);
 				(this->*commands[i].func)(m);
 			}
 		}
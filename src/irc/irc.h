@@ -31,7 +31,9 @@
 #include "core/exception.h"
 
 class _CallBack;
+struct CacaRender;
 class ServerPoll;
+class Histogram;
 
 namespace im
 {
@@ -70,7 +72,10 @@ namespace irc
 		int ping_id;
 		time_t ping_freq;
 		time_t uptime;
+		unsigned long received;
 		_CallBack *ping_cb;
+		int latency_dump_id;
+		_CallBack *latency_dump_cb;
 		User* user;
 		im::IM* im;
 		im::Auth *im_auth;
@@ -79,6 +84,7 @@ namespace irc
 		map<string, Server*> servers;
 		vector<DCC*> dccs;
 		vector<string> motd;
+		vector<CacaRender*> renders;   /**< pending renders of WHOIS icons */
 
 		struct command_t
 		{
@@ -87,6 +93,7 @@ namespace irc
 			size_t minargs;
 			unsigned count;
 			unsigned flags;
+			Histogram* latency;     /**< set at first call */
 		};
 		static command_t commands[];
 
@@ -101,6 +108,9 @@ namespace irc
 
 		bool check_channel_join(void*);
 
+		/** Callback when the icon of a WHOIS reply is rendered. */
+		bool whois_icon_rendered(void*);
+
 		void m_nick(Message m);     /**< Handler for the NICK message */
 		void m_user(Message m);     /**< Handler for the USER message */
 		void m_pass(Message m);     /**< Handler for the PASS message */
@@ -162,6 +172,11 @@ namespace irc
 		im::IM* getIM() const { return im; }
 		im::Auth* getIMAuth() const { return im_auth; }
 
+		/** Number of messages received from user. */
+		unsigned long getReceivedCount() const { return received; }
+		size_t countNicks() const { return users.size(); }
+		size_t countChannels() const { return channels.size(); }
+
 		/** Ends the auth sequence.
 		 *
 		 * It checks if user has sent all requested parameters to
@@ -200,13 +215,28 @@ namespace irc
 		void removeServer(string server);
 
 		DCC* createDCCSend(const im::FileTransfert& ft, Nick* from);
-		DCC* createDCCGet(Nick* from, string filename, uint32_t addr,
-				  uint16_t port, ssize_t size, _CallBack* callback);
+		DCC* createDCCGet(Nick* from, string filename, string addr,
+				  uint16_t port, ssize_t size, string token, _CallBack* callback);
 		void updateDCC(const im::FileTransfert& ft, bool destroy = false);
 
+		/** The IRC user accepted to resume a file sent to a nick.
+		 *
+		 * @return  false if there isn't any such DCC waiting for this answer.
+		 */
+		bool acceptDCCResume(Nick* from, uint16_t port, ssize_t position, const string& token);
+
+		/** The IRC user answered to a passive DCC request sent by a nick.
+		 *
+		 * @return  false if there isn't any DCC with this token.
+		 */
+		bool connectDCCPassive(Nick* from, const string& token, const string& addr, uint16_t port);
+
 		/** Callback used by glibc to check user ping */
 		bool ping(void*);
 
+		/** Periodically log the latency histograms. */
+		bool latency_dump(void*);
+
 		/** Send a notice to a user.
 		 *
 		 * @param user  destination
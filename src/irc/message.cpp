@@ -130,17 +130,19 @@ string Message::getArg(size_t n) const
 	return args[n];
 }
 
-Message Message::parse(string line)
+Message Message::parse(const string& line)
 {
+	StringTokenizer tok(line, " ");
 	string s;
 	Message m;
-	while((s = stringtok(line, " ")).empty() == false)
+	while(tok.next(s))
 	{
 		if(m.getCommand().empty())
 			m.setCommand(strupper(s));
 		else if(s[0] == ':')
 		{
-			m.addArg(s.substr(1) + (line.empty() ? "" : " " + line));
+			string rest = tok.rest();
+			m.addArg(s.substr(1) + (rest.empty() ? "" : " " + rest));
 			break;
 		}
 		else
@@ -79,7 +79,7 @@ namespace irc
 
 		string format() const;
 		void rebuildWithQuotes();
-		static Message parse(string s);
+		static Message parse(const string& line);
 	};
 }; /* namespace irc */
 #endif /* IRC_MESSAGE_H */
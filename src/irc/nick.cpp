@@ -18,6 +18,7 @@
 #include <cstring>
 #include <cassert>
 #include <algorithm>
+#include <list>
 
 #include "irc/nick.h"
 #include "irc/server.h"
@@ -31,6 +32,56 @@ const char *Nick::nick_lc_chars = "0123456789abcdefghijklmnopqrstuvwxyz{}^`-_|";
 const char *Nick::nick_uc_chars = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ[]~`-_\\";
 const char *Nick::UMODES = "o";
 
+/** Lookup table of chars allowed in nicknames. */
+static struct NickChars
+{
+	bool allowed[256];
+
+	NickChars()
+	{
+		memset(allowed, 0, sizeof allowed);
+		for(const char* c = Nick::nick_lc_chars; *c; ++c)
+			allowed[(unsigned char)*c] = true;
+		for(const char* c = Nick::nick_uc_chars; *c; ++c)
+			allowed[(unsigned char)*c] = true;
+	}
+
+	bool operator()(char c) const { return allowed[(unsigned char)c]; }
+} is_nick_char;
+
+/** LRU cache of the Nick::nickize() results. */
+static struct NickizeCache
+{
+	static const size_t MAX_SIZE = 1024;
+
+	typedef std::list<std::pair<string, string> > entries_t;
+	entries_t entries;
+	map<string, entries_t::iterator> index;
+
+	bool get(const string& key, string& value)
+	{
+		map<string, entries_t::iterator>::iterator it = index.find(key);
+		if(it == index.end())
+			return false;
+
+		/* Move entry at the front of the list. */
+		entries.splice(entries.begin(), entries, it->second);
+		value = it->second->second;
+		return true;
+	}
+
+	void put(const string& key, const string& value)
+	{
+		entries.push_front(std::make_pair(key, value));
+		index[key] = entries.begin();
+		if(entries.size() > MAX_SIZE)
+		{
+			index.erase(entries.back().first);
+			entries.pop_back();
+		}
+	}
+} nickize_cache;
+
 Nick::Nick(Server* _server, string nickname, string _identname, string _hostname, string _realname)
 	: Entity(nickname),
 	  server(_server),
@@ -54,7 +105,7 @@ bool Nick::isValidNickname(const string& nick)
 		return false;
 
 	for(string::const_iterator i = nick.begin(); i != nick.end(); ++i)
-		if(!strchr(Nick::nick_lc_chars, *i) && !strchr(Nick::nick_uc_chars, *i))
+		if(!is_nick_char(*i))
 			return false;
 
 	return true;
@@ -63,19 +114,28 @@ bool Nick::isValidNickname(const string& nick)
 
 string Nick::nickize(const string& n)
 {
+	/* The converter is opened once and kept for the whole process. */
+	static GIConv ic = g_iconv_open("ASCII//TRANSLIT", "UTF-8");
 	string nick;
 
+	if(nickize_cache.get(n, nick))
+		return nick;
+
 	/* Transliterate string. */
-	GIConv ic = g_iconv_open("ASCII//TRANSLIT", "UTF-8");
-	gchar* conv = g_convert_with_iconv(n.c_str(), n.size(), ic, NULL, NULL, NULL);
+	gchar* conv = NULL;
+	if(ic != (GIConv)-1)
+	{
+		/* Reset the conversion state. */
+		g_iconv(ic, NULL, NULL, NULL, NULL);
+		conv = g_convert_with_iconv(n.c_str(), n.size(), ic, NULL, NULL, NULL);
+	}
 
 	for(const char* c = conv ? conv : n.c_str(); *c; ++c)
 		if (*c == ' ')
-			nick += "_";
-		else if (strchr(nick_lc_chars, *c) || strchr(nick_uc_chars, *c))
+			nick += '_';
+		else if (is_nick_char(*c))
 			nick += *c;
 
-	g_iconv_close(ic);
 	g_free(conv);
 
 	if(isdigit(nick[0]))
@@ -88,6 +148,7 @@ string Nick::nickize(const string& n)
 	if (nick.empty())
 		nick = "Invalid";
 
+	nickize_cache.put(n, nick);
 	return nick;
 }
 
@@ -232,8 +293,9 @@ void Nick::quit(string text)
 
 void Nick::privmsg(Channel* chan, string msg)
 {
+	StringTokenizer tok(msg, "\n\r");
 	string tmp;
-	while((tmp = stringtok(msg, "\n\r")).empty() == false)
+	while(tok.next(tmp))
 		chan->broadcast(Message(MSG_PRIVMSG).setSender(this)
 						    .setReceiver(chan)
 						    .addArg(tmp),
@@ -242,8 +304,9 @@ void Nick::privmsg(Channel* chan, string msg)
 
 void Nick::privmsg(Nick* nick, string msg)
 {
+	StringTokenizer tok(msg, "\n\r");
 	string tmp;
-	while((tmp = stringtok(msg, "\n\r")).empty() == false)
+	while(tok.next(tmp))
 		nick->send(Message(MSG_PRIVMSG).setSender(this)
 					       .setReceiver(nick)
 					       .addArg(tmp));
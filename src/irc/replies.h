@@ -31,6 +31,7 @@
 #define RPL_UMODEIS          "221"
 #define RPL_STATSUPTIME      "242"
 #define RPL_STATSOLINE       "243"
+#define RPL_STATSDEBUG       "249"
 #define RPL_LUSERCLIENT      "251"
 #define RPL_LUSEROP          "252"
 #define RPL_LUSERUNKNOWN     "253"
@@ -18,6 +18,7 @@
 
 #include "settings.h"
 #include "im/im.h"
+#include "im/password_hash.h"
 #include "irc.h"
 #include "user.h"
 #include "core/util.h"
@@ -33,6 +34,8 @@ SettingBase::SettingBase(IRC* _irc, im::IM* _im)
 
 string SettingPassword::getValue() const
 {
+	if (im::PasswordHash::isHashed(getIM()->getPassword()))
+		return "(stored hashed)";
 	return getIRC()->getIMAuth()->getPassword();
 }
 
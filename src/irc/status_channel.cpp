@@ -112,12 +112,16 @@ void StatusChannel::processBan(Nick* from, string pattern, bool add)
 	else
 	{
 		im::Account acc;
-		string accid = pattern;
-		pattern = stringtok(accid, ":");
+		string mask = pattern;
+		StringTokenizer tok(mask, ":");
+		pattern = tok.next();
+		string accid = tok.rest();
 		if (accid.empty())
 		{
-			accid = pattern;
-			pattern = stringtok(accid, "@");
+			mask = pattern;
+			StringTokenizer tok_at(mask, "@");
+			pattern = tok_at.next();
+			accid = tok_at.rest();
 		}
 
 		vector<im::Account>::iterator it;
@@ -137,8 +141,9 @@ void StatusChannel::processBan(Nick* from, string pattern, bool add)
 			return;
 		}
 
-		if (pattern.find('!') != string::npos)
-			stringtok(pattern, "!");
+		string::size_type bang = pattern.find('!');
+		if (bang != string::npos)
+			pattern.erase(0, bang + 1);
 
 		if ((acc.*func)(pattern))
 			broadcast(Message(MSG_MODE).setSender(from)
@@ -151,8 +156,9 @@ void StatusChannel::processBan(Nick* from, string pattern, bool add)
 
 bool StatusChannel::invite(Nick* from, const string& nickname, const string& message)
 {
-	string acc = nickname;
-	string username = stringtok(acc, ":");
+	StringTokenizer tok(nickname, ":");
+	string username = tok.next();
+	string acc = tok.rest();
 	im::Account account;
 	if(acc.empty())
 		account = irc->getIM()->getAccountFromChannel(getName());
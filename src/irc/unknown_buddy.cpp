@@ -28,9 +28,11 @@ namespace irc {
 UnknownBuddy::UnknownBuddy(Server* server, im::Conversation& conv)
 	: ConvNick(server, conv, "","","","")
 {
-	string hostname = conv.getName();
-	string identname = stringtok(hostname, "@");
-	string nickname = conv.getName();
+	string name = conv.getName();
+	StringTokenizer tok(name, "@");
+	string identname = tok.next();
+	string hostname = tok.rest();
+	string nickname = name;
 	if(nickname.find('@') != string::npos || nickname.find(' ') != string::npos)
 		nickname = nickize(identname);
 	else
@@ -24,7 +24,8 @@ namespace irc {
 
 User::User(sock::SockWrapper* _sockw, Server* server, string nickname, string identname, string hostname, string realname)
 	: Nick(server, nickname, identname, hostname, realname),
-	  sockw(_sockw)
+	  sockw(_sockw),
+	  sent(0)
 {
 }
 
@@ -35,7 +36,10 @@ User::~User()
 void User::send(Message msg)
 {
 	if (sockw)
+	{
 		sockw->Write(msg.format());
+		sent++;
+	}
 }
 
 void User::setLastReadNow()
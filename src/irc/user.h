@@ -30,6 +30,7 @@ namespace irc
 		sock::SockWrapper* sockw;
 		string password;
 		time_t last_read;
+		unsigned long sent;
 
 	public:
 
@@ -61,6 +62,9 @@ namespace irc
 		/** Send a message to file descriptor */
 		virtual void send(Message m);
 
+		/** Number of messages sent to user. */
+		unsigned long getSentCount() const { return sent; }
+
 	};
 
 }; /* namespace irc */
@@ -17,31 +17,67 @@
  */
 
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
 #include <cassert>
 #include <cstring>
+#include <cstdlib>
 #include <cerrno>
 #include <glib.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <sys/select.h>
+#include <sys/resource.h>
 #include <arpa/inet.h>
+#include <netdb.h>
 
 #include "daemon_fork.h"
 #include "irc/irc.h"
 #include "irc/user.h"
 #include "irc/message.h"
 #include "irc/replies.h"
+#include "im/im.h"
 #include "core/callback.h"
+#include "core/latency.h"
 #include "core/log.h"
+#include "core/metrics.h"
 #include "core/minbif.h"
 #include "core/util.h"
+#include "core/watchdog.h"
 #include "sockwrap/sock.h"
 #include "sockwrap/sockwrap.h"
 
+/** Environment variable giving inherited fds to the new binary.
+ *
+ * It is a list of "L<fd>" for listening sockets, and of
+ * "C<fd>:<pid>:<username>" for IPC channels to children.
+ */
+static const char UPGRADE_ENV[] = "MINBIF_UPGRADE";
+
 DaemonForkServerPoll::DaemonForkServerPoll(Minbif* application, ConfigSection* config)
 	: ServerPoll(application, config),
 	  irc(NULL),
-	  sock(-1),
-	  read_cb(NULL)
+	  ratelimit(0),
+	  master(NULL),
+	  master_read_id(-1),
+	  master_read_cb(NULL),
+	  stats_id(-1),
+	  stats_cb(NULL),
+	  last_stats(0),
+	  last_received(0),
+	  last_sent(0),
+	  stats_sock(-1),
+	  stats_read_id(-1),
+	  stats_read_cb(NULL),
+	  metrics_sock(-1),
+	  metrics_read_id(-1),
+	  metrics_read_cb(NULL),
+	  upgrade_id(-1),
+	  upgrade_cb(NULL),
+	  upgrade_tries(0)
 {
 	ConfigSection* section = getConfig();
 	if(section->Found() == false)
@@ -51,8 +87,16 @@ DaemonForkServerPoll::DaemonForkServerPoll(Minbif* application, ConfigSection* c
 	}
 
 	maxcon = section->GetItem("maxcon")->Integer();
+	ratelimit = section->GetItem("ratelimit")->Integer();
 
-	if(section->GetItem("background")->Boolean())
+	/* When upgrading, this process is already daemonized. */
+	const char* inherited = getenv(UPGRADE_ENV);
+	if(inherited)
+	{
+		adopt(inherited);
+		unsetenv(UPGRADE_ENV);
+	}
+	else if(section->GetItem("background")->Boolean())
 	{
 		int r = fork();
 		if(r < 0)
@@ -83,91 +127,337 @@ DaemonForkServerPoll::DaemonForkServerPoll(Minbif* application, ConfigSection* c
 		}
 	}
 
-	struct addrinfo *addrinfo_bind, *res, hints;
-	string bind_addr = section->GetItem("bind")->String();
+	if(!inherited)
+		listen_all(section);
+	if(listeners.empty())
+		throw ServerPollError();
+
+	stats_path = section->GetItem("stats_socket")->String();
+	if(stats_path != " ")
+	{
+		struct sockaddr_un addr;
+
+		memset(&addr, 0, sizeof addr);
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, stats_path.c_str(), sizeof addr.sun_path - 1);
+		unlink(stats_path.c_str());
+
+		if((stats_sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+		   bind(stats_sock, (struct sockaddr*)&addr, sizeof addr) < 0 ||
+		   listen(stats_sock, 5) < 0)
+		{
+			b_log[W_ERR] << "Unable to listen on " << stats_path << ": " << strerror(errno);
+			stats_close();
+		}
+		else
+		{
+			chmod(stats_path.c_str(), 0600);
+			fcntl(stats_sock, F_SETFD, FD_CLOEXEC);
+			stats_read_cb = new CallBack<DaemonForkServerPoll>(this, &DaemonForkServerPoll::stats_accept_cb);
+			stats_read_id = glib_input_add(stats_sock, (PurpleInputCondition)PURPLE_INPUT_READ,
+						       g_callback_input, stats_read_cb);
+		}
+	}
+
+	metrics_listen(section);
+}
+
+DaemonForkServerPoll::~DaemonForkServerPoll()
+{
+	close_listeners();
+
+	if(upgrade_id >= 0)
+		g_source_remove(upgrade_id);
+	delete upgrade_cb;
+
+	delete irc;
+
+	if(stats_id >= 0)
+		g_source_remove(stats_id);
+	delete stats_cb;
+	stats_close();
+	if(!stats_path.empty() && stats_path != " ")
+		unlink(stats_path.c_str());
+	metrics_close();
+
+	if(master_read_id >= 0)
+		g_source_remove(master_read_id);
+	delete master_read_cb;
+	delete master;
+
+	for(vector<child_t*>::iterator it = childs.begin(); it != childs.end(); ++it)
+	{
+		g_source_remove((*it)->read_id);
+		delete (*it)->read_cb;
+		delete (*it)->ipc;
+		delete *it;
+	}
+}
+
+void DaemonForkServerPoll::listen_all(ConfigSection* section)
+{
+	string bind_list = section->GetItem("bind")->String();
 	uint16_t port = (uint16_t)section->GetItem("port")->Integer();
+	int backlog = section->GetItem("backlog")->Integer();
+	bool reuse_port = section->GetItem("reuseport")->Boolean();
 	unsigned int reuse_addr = 1, ipv6_only = 0;
+	StringTokenizer tok(bind_list, " ,");
+	string bind_addr;
 
-	memset(&hints, 0, sizeof(hints));
-	hints.ai_family = PF_UNSPEC;
-	hints.ai_socktype = SOCK_STREAM;
-	hints.ai_flags = AI_PASSIVE;
+	while(tok.next(bind_addr))
+	{
+		struct addrinfo *addrinfo_bind, *res, hints;
+		int sock = -1;
+
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = PF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = AI_PASSIVE;
+
+		if(getaddrinfo(bind_addr.c_str(), t2s(port).c_str(), &hints, &addrinfo_bind))
+		{
+			b_log[W_ERR] << "Could not parse address " << bind_addr << ":" << port;
+			continue;
+		}
+
+		for(res = addrinfo_bind; res && sock < 0; res = res->ai_next)
+		{
+			sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+			if(sock < 0)
+				continue;
+
+			setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse_addr, sizeof reuse_addr);
+#ifdef SO_REUSEPORT
+			if(reuse_port)
+				setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &reuse_addr, sizeof reuse_addr);
+#endif
+			if(res->ai_family == AF_INET6)
+				setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &ipv6_only, sizeof ipv6_only);
+
+			/* Every pending connections are accepted at once, until EAGAIN. */
+			sock_make_nonblocking(sock);
+			fcntl(sock, F_SETFD, FD_CLOEXEC);
+
+			if(bind(sock, res->ai_addr, res->ai_addrlen) < 0 ||
+			   listen(sock, backlog) < 0)
+			{
+				close(sock);
+				sock = -1;
+			}
+		}
+		freeaddrinfo(addrinfo_bind);
 
-	if(getaddrinfo(bind_addr.c_str(), t2s(port).c_str(), &hints, &addrinfo_bind))
+		if(sock < 0)
+		{
+			b_log[W_ERR] << "Unable to listen on " << bind_addr << ":" << port
+				     << ": " << strerror(errno);
+			continue;
+		}
+
+		listener_t* listener = new listener_t();
+		listener->sock = sock;
+		listener->addr = bind_addr;
+		listener->read_cb = new CallBack<DaemonForkServerPoll>(this, &DaemonForkServerPoll::new_client_cb, listener);
+		listener->read_id = glib_input_add(sock, (PurpleInputCondition)PURPLE_INPUT_READ,
+						   g_callback_input, listener->read_cb);
+		listeners.push_back(listener);
+	}
+}
+
+void DaemonForkServerPoll::close_listeners()
+{
+	for(vector<listener_t*>::iterator it = listeners.begin(); it != listeners.end(); it = listeners.erase(it))
 	{
-		b_log[W_ERR] << "Could not parse address " << bind_addr << ":" << port;
-		throw ServerPollError();
+		listener_t* listener = *it;
+		g_source_remove(listener->read_id);
+		delete listener->read_cb;
+		close(listener->sock);
+		delete listener;
 	}
+}
 
-	for(res = addrinfo_bind; res && sock < 0; res = res->ai_next)
+void DaemonForkServerPoll::adopt(string inherited)
+{
+	StringTokenizer tok(inherited, " ");
+	string token;
+
+	while(tok.next(token))
 	{
-		sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
-		if(sock < 0)
+		int fd = atoi(token.c_str() + 1);
+		if(fd <= 2)
 			continue;
 
-		setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse_addr, sizeof reuse_addr);
-		setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &ipv6_only, sizeof ipv6_only);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
 
-		if(bind(sock, res->ai_addr, res->ai_addrlen) < 0 ||
-		   listen(sock, 5) < 0)
+		if(token[0] == 'L')
 		{
-			close(sock);
-			sock = -1;
+			listener_t* listener = new listener_t();
+			listener->sock = fd;
+			listener->read_cb = new CallBack<DaemonForkServerPoll>(this, &DaemonForkServerPoll::new_client_cb, listener);
+			listener->read_id = glib_input_add(fd, (PurpleInputCondition)PURPLE_INPUT_READ,
+							   g_callback_input, listener->read_cb);
+			listeners.push_back(listener);
+		}
+		else if(token[0] == 'C')
+		{
+			child_t* child = new child_t();
+			size_t p1 = token.find(':');
+			size_t p2 = token.find(':', p1 == string::npos ? p1 : p1 + 1);
+			if(p1 != string::npos)
+				child->pid = atoi(token.c_str() + p1 + 1);
+			if(p2 != string::npos)
+				child->username = token.substr(p2 + 1);
+			child->ipc = new IPCChannel(fd);
+			child->read_cb = new CallBack<DaemonForkServerPoll>(this, &DaemonForkServerPoll::ipc_read, child);
+			child->read_id = glib_input_add(fd, (PurpleInputCondition)PURPLE_INPUT_READ,
+						       g_callback_input, child->read_cb);
+			childs.push_back(child);
 		}
 	}
 
-	if(sock < 0)
-		b_log[W_ERR] << "Unable to listen on " << bind_addr << ":" << port
-			     << ": " << strerror(errno);
-	else
+	b_log[W_INFO] << "Upgraded, with " << listeners.size() << " listening sockets and "
+		      << childs.size() << " children";
+}
+
+bool DaemonForkServerPoll::upgrade()
+{
+	/* Only master is upgraded, children keep running the old binary. */
+	if(irc || upgrade_id >= 0)
+		return true;
+
+	upgrade_tries = 0;
+	if(upgrade_exec(NULL))
 	{
+		upgrade_cb = new CallBack<DaemonForkServerPoll>(this, &DaemonForkServerPoll::upgrade_exec);
+		upgrade_id = g_timeout_add(UPGRADE_RETRY, g_callback_delete, upgrade_cb);
+	}
+	return true;
+}
 
-		read_cb = new CallBack<DaemonForkServerPoll>(this, &DaemonForkServerPoll::new_client_cb);
-		read_id = glib_input_add(sock, (PurpleInputCondition)PURPLE_INPUT_READ,
-					       g_callback_input, read_cb);
+bool DaemonForkServerPoll::upgrade_exec(void*)
+{
+	/* A frame partially received or sent would be lost with the buffers
+	 * of this process, and the new one would be desynchronized. */
+	bool idle = true;
+	for(vector<child_t*>::iterator it = childs.begin(); it != childs.end() && idle; ++it)
+		idle = (*it)->ipc->isIdle();
+
+	if(!idle && ++upgrade_tries < UPGRADE_MAX_TRIES)
+		return true;
+
+	/* As false is returned, the timer callback is deleted. */
+	upgrade_id = -1;
+	upgrade_cb = NULL;
+
+	if(!idle)
+	{
+		b_log[W_ERR|W_SNO] << "Upgrade aborted: IPC channels are still busy";
+		return false;
 	}
 
-	freeaddrinfo(addrinfo_bind);
-	if(!read_cb)
-		throw ServerPollError();
+	string inherited;
+	for(vector<listener_t*>::iterator it = listeners.begin(); it != listeners.end(); ++it)
+	{
+		fcntl((*it)->sock, F_SETFD, 0);
+		inherited += " L" + t2s((*it)->sock);
+	}
+	for(vector<child_t*>::iterator it = childs.begin(); it != childs.end(); ++it)
+	{
+		fcntl((*it)->ipc->getFD(), F_SETFD, 0);
+		inherited += " C" + t2s((*it)->ipc->getFD()) + ":" + t2s((*it)->pid) + ":" + (*it)->username;
+	}
+	setenv(UPGRADE_ENV, inherited.c_str(), 1);
+
+	b_log[W_INFO|W_SNO] << "Upgrading minbif...";
+	getApplication()->exec();
+
+	/* Still there, so go on with the current binary. */
+	unsetenv(UPGRADE_ENV);
+	for(vector<listener_t*>::iterator it = listeners.begin(); it != listeners.end(); ++it)
+		fcntl((*it)->sock, F_SETFD, FD_CLOEXEC);
+	for(vector<child_t*>::iterator it = childs.begin(); it != childs.end(); ++it)
+		fcntl((*it)->ipc->getFD(), F_SETFD, FD_CLOEXEC);
+	return false;
 }
 
-DaemonForkServerPoll::~DaemonForkServerPoll()
+bool DaemonForkServerPoll::check_rate(const string& host)
 {
-	if(read_id >= 0)
-		g_source_remove(read_id);
-	delete read_cb;
-	if(sock >= 0)
-		close(sock);
+	if(!ratelimit)
+		return true;
 
-	delete irc;
+	time_t now = time(NULL);
 
-	for(vector<child_t*>::iterator it = childs.begin(); it != childs.end(); ++it)
+	/* Forget hosts which didn't connect during the last period. */
+	if(rates.size() > 1024)
 	{
-		close((*it)->fd);
-		delete (*it)->read_cb;
-		g_source_remove((*it)->read_id);
-		delete *it;
+		for(map<string, rate_t>::iterator it = rates.begin(); it != rates.end();)
+			if(now - it->second.start >= (time_t)RATE_PERIOD)
+				rates.erase(it++);
+			else
+				++it;
 	}
+
+	rate_t& rate = rates[host];
+	if(rate.count == 0 || now - rate.start >= (time_t)RATE_PERIOD)
+	{
+		rate.start = now;
+		rate.count = 0;
+	}
+
+	return ++rate.count <= ratelimit;
 }
 
-bool DaemonForkServerPoll::new_client_cb(void*)
+bool DaemonForkServerPoll::new_client_cb(void* data)
 {
-	struct sockaddr_in newcon;
-	socklen_t addrlen = sizeof newcon;
-	int new_socket = accept(sock, (struct sockaddr *) &newcon, &addrlen);
+	listener_t* listener = static_cast<listener_t*>(data);
 
-	if(new_socket < 0)
+	for(;;)
 	{
-		b_log[W_WARNING] << "Could not accept new connection: " << strerror(errno);
-		return true;
+		struct sockaddr_storage newcon;
+		socklen_t addrlen = sizeof newcon;
+#ifdef SOCK_CLOEXEC
+		int new_socket = accept4(listener->sock, (struct sockaddr *) &newcon, &addrlen, SOCK_CLOEXEC);
+#else
+		int new_socket = accept(listener->sock, (struct sockaddr *) &newcon, &addrlen);
+#endif
+
+		if(new_socket < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			if(!sockerr_again())
+				b_log[W_WARNING] << "Could not accept new connection: " << strerror(errno);
+			return true;
+		}
+
+		char host[NI_MAXHOST];
+		if(getnameinfo((struct sockaddr *) &newcon, addrlen, host, sizeof host, NULL, 0, NI_NUMERICHOST))
+			host[0] = 0;
+
+		/* In the child, the listener doesn't exist anymore. */
+		if(!new_client(new_socket, host))
+			return false;
 	}
+}
 
+bool DaemonForkServerPoll::new_client(int new_socket, const string& host)
+{
 	if(maxcon > 0 && childs.size() >= (unsigned)maxcon)
 	{
 		static const char error[] = "ERROR :Closing Link: Too much connections on server\r\n";
 		send(new_socket, error, sizeof(error), 0);
 		close(new_socket);
+		METRIC_INC("minbif_connections_rejected_total{reason=\"maxcon\"}");
+		return true;
+	}
+
+	if(!check_rate(host))
+	{
+		static const char error[] = "ERROR :Closing Link: Too many connections from your host\r\n";
+		b_log[W_WARNING] << "Too many connections from " << host;
+		send(new_socket, error, sizeof(error) - 1, MSG_DONTWAIT);
+		close(new_socket);
+		METRIC_INC("minbif_connections_rejected_total{reason=\"ratelimit\"}");
 		return true;
 	}
 
@@ -189,19 +479,26 @@ bool DaemonForkServerPoll::new_client_cb(void*)
 	{
 		b_log[W_ERR] << "Unable to fork while receiving a new connection: " << strerror(errno);
 		close(new_socket);
+		if(fds[0] >= 0)
+		{
+			close(fds[0]);
+			close(fds[1]);
+		}
 		return true;
 	}
 	else if(client_pid > 0)
 	{
 		/* Parent */
 		b_log[W_INFO] << "Creating new process with pid " << client_pid;
+		METRIC_INC("minbif_connections_total");
 		close(new_socket);
 		if(fds[0] >= 0)
 		{
 			child_t* child = new child_t();
-			child->fd = fds[0];
+			child->pid = client_pid;
+			child->ipc = new IPCChannel(fds[0]);
 			child->read_cb = new CallBack<DaemonForkServerPoll>(this, &DaemonForkServerPoll::ipc_read, child);
-			child->read_id = glib_input_add(child->fd, (PurpleInputCondition)PURPLE_INPUT_READ,
+			child->read_id = glib_input_add(fds[0], (PurpleInputCondition)PURPLE_INPUT_READ,
 						       g_callback_input, child->read_cb);
 			childs.push_back(child);
 			close(fds[1]);
@@ -210,30 +507,37 @@ bool DaemonForkServerPoll::new_client_cb(void*)
 	else
 	{
 		/* Child */
-		close(sock);
-		sock = -1;
-		g_source_remove(read_id);
-		read_id = -1;
-		delete read_cb;
-		read_cb = NULL;
+		close_listeners();
+		rates.clear();
+
+		/* Only master removes it. */
+		stats_close();
+		stats_path.clear();
+		metrics_close();
+		dead_metrics.clear();
+		/* Counters of master would be counted twice, and its
+		 * latencies and stalls aren't the ones of this user. */
+		Metrics::reset();
+		Latency::reset();
+		Watchdog::reset();
 
 		if(fds[1] >= 0)
 		{
-			sock = fds[1];
-			read_cb = new CallBack<DaemonForkServerPoll>(this, &DaemonForkServerPoll::ipc_read);
-			read_id = glib_input_add(sock, (PurpleInputCondition)PURPLE_INPUT_READ,
-						       g_callback_input, read_cb);
+			master = new IPCChannel(fds[1]);
+			master_read_cb = new CallBack<DaemonForkServerPoll>(this, &DaemonForkServerPoll::ipc_read);
+			master_read_id = glib_input_add(fds[1], (PurpleInputCondition)PURPLE_INPUT_READ,
+						       g_callback_input, master_read_cb);
 			close(fds[0]);
+		}
 
-			/* Cleanup all childs accumulated when I was parent. */
-			for(vector<child_t*>::iterator it = childs.begin(); it != childs.end(); it = childs.erase(it))
-			{
-				child_t* child = *it;
-				close(child->fd);
-				delete child->read_cb;
-				g_source_remove(child->read_id);
-				delete child;
-			}
+		/* Cleanup all childs accumulated when I was parent. */
+		for(vector<child_t*>::iterator it = childs.begin(); it != childs.end(); it = childs.erase(it))
+		{
+			child_t* child = *it;
+			g_source_remove(child->read_id);
+			delete child->read_cb;
+			delete child->ipc;
+			delete child;
 		}
 
 		try
@@ -241,29 +545,79 @@ bool DaemonForkServerPoll::new_client_cb(void*)
 			irc = new irc::IRC(this, sock::SockWrapper::Builder(getConfig(), new_socket, new_socket),
 				      conf.GetSection("irc")->GetItem("hostname")->String(),
 				      conf.GetSection("irc")->GetItem("ping")->Integer());
+
+			if(master)
+			{
+				stats_cb = new CallBack<DaemonForkServerPoll>(this, &DaemonForkServerPoll::ipc_push_stats);
+				stats_id = g_timeout_add(STATS_INTERVAL * 1000, g_callback, stats_cb);
+			}
 		}
 		catch(StrException &e)
 		{
 			b_log[W_ERR] << "Unable to start the IRC daemon: " + e.Reason();
 			getApplication()->quit();
 		}
+		return false;
 	}
 	return true;
 }
 
+/** Arguments of a STATS frame. */
+enum
+{
+	ST_USERNAME,
+	ST_PID,
+	ST_RSS,           /**< resident memory, in KiB */
+	ST_CPU,           /**< user and system CPU time, in ms */
+	ST_NICKS,
+	ST_CHANNELS,
+	ST_ACCOUNTS,
+	ST_SENDQ,         /**< bytes not sent yet to IRC user */
+	ST_MSGS_IN,       /**< messages received from IRC user per second */
+	ST_MSGS_OUT,      /**< messages sent to IRC user per second */
+	ST_COUNT
+};
+
+static string format_stats(const IPCMessage& m)
+{
+	std::ostringstream oss;
+	oss << std::left << std::setw(16) << m.getArg(ST_USERNAME) << std::right
+	    << " pid " << std::setw(6) << m.getArg(ST_PID)
+	    << " rss " << std::setw(8) << m.getArg(ST_RSS) << " KiB"
+	    << " cpu " << std::setw(8) << std::fixed << std::setprecision(1) << strtod(m.getArg(ST_CPU).c_str(), NULL) / 1000 << "s"
+	    << " nicks " << std::setw(5) << m.getArg(ST_NICKS)
+	    << " chans " << std::setw(4) << m.getArg(ST_CHANNELS)
+	    << " accs " << std::setw(3) << m.getArg(ST_ACCOUNTS)
+	    << " sendq " << std::setw(7) << m.getArg(ST_SENDQ)
+	    << " in " << std::setw(6) << m.getArg(ST_MSGS_IN) << "/s"
+	    << " out " << std::setw(6) << m.getArg(ST_MSGS_OUT) << "/s";
+	return oss.str();
+}
+
+static string format_rate(double rate)
+{
+	std::ostringstream oss;
+	oss << std::fixed << std::setprecision(1) << rate;
+	return oss.str();
+}
+
 DaemonForkServerPoll::ipc_cmds_t DaemonForkServerPoll::ipc_cmds[] = {
-	{ MSG_WALLOPS,    &DaemonForkServerPoll::m_wallops,  2 },
-	{ MSG_REHASH,     &DaemonForkServerPoll::m_rehash,   0 },
-	{ MSG_DIE,        &DaemonForkServerPoll::m_die,      2 },
-	{ MSG_OPER,       &DaemonForkServerPoll::m_oper,     1 },
-	{ MSG_USER,       &DaemonForkServerPoll::m_user,     1 },
+	{ IPCMessage::WALLOPS, MSG_WALLOPS,    &DaemonForkServerPoll::m_wallops,  2 },
+	{ IPCMessage::REHASH,  MSG_REHASH,     &DaemonForkServerPoll::m_rehash,   0 },
+	{ IPCMessage::DIE,     MSG_DIE,        &DaemonForkServerPoll::m_die,      2 },
+	{ IPCMessage::OPER,    MSG_OPER,       &DaemonForkServerPoll::m_oper,     1 },
+	{ IPCMessage::USER,    MSG_USER,       &DaemonForkServerPoll::m_user,     1 },
+	{ IPCMessage::STATS,   "",             &DaemonForkServerPoll::m_stats,    ST_COUNT },
+	{ IPCMessage::STATS_REQUEST, MSG_STATS, &DaemonForkServerPoll::m_stats_request, 0 },
+	{ IPCMessage::STATS_END, "",           &DaemonForkServerPoll::m_stats_end, 0 },
+	{ IPCMessage::METRICS, "",             &DaemonForkServerPoll::m_metrics,  0 },
 };
 
 /** OPER nick
  *
  * A user on a minbif instance is now an IRC Operator
  */
-void DaemonForkServerPoll::m_oper(child_t* child, irc::Message m)
+void DaemonForkServerPoll::m_oper(child_t* child, const IPCMessage& m)
 {
 	if(child)
 		ipc_master_broadcast(m, child);
@@ -274,7 +628,7 @@ void DaemonForkServerPoll::m_oper(child_t* child, irc::Message m)
  *
  * Send a message to every minbif instances.
  */
-void DaemonForkServerPoll::m_wallops(child_t* child, irc::Message m)
+void DaemonForkServerPoll::m_wallops(child_t* child, const IPCMessage& m)
 {
 	if(child)
 		ipc_master_broadcast(m);
@@ -287,16 +641,16 @@ void DaemonForkServerPoll::m_wallops(child_t* child, irc::Message m)
  *
  * Reload configuration.
  */
-void DaemonForkServerPoll::m_rehash(child_t* child, irc::Message m)
+void DaemonForkServerPoll::m_rehash(child_t* child, const IPCMessage& m)
 {
 	rehash();
 }
 
-/** DIE
+/** DIE nick reason
  *
  * Close server.
  */
-void DaemonForkServerPoll::m_die(child_t* child, irc::Message m)
+void DaemonForkServerPoll::m_die(child_t* child, const IPCMessage& m)
 {
 	if(child)
 		ipc_master_broadcast(m);
@@ -312,7 +666,7 @@ void DaemonForkServerPoll::m_die(child_t* child, irc::Message m)
  *
  * New minbif instance tells his username.
  */
-void DaemonForkServerPoll::m_user(child_t* child, irc::Message m)
+void DaemonForkServerPoll::m_user(child_t* child, const IPCMessage& m)
 {
 	if (child)
 	{
@@ -320,104 +674,457 @@ void DaemonForkServerPoll::m_user(child_t* child, irc::Message m)
 		/* Disconnect any other minbif instance logged on the same user. */
 		for(vector<child_t*>::iterator it = childs.begin(); it != childs.end(); ++it)
 			if (*it != child && !strcasecmp((*it)->username.c_str(), child->username.c_str()))
-				ipc_master_send(*it, irc::Message(MSG_DIE).addArg(child->username)
-						                          .addArg("You are logged from another location."));
+				ipc_master_send(*it, IPCMessage(IPCMessage::DIE).addArg(child->username)
+						                                .addArg("You are logged from another location."));
 	}
 }
 
-bool DaemonForkServerPoll::ipc_read(void* data)
+/** STATS nick pid rss cpu nicks channels accounts sendq in out
+ *
+ * A child sends its resources usage, or master gives the one of a child
+ * after a STATS_REQUEST.
+ */
+void DaemonForkServerPoll::m_stats(child_t* child, const IPCMessage& m)
 {
-	child_t* child = NULL;
-	if(data)
-		child = static_cast<child_t*>(data);
-
-	static char buf[512];
-	ssize_t r;
-	int fd;
 	if(child)
-		fd = child->fd;
-	else
-		fd = sock;
-	if((r = recv(fd, buf, sizeof buf - 1, MSG_PEEK)) <= 0)
-	{
-		if(r < 0 && sockerr_again())
-			return true;
-		if(child)
+		child->stats = m;
+	else if(irc)
+		irc->getUser()->send(irc::Message(RPL_STATSDEBUG).setSender(irc)
+				                                 .setReceiver(irc->getUser())
+								 .addArg("U")
+								 .addArg(format_stats(m)));
+}
+
+/** STATS_REQUEST
+ *
+ * A child asks for resources usage of every children.
+ */
+void DaemonForkServerPoll::m_stats_request(child_t* child, const IPCMessage& m)
+{
+	if(!child)
+		return;
+
+	for(vector<child_t*>::iterator it = childs.begin(); it != childs.end(); ++it)
+		if((*it)->stats.getType() == IPCMessage::STATS)
+			ipc_master_send(child, (*it)->stats);
+	ipc_master_send(child, stats_total());
+	ipc_master_send(child, IPCMessage(IPCMessage::STATS_END));
+}
+
+/** STATS_END
+ *
+ * End of the reply to a STATS_REQUEST.
+ */
+void DaemonForkServerPoll::m_stats_end(child_t* child, const IPCMessage& m)
+{
+	if(!child && irc)
+		irc->getUser()->send(irc::Message(RPL_ENDOFSTATS).setSender(irc)
+				                                 .setReceiver(irc->getUser())
+								 .addArg("U")
+								 .addArg("End of /STATS report"));
+}
+
+/** METRICS name value [name value...]
+ *
+ * A child sends its counters.
+ */
+void DaemonForkServerPoll::m_metrics(child_t* child, const IPCMessage& m)
+{
+	if(!child)
+		return;
+
+	child->metrics.clear();
+	for(size_t i = 0; i + 1 < m.countArgs(); i += 2)
+		child->metrics[m.getArg(i)] = strtoull(m.getArg(i + 1).c_str(), NULL, 10);
+}
+
+IPCMessage DaemonForkServerPoll::stats_total() const
+{
+	double total[ST_COUNT] = { 0 };
+	unsigned count = 0;
+
+	for(vector<child_t*>::const_iterator it = childs.begin(); it != childs.end(); ++it)
+		if((*it)->stats.getType() == IPCMessage::STATS)
 		{
-			b_log[W_INFO] << "IPC: a child left: " << strerror(errno);
-			for(vector<child_t*>::iterator it = childs.begin(); it != childs.end();)
-				if(child->fd == (*it)->fd)
-					it = childs.erase(it);
-				else
-					++it;
-
-			close(child->fd);
-			g_source_remove(child->read_id);
-			delete child->read_cb;
-			delete child;
+			for(size_t i = ST_RSS; i < ST_COUNT; ++i)
+				total[i] += strtod((*it)->stats.getArg(i).c_str(), NULL);
+			count++;
 		}
+
+	IPCMessage m(IPCMessage::STATS);
+	m.addArg("*total*").addArg(t2s(count));
+	for(size_t i = ST_RSS; i < ST_COUNT; ++i)
+		if(i == ST_MSGS_IN || i == ST_MSGS_OUT)
+			m.addArg(format_rate(total[i]));
 		else
-		{
-			b_log[W_INFO|W_SNO] << "IPC: master left: " << strerror(errno);
-			g_source_remove(read_id);
-			read_id = -1;
-			delete read_cb;
-			read_cb = NULL;
-			close(sock);
-			sock = -1;
-		}
+			m.addArg(t2s((unsigned long)total[i]));
+	return m;
+}
+
+bool DaemonForkServerPoll::ipc_push_stats(void*)
+{
+	if(!irc || !master)
+		return true;
+
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	unsigned long cpu = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000
+			  + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000;
+
+	/* Peak RSS, if /proc isn't available. */
+	unsigned long rss = ru.ru_maxrss, pages, resident;
+	std::ifstream statm("/proc/self/statm");
+	if(statm >> pages >> resident)
+		rss = resident * (sysconf(_SC_PAGESIZE) / 1024);
+
+	time_t now = time(NULL);
+	double elapsed = last_stats && now > last_stats ? now - last_stats : STATS_INTERVAL;
+	unsigned long received = irc->getReceivedCount();
+	unsigned long sent = irc->getUser()->getSentCount();
+	im::IM* im = irc->getIM();
+
+	IPCMessage m(IPCMessage::STATS);
+	m.addArg(irc->getUser()->getNickname())
+	 .addArg(t2s(getpid()))
+	 .addArg(t2s(rss))
+	 .addArg(t2s(cpu))
+	 .addArg(t2s(irc->countNicks()))
+	 .addArg(t2s(irc->countChannels()))
+	 .addArg(t2s(im ? im->getAccountsList().size() : 0))
+	 .addArg(t2s(irc->getSockWrap() ? irc->getSockWrap()->GetOutputQueueSize() : 0))
+	 .addArg(format_rate((received - last_received) / elapsed))
+	 .addArg(format_rate((sent - last_sent) / elapsed));
+
+	last_stats = now;
+	last_received = received;
+	last_sent = sent;
+
+	ipc_child_send(m);
+
+	Metrics::get("minbif_messages_total{direction=\"in\"}") = received;
+	Metrics::get("minbif_messages_total{direction=\"out\"}") = sent;
+
+	IPCMessage metrics(IPCMessage::METRICS);
+	const Metrics::values_t& values = Metrics::getAll();
+	for(Metrics::values_t::const_iterator it = values.begin(); it != values.end(); ++it)
+		metrics.addArg(it->first).addArg(t2s(it->second));
+	ipc_child_send(metrics);
+	return true;
+}
+
+bool DaemonForkServerPoll::stats_accept_cb(void*)
+{
+	int fd = accept(stats_sock, NULL, NULL);
+	if(fd < 0)
+		return true;
+
+	report_client_t* client = report_add_client(fd);
+	for(vector<child_t*>::iterator it = childs.begin(); it != childs.end(); ++it)
+		if((*it)->stats.getType() == IPCMessage::STATS)
+			client->response += format_stats((*it)->stats) + "\n";
+	client->response += format_stats(stats_total()) + "\n";
+
+	report_write(client);
+	return true;
+}
+
+void DaemonForkServerPoll::stats_close()
+{
+	while(!report_clients.empty())
+		report_remove_client(report_clients.front());
+
+	if(stats_read_id >= 0)
+		g_source_remove(stats_read_id);
+	stats_read_id = -1;
+	delete stats_read_cb;
+	stats_read_cb = NULL;
+	if(stats_sock >= 0)
+		close(stats_sock);
+	stats_sock = -1;
+}
+
+void DaemonForkServerPoll::metrics_listen(ConfigSection* section)
+{
+	int port = section->GetItem("metrics_port")->Integer();
+	string addr = section->GetItem("metrics_bind")->String();
+	struct addrinfo *res, hints;
+	unsigned int reuse_addr = 1;
+
+	if(!port)
+		return;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = PF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	if(getaddrinfo(addr.c_str(), t2s(port).c_str(), &hints, &res))
+	{
+		b_log[W_ERR] << "Could not parse address " << addr << ":" << port;
+		return;
+	}
+
+	metrics_sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+	if(metrics_sock >= 0)
+	{
+		setsockopt(metrics_sock, SOL_SOCKET, SO_REUSEADDR, &reuse_addr, sizeof reuse_addr);
+		fcntl(metrics_sock, F_SETFD, FD_CLOEXEC);
+		sock_make_nonblocking(metrics_sock);
+	}
+
+	if(metrics_sock < 0 ||
+	   bind(metrics_sock, res->ai_addr, res->ai_addrlen) < 0 ||
+	   listen(metrics_sock, 5) < 0)
+	{
+		b_log[W_ERR] << "Unable to listen on " << addr << ":" << port << ": " << strerror(errno);
+		metrics_close();
+	}
+	else
+	{
+		metrics_read_cb = new CallBack<DaemonForkServerPoll>(this, &DaemonForkServerPoll::metrics_accept_cb);
+		metrics_read_id = glib_input_add(metrics_sock, (PurpleInputCondition)PURPLE_INPUT_READ,
+						 g_callback_input, metrics_read_cb);
+	}
+	freeaddrinfo(res);
+}
+
+bool DaemonForkServerPoll::metrics_accept_cb(void*)
+{
+	int fd = accept(metrics_sock, NULL, NULL);
+	if(fd < 0)
+		return true;
+
+	report_client_t* client = report_add_client(fd);
+	client->read_cb = new CallBack<DaemonForkServerPoll>(this, &DaemonForkServerPoll::metrics_read, client);
+	client->read_id = glib_input_add(fd, (PurpleInputCondition)PURPLE_INPUT_READ,
+					 g_callback_input, client->read_cb);
+	return true;
+}
+
+bool DaemonForkServerPoll::metrics_read(void* data)
+{
+	report_client_t* client = static_cast<report_client_t*>(data);
+	char buf[1024];
+	ssize_t r = read(client->fd, buf, sizeof buf);
+
+	if(r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return true;
+	if(r <= 0 || client->request.size() + r > 8192)
+	{
+		report_remove_client(client);
 		return false;
 	}
 
-	buf[r] = 0;
-	char* eol;
-	if(!(eol = strstr(buf, "\r\n")))
+	client->request.append(buf, r);
+	if(client->request.find("\r\n\r\n") == string::npos &&
+	   client->request.find("\n\n") == string::npos)
 		return true;
+
+	if(client->request.compare(0, 13, "GET /metrics ") == 0 ||
+	   client->request.compare(0, 6, "GET / ") == 0)
+	{
+		string body = metrics_format();
+		client->response = "HTTP/1.0 200 OK\r\n"
+				   "Content-Type: text/plain; version=0.0.4\r\n"
+				   "Content-Length: " + t2s(body.size()) + "\r\n"
+				   "Connection: close\r\n\r\n" + body;
+	}
 	else
-		r = eol - buf + 2;
+		client->response = "HTTP/1.0 404 Not Found\r\nConnection: close\r\n\r\n";
 
-	if(recv(fd, buf, r, 0) != r)
-		return false;
-	buf[r - 2] = 0;
+	/* Nothing more is expected from the client. */
+	g_source_remove(client->read_id);
+	client->read_id = -1;
 
-	irc::Message m = irc::Message::parse(buf);
+	report_write(client);
+	return false;
+}
 
-	unsigned i = 0;
-	for(; i < (sizeof ipc_cmds / sizeof *ipc_cmds) && m.getCommand() != ipc_cmds[i].cmd; ++i)
-		;
+DaemonForkServerPoll::report_client_t* DaemonForkServerPoll::report_add_client(int fd)
+{
+	/* Forget the oldest client, which is probably stuck. */
+	if(report_clients.size() >= REPORT_MAX_CLIENTS)
+		report_remove_client(report_clients.front());
 
-	if(i >= (sizeof ipc_cmds / sizeof *ipc_cmds))
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	sock_make_nonblocking(fd);
+
+	report_client_t* client = new report_client_t();
+	client->fd = fd;
+	client->read_id = -1;
+	client->read_cb = NULL;
+	client->write_id = -1;
+	client->write_cb = NULL;
+	client->sent = 0;
+	report_clients.push_back(client);
+	return client;
+}
+
+bool DaemonForkServerPoll::report_write(void* data)
+{
+	report_client_t* client = static_cast<report_client_t*>(data);
+
+	while(client->sent < client->response.size())
 	{
-		b_log[W_WARNING] << "Received unknown command from IPC: " << buf;
-		return true;
+		ssize_t w = write(client->fd, client->response.data() + client->sent,
+				  client->response.size() - client->sent);
+		if(w < 0 && errno == EINTR)
+			continue;
+		if(w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			/* A slow reader must not block the master. */
+			if(client->write_id < 0)
+			{
+				client->write_cb = new CallBack<DaemonForkServerPoll>(this, &DaemonForkServerPoll::report_write, client);
+				client->write_id = glib_input_add(client->fd, (PurpleInputCondition)PURPLE_INPUT_WRITE,
+								  g_callback_input, client->write_cb);
+			}
+			return true;
+		}
+		if(w <= 0)
+			break;
+		client->sent += w;
 	}
 
-	if(m.countArgs() < ipc_cmds[i].min_args)
+	report_remove_client(client);
+	return false;
+}
+
+void DaemonForkServerPoll::report_remove_client(report_client_t* client)
+{
+	for(vector<report_client_t*>::iterator it = report_clients.begin(); it != report_clients.end();)
+		if(*it == client)
+			it = report_clients.erase(it);
+		else
+			++it;
+
+	if(client->read_id >= 0)
+		g_source_remove(client->read_id);
+	delete client->read_cb;
+	if(client->write_id >= 0)
+		g_source_remove(client->write_id);
+	delete client->write_cb;
+	close(client->fd);
+	delete client;
+}
+void DaemonForkServerPoll::metrics_close()
+{
+	while(!report_clients.empty())
+		report_remove_client(report_clients.front());
+
+	if(metrics_read_id >= 0)
+		g_source_remove(metrics_read_id);
+	metrics_read_id = -1;
+	delete metrics_read_cb;
+	metrics_read_cb = NULL;
+	if(metrics_sock >= 0)
+		close(metrics_sock);
+	metrics_sock = -1;
+}
+
+string DaemonForkServerPoll::metrics_format() const
+{
+	Metrics::values_t values = Metrics::getAll();
+
+	for(Metrics::values_t::const_iterator it = dead_metrics.begin(); it != dead_metrics.end(); ++it)
+		values[it->first] += it->second;
+
+	values["minbif_children"] = childs.size();
+	for(vector<child_t*>::const_iterator c = childs.begin(); c != childs.end(); ++c)
 	{
-		b_log[W_WARNING] << "Received malformated command from IPC: " << buf;
-		return true;
+		for(Metrics::values_t::const_iterator it = (*c)->metrics.begin(); it != (*c)->metrics.end(); ++it)
+			values[it->first] += it->second;
+
+		if((*c)->stats.getType() == IPCMessage::STATS)
+			values[Metrics::series("minbif_user_rss_bytes", "user", (*c)->stats.getArg(ST_USERNAME))]
+				+= strtoull((*c)->stats.getArg(ST_RSS).c_str(), NULL, 10) * 1024;
 	}
 
-	(this->*ipc_cmds[i].func)(child, m);
+	return Metrics::format(values);
+}
 
-	return true;
+void DaemonForkServerPoll::ipc_dispatch(child_t* child, const IPCMessage& m)
+{
+	unsigned i = 0;
+	for(; i < (sizeof ipc_cmds / sizeof *ipc_cmds) && m.getType() != ipc_cmds[i].type; ++i)
+		;
+
+	if(i >= (sizeof ipc_cmds / sizeof *ipc_cmds))
+		b_log[W_WARNING] << "Received unknown command from IPC: " << m.getType();
+	else if(m.countArgs() < ipc_cmds[i].min_args)
+		b_log[W_WARNING] << "Received malformated command from IPC: " << ipc_cmds[i].cmd;
+	else
+		(this->*ipc_cmds[i].func)(child, m);
+
+	/* A descriptor attached to the frame belongs to the dispatcher, so a
+	 * handler keeping it has to dup() it. */
+	if(m.getFD() >= 0)
+		close(m.getFD());
 }
 
-bool DaemonForkServerPoll::ipc_master_send(child_t* child, const irc::Message& m)
+void DaemonForkServerPoll::ipc_remove_child(child_t* child)
 {
-	if(!child)
-		return false;
+	/* Keep counters monotonic. */
+	for(Metrics::values_t::iterator it = child->metrics.begin(); it != child->metrics.end(); ++it)
+		dead_metrics[it->first] += it->second;
 
-	string msg = m.format();
-	if(write(child->fd, msg.c_str(), msg.size()) <= 0)
+	for(vector<child_t*>::iterator it = childs.begin(); it != childs.end();)
+		if(child == *it)
+			it = childs.erase(it);
+		else
+			++it;
+
+	g_source_remove(child->read_id);
+	delete child->read_cb;
+	delete child->ipc;
+	delete child;
+}
+
+bool DaemonForkServerPoll::ipc_read(void* data)
+{
+	child_t* child = static_cast<child_t*>(data);
+	IPCChannel* ipc = child ? child->ipc : master;
+	vector<IPCMessage> msgs;
+
+	/* Every complete frames are handled, even if the peer has left
+	 * just after sending them. */
+	bool alive = ipc->read(msgs);
+	if(child)
+		METRIC_ADD("minbif_ipc_frames_total{direction=\"in\"}", msgs.size());
+	for(vector<IPCMessage>::iterator m = msgs.begin(); m != msgs.end(); ++m)
+		ipc_dispatch(child, *m);
+
+	if(alive)
+		return true;
+
+	if(child)
 	{
-		b_log[W_ERR] << "Error while sending: " << strerror(errno);
-		return false;
+		b_log[W_INFO] << "IPC: a child left";
+		ipc_remove_child(child);
 	}
-	return true;
+	else
+	{
+		b_log[W_INFO|W_SNO] << "IPC: master left";
+		g_source_remove(master_read_id);
+		master_read_id = -1;
+		delete master_read_cb;
+		master_read_cb = NULL;
+		delete master;
+		master = NULL;
+	}
+	return false;
+}
+
+bool DaemonForkServerPoll::ipc_master_send(child_t* child, const IPCMessage& m)
+{
+	if(!child)
+		return false;
+
+	METRIC_INC("minbif_ipc_frames_total{direction=\"out\"}");
+	return child->ipc->send(m);
 }
 
-bool DaemonForkServerPoll::ipc_master_broadcast(const irc::Message& m, child_t* butone)
+bool DaemonForkServerPoll::ipc_master_broadcast(const IPCMessage& m, child_t* butone)
 {
 	bool ret = false;
 	for(vector<child_t*>::iterator it = childs.begin(); it != childs.end(); ++it)
@@ -426,26 +1133,34 @@ bool DaemonForkServerPoll::ipc_master_broadcast(const irc::Message& m, child_t*
 	return ret;
 }
 
-bool DaemonForkServerPoll::ipc_child_send(const irc::Message& m)
+bool DaemonForkServerPoll::ipc_child_send(const IPCMessage& m)
 {
-	if(sock < 0)
+	if(!master)
 		return false;
 
-	string msg = m.format();
-	if(write(sock, msg.c_str(), msg.size()) <= 0)
-	{
-		b_log[W_ERR] << "Error while sending: " << strerror(errno);
-		return false;
-	}
-	return true;
+	return master->send(m);
 }
 
 bool DaemonForkServerPoll::ipc_send(const irc::Message& m)
 {
+	unsigned i = 0;
+	for(; i < (sizeof ipc_cmds / sizeof *ipc_cmds) && m.getCommand() != ipc_cmds[i].cmd; ++i)
+		;
+
+	if(i >= (sizeof ipc_cmds / sizeof *ipc_cmds))
+	{
+		b_log[W_WARNING] << "Unable to send command through IPC: " << m.getCommand();
+		return false;
+	}
+
+	IPCMessage msg(ipc_cmds[i].type);
+	for(size_t j = 0; j < m.countArgs(); ++j)
+		msg.addArg(m.getArg(j));
+
 	if(irc)
-		return ipc_child_send(m);
+		return ipc_child_send(msg);
 	else
-		return ipc_master_broadcast(m);
+		return ipc_master_broadcast(msg);
 }
 
 void DaemonForkServerPoll::log(size_t level, string msg) const
@@ -455,10 +1170,13 @@ void DaemonForkServerPoll::log(size_t level, string msg) const
 		cmd = MSG_PRIVMSG;
 
 	if(irc)
-		for(string line; (line = stringtok(msg, "\n\r")).empty() == false;)
+	{
+		StringTokenizer tok(msg, "\n\r");
+		for(string line; tok.next(line);)
 			irc->getUser()->send(irc::Message(cmd).setSender(irc)
 								     .setReceiver(irc->getUser())
 								     .addArg(line));
+	}
 	else if(!(level & W_SNO))
 		std::cout << msg << std::endl;
 }
@@ -468,7 +1186,7 @@ void DaemonForkServerPoll::rehash()
 	if(irc)
 		irc->rehash();
 	else
-		ipc_master_broadcast(irc::Message(MSG_REHASH));
+		ipc_master_broadcast(IPCMessage(IPCMessage::REHASH));
 }
 
 void DaemonForkServerPoll::kill(irc::IRC* irc)
@@ -481,6 +1199,22 @@ void DaemonForkServerPoll::kill(irc::IRC* irc)
 
 bool DaemonForkServerPoll::stopServer_cb(void*)
 {
+	/* Counters incremented since the last periodic frame, for example by
+	 * a failed login, would be lost with this process. */
+	if(irc && master)
+	{
+		ipc_push_stats(NULL);
+		for(unsigned tries = 0; master->getQueuedBytes() && tries < 10; ++tries)
+		{
+			fd_set fds;
+			struct timeval tv = { 0, 100000 };
+			FD_ZERO(&fds);
+			FD_SET(master->getFD(), &fds);
+			if(select(master->getFD() + 1, NULL, &fds, NULL, &tv) > 0)
+				master->flush();
+		}
+	}
+
 	delete irc;
 	irc = NULL;
 
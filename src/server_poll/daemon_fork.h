@@ -20,8 +20,12 @@
 #define SERVER_POLL_DAEMON_FORK_H
 
 #include <vector>
+#include <map>
+#include <sys/types.h>
 
 #include "poll.h"
+#include "ipc.h"
+#include "core/metrics.h"
 
 namespace irc {
 	class IRC;
@@ -30,50 +34,192 @@ namespace irc {
 
 class _CallBack;
 using std::vector;
+using std::map;
 
 class DaemonForkServerPoll : public ServerPoll
 {
 	/** IPC child data structure */
 	struct child_t
 	{
-		int fd;
+		IPCChannel* ipc;
 		int read_id;
 		_CallBack* read_cb;
 		string username;
+		pid_t pid;
+		IPCMessage stats;        /**< last STATS frame received */
+		Metrics::values_t metrics; /**< last METRICS frame received */
+	};
+
+	/** Client of the stats socket or of the metrics exporter. */
+	struct report_client_t
+	{
+		int fd;
+		int read_id;
+		_CallBack* read_cb;
+		int write_id;
+		_CallBack* write_cb;
+		string request;          /**< HTTP request, for the metrics exporter */
+		string response;
+		size_t sent;             /**< bytes of response already sent */
+	};
+
+	/** Maximum simultaneous clients of the stats socket and of the
+	 * metrics exporter. */
+	static const size_t REPORT_MAX_CLIENTS = 16;
+
+	/** Listening socket. */
+	struct listener_t
+	{
+		int sock;
+		int read_id;
+		_CallBack* read_cb;
+		string addr;
+	};
+
+	/** Connections accepted from a source address. */
+	struct rate_t
+	{
+		time_t start;            /**< beginning of the current period */
+		unsigned count;
 	};
 
-	/** IPC commands array. */
+	/** Seconds of a period of the connections rate limit. */
+	static const unsigned RATE_PERIOD = 60;
+
+	/** Milliseconds between two tries to upgrade while IPC channels are busy. */
+	static const unsigned UPGRADE_RETRY = 100;
+	static const unsigned UPGRADE_MAX_TRIES = 50;
+
+	/** Seconds between two STATS frames sent by a child. */
+	static const unsigned STATS_INTERVAL = 10;
+
+	/** IPC commands array.
+	 *
+	 * The IRC command name is used to convert messages given to
+	 * ipc_send(). See \ref IPC for the frame format.
+	 *
+	 * A file descriptor attached to a frame is closed once its handler
+	 * returns.
+	 */
 	static struct ipc_cmds_t
 	{
+		IPCMessage::type_t type;
 		const char* cmd;
-		void (DaemonForkServerPoll::*func) (child_t* child, irc::Message m);
+		void (DaemonForkServerPoll::*func) (child_t* child, const IPCMessage& m);
 		unsigned min_args;
 	} ipc_cmds[];
 
-	/** \page IPC
+	void m_wallops(child_t* child, const IPCMessage& m);     /**< IPC handler for the WALLOPS command. */
+	void m_rehash(child_t* child, const IPCMessage& m);      /**< IPC handler for the REHASH command. */
+	void m_die(child_t* child, const IPCMessage& m);         /**< IPC handler for the DIE command. */
+	void m_oper(child_t* child, const IPCMessage& m);        /**< IPC handler for the OPER command. */
+	void m_user(child_t* child, const IPCMessage& m);        /**< IPC handler for the USER command. */
+	void m_stats(child_t* child, const IPCMessage& m);       /**< IPC handler for the STATS command. */
+	void m_stats_request(child_t* child, const IPCMessage& m); /**< IPC handler for the STATS_REQUEST command. */
+	void m_stats_end(child_t* child, const IPCMessage& m);   /**< IPC handler for the STATS_END command. */
+	void m_metrics(child_t* child, const IPCMessage& m);     /**< IPC handler for the METRICS command. */
+
+	irc::IRC* irc;
+	int maxcon;
+	unsigned ratelimit;
+	vector<listener_t*> listeners;
+	map<string, rate_t> rates;
+	vector<child_t*> childs;
+
+	/** In a child, IPC channel to master. */
+	IPCChannel* master;
+	int master_read_id;
+	_CallBack* master_read_cb;
+
+	/** In a child, values at the last STATS frame. */
+	int stats_id;
+	_CallBack* stats_cb;
+	time_t last_stats;
+	unsigned long last_received, last_sent;
+
+	/** In master, UNIX socket giving the stats of every children. */
+	int stats_sock;
+	int stats_read_id;
+	_CallBack* stats_read_cb;
+	string stats_path;
+
+	/** In master, HTTP socket exporting metrics. */
+	int metrics_sock;
+	int metrics_read_id;
+	_CallBack* metrics_read_cb;
+
+	/** In master, clients of the stats socket and of the metrics exporter. */
+	vector<report_client_t*> report_clients;
+
+	/** In master, counters of children which have left. */
+	Metrics::values_t dead_metrics;
+
+	void metrics_listen(ConfigSection* section);
+	bool metrics_accept_cb(void*);
+	bool metrics_read(void* client);
+	void metrics_close();
+
+	/** Add a client of the stats socket or of the metrics exporter. */
+	report_client_t* report_add_client(int fd);
+
+	/** Send the rest of the response, without blocking.
 	 *
-	 * Daemon fork mode forks everytimes there is a new connection.
+	 * The client is removed once the response is sent.
+	 */
+	bool report_write(void* client);
+	void report_remove_client(report_client_t* client);
+
+	/** Counters of master and children, and gauges of children. */
+	string metrics_format() const;
+
+	/** In master, pending upgrade. */
+	int upgrade_id;
+	_CallBack* upgrade_cb;
+	unsigned upgrade_tries;
+
+	/** Try to execute the new binary.
 	 *
-	 * Communication between children and parent is made with two sockets
-	 * that are shared. Every commands are formatted like an IRC command,
-	 * and the irc::Message class can be used to parse or format commands.
-	 * Note that it is forbidden to set a sender or a receiver.
+	 * @return  true to be called again later.
+	 */
+	bool upgrade_exec(void*);
+
+	/** Take listening sockets and children given by the previous binary.
 	 *
+	 * @param inherited  list of fds set by upgrade_exec()
 	 */
-	void m_wallops(child_t* child, irc::Message m);     /**< IPC handler for the WALLOPS command. */
-	void m_rehash(child_t* child, irc::Message m);      /**< IPC handler for the REHASH command. */
-	void m_die(child_t* child, irc::Message m);         /**< IPC handler for the DIE command. */
-	void m_oper(child_t* child, irc::Message m);        /**< IPC handler for the OPER command. */
-	void m_user(child_t* child, irc::Message m);        /**< IPC handler for the USER command. */
+	void adopt(string inherited);
 
-	irc::IRC* irc;
-	int maxcon;
-	int sock;
-	int read_id;
-	_CallBack *read_cb;
-	vector<child_t*> childs;
+	/** Listen on every addresses of the bind configuration item. */
+	void listen_all(ConfigSection* section);
+
+	/** Stop listening, in a child or when leaving. */
+	void close_listeners();
+
+	/** Check the connections rate of the source address.
+	 *
+	 * @return  false if there are too many connections from it.
+	 */
+	bool check_rate(const string& host);
+
+	/** Handle a connection accepted by master.
+	 *
+	 * @return  false if we are in the new child.
+	 */
+	bool new_client(int fd, const string& host);
+
+	/** Child sends its resources usage to master. */
+	bool ipc_push_stats(void*);
+
+	/** Sum of STATS frames of every children. */
+	IPCMessage stats_total() const;
+
+	/** A client is connected to the stats socket. */
+	bool stats_accept_cb(void*);
+	void stats_close();
 
 	bool ipc_read(void*);
+	void ipc_dispatch(child_t* child, const IPCMessage& m);
+	void ipc_remove_child(child_t* child);
 
 	/** Master sends a IPC message to a child.
 	 *
@@ -81,7 +227,7 @@ class DaemonForkServerPoll : public ServerPoll
 	 * @param m  message to send
 	 * @return  true if the message has correctly been sent.
 	 */
-	bool ipc_master_send(child_t* child, const irc::Message& m);
+	bool ipc_master_send(child_t* child, const IPCMessage& m);
 
 	/** Master broadcasts a IPC message to every children.
 	 *
@@ -91,14 +237,14 @@ class DaemonForkServerPoll : public ServerPoll
 	 * @return  true if the message has correctly been sent to at least
 	 *               one child
 	 */
-	bool ipc_master_broadcast(const irc::Message& m, child_t* butone = NULL);
+	bool ipc_master_broadcast(const IPCMessage& m, child_t* butone = NULL);
 
 	/** Child send a message to his master.
 	 *
 	 * @param m  message to send
 	 * @return  true if the message has correctly been sent.
 	 */
-	bool ipc_child_send(const irc::Message& m);
+	bool ipc_child_send(const IPCMessage& m);
 
 public:
 
@@ -112,6 +258,11 @@ public:
 	bool stopServer_cb(void*);
 	bool ipc_send(const irc::Message& msg);
 
+	/** Execute the new binary, which takes the listening sockets and
+	 * the IPC channels of children. Children keep running.
+	 */
+	bool upgrade();
+
 	void log(size_t level, string log) const;
 };
 
@@ -62,7 +62,8 @@ void InetdServerPoll::log(size_t level, string msg) const
 	if(level & W_DEBUG)
 		cmd = MSG_PRIVMSG;
 
-	for(string line; (line = stringtok(msg, "\n\r")).empty() == false;)
+	StringTokenizer tok(msg, "\n\r");
+	for(string line; tok.next(line);)
 		irc->getUser()->send(irc::Message(cmd).setSender(irc)
 							     .setReceiver(irc->getUser())
 							     .addArg(line));
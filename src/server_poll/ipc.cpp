@@ -0,0 +1,361 @@
+/*
+ * Minbif - IRC instant messaging gateway
+ * Copyright(C) 2009 Romain Bignon
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "ipc.h"
+#include "core/callback.h"
+#include "core/log.h"
+#include "core/util.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#ifndef MSG_CMSG_CLOEXEC
+#define MSG_CMSG_CLOEXEC 0
+#endif
+
+IPCMessage::IPCMessage(type_t _type)
+	: type(_type),
+	  flags(0),
+	  fd(-1)
+{}
+
+IPCMessage& IPCMessage::addArg(const string& arg)
+{
+	args.push_back(arg);
+	return *this;
+}
+
+string IPCMessage::getArg(size_t i) const
+{
+	if(i >= args.size())
+		return "";
+	return args[i];
+}
+
+IPCMessage& IPCMessage::setFD(int _fd)
+{
+	fd = _fd;
+	if(fd >= 0)
+		flags |= FLAG_FD;
+	else
+		flags &= ~FLAG_FD;
+	return *this;
+}
+
+static void put_u32(string& s, uint32_t v)
+{
+	v = htonl(v);
+	s.append((const char*)&v, sizeof v);
+}
+
+static void put_u16(string& s, uint16_t v)
+{
+	v = htons(v);
+	s.append((const char*)&v, sizeof v);
+}
+
+static uint32_t get_u32(const char* p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof v);
+	return ntohl(v);
+}
+
+static uint16_t get_u16(const char* p)
+{
+	uint16_t v;
+	memcpy(&v, p, sizeof v);
+	return ntohs(v);
+}
+
+string IPCMessage::format() const
+{
+	size_t len = 0;
+	for(vector<string>::const_iterator it = args.begin(); it != args.end(); ++it)
+		len += 4 + it->size();
+
+	string frame;
+	frame.reserve(HEADER_SIZE + len);
+	put_u32(frame, len);
+	put_u16(frame, type);
+	put_u16(frame, flags);
+	for(vector<string>::const_iterator it = args.begin(); it != args.end(); ++it)
+	{
+		put_u32(frame, it->size());
+		frame += *it;
+	}
+	return frame;
+}
+
+ssize_t IPCMessage::parse(const char* buf, size_t len, IPCMessage& msg)
+{
+	if(len < HEADER_SIZE)
+		return 0;
+
+	size_t payload = get_u32(buf);
+	if(payload > MAX_PAYLOAD)
+		return -1;
+	if(len < HEADER_SIZE + payload)
+		return 0;
+
+	msg = IPCMessage((type_t)get_u16(buf + 4));
+	msg.flags = get_u16(buf + 6);
+
+	const char* p = buf + HEADER_SIZE;
+	const char* end = p + payload;
+	while(p < end)
+	{
+		if(end - p < 4)
+			return -1;
+		size_t arg_len = get_u32(p);
+		p += 4;
+		if(arg_len > (size_t)(end - p))
+			return -1;
+		msg.args.push_back(string(p, arg_len));
+		p += arg_len;
+	}
+
+	return HEADER_SIZE + payload;
+}
+
+IPCChannel::IPCChannel(int _fd)
+	: fd(_fd),
+	  write_id(-1),
+	  write_cb(NULL)
+{
+	write_cb = new CallBack<IPCChannel>(this, &IPCChannel::write_cb_run);
+}
+
+IPCChannel::~IPCChannel()
+{
+	if(write_id >= 0)
+		g_source_remove(write_id);
+	delete write_cb;
+
+	for(; !txqueue.empty(); txqueue.pop_front())
+		if(txqueue.front().fd >= 0)
+			close(txqueue.front().fd);
+	for(; !rxfds.empty(); rxfds.pop_front())
+		close(rxfds.front());
+
+	if(fd >= 0)
+		close(fd);
+}
+
+bool IPCChannel::send(const IPCMessage& msg)
+{
+	if(fd < 0)
+		return false;
+
+	pending_t p;
+	p.data = msg.format();
+	p.offset = 0;
+	p.fd = -1;
+
+	if(msg.getFD() >= 0 && (p.fd = dup(msg.getFD())) < 0)
+	{
+		b_log[W_ERR] << "IPC: Unable to duplicate fd: " << strerror(errno);
+		return false;
+	}
+
+	txqueue.push_back(p);
+	return flush();
+}
+
+bool IPCChannel::flush()
+{
+	bool ok = true;
+
+	while(!txqueue.empty())
+	{
+		pending_t& p = txqueue.front();
+		struct iovec iov;
+		struct msghdr mh;
+		char cbuf[CMSG_SPACE(sizeof(int))];
+
+		iov.iov_base = const_cast<char*>(p.data.data() + p.offset);
+		iov.iov_len = p.data.size() - p.offset;
+		memset(&mh, 0, sizeof mh);
+		mh.msg_iov = &iov;
+		mh.msg_iovlen = 1;
+
+		if(p.fd >= 0)
+		{
+			memset(cbuf, 0, sizeof cbuf);
+			mh.msg_control = cbuf;
+			mh.msg_controllen = sizeof cbuf;
+
+			struct cmsghdr* cmsg = CMSG_FIRSTHDR(&mh);
+			cmsg->cmsg_level = SOL_SOCKET;
+			cmsg->cmsg_type = SCM_RIGHTS;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+			memcpy(CMSG_DATA(cmsg), &p.fd, sizeof(int));
+		}
+
+		ssize_t r = sendmsg(fd, &mh, MSG_NOSIGNAL);
+		if(r < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			if(errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+
+			b_log[W_ERR] << "IPC: Error while sending: " << strerror(errno);
+			ok = false;
+			for(; !txqueue.empty(); txqueue.pop_front())
+				if(txqueue.front().fd >= 0)
+					close(txqueue.front().fd);
+			break;
+		}
+
+		/* The fd has been sent with the first bytes. */
+		if(p.fd >= 0)
+		{
+			close(p.fd);
+			p.fd = -1;
+		}
+
+		p.offset += r;
+		if(p.offset >= p.data.size())
+			txqueue.pop_front();
+	}
+
+	if(txqueue.empty())
+	{
+		if(write_id >= 0)
+		{
+			g_source_remove(write_id);
+			write_id = -1;
+		}
+	}
+	else if(write_id < 0)
+		write_id = glib_input_add(fd, (PurpleInputCondition)PURPLE_INPUT_WRITE,
+					  g_callback_input, write_cb);
+
+	return ok;
+}
+
+bool IPCChannel::write_cb_run(void*)
+{
+	flush();
+	return true;
+}
+
+bool IPCChannel::read(vector<IPCMessage>& msgs)
+{
+	static char buf[64 * 1024];
+	char cbuf[CMSG_SPACE(sizeof(int) * 16)];
+	bool alive = true;
+
+	/* Drain the socket. */
+	while(fd >= 0)
+	{
+		struct iovec iov;
+		struct msghdr mh;
+
+		iov.iov_base = buf;
+		iov.iov_len = sizeof buf;
+		memset(&mh, 0, sizeof mh);
+		mh.msg_iov = &iov;
+		mh.msg_iovlen = 1;
+		mh.msg_control = cbuf;
+		mh.msg_controllen = sizeof cbuf;
+
+		ssize_t r = recvmsg(fd, &mh, MSG_CMSG_CLOEXEC);
+		if(r < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			if(errno != EAGAIN && errno != EWOULDBLOCK)
+				alive = false;
+			break;
+		}
+
+		for(struct cmsghdr* cmsg = CMSG_FIRSTHDR(&mh); cmsg; cmsg = CMSG_NXTHDR(&mh, cmsg))
+			if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+			{
+				size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+				for(size_t i = 0; i < n; ++i)
+				{
+					int passed;
+					memcpy(&passed, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+					rxfds.push_back(passed);
+				}
+			}
+
+		if(r == 0)
+		{
+			alive = false;
+			break;
+		}
+
+		rxbuf.append(buf, r);
+
+		/* Nothing more to read. */
+		if((size_t)r < sizeof buf)
+			break;
+	}
+
+	size_t offset = 0;
+	while(offset < rxbuf.size())
+	{
+		IPCMessage m;
+		ssize_t n = IPCMessage::parse(rxbuf.data() + offset, rxbuf.size() - offset, m);
+		if(n == 0)
+			break;
+		if(n < 0)
+		{
+			b_log[W_ERR] << "IPC: Received an invalid frame";
+			alive = false;
+			break;
+		}
+
+		if(m.flags & IPCMessage::FLAG_FD)
+		{
+			if(rxfds.empty())
+			{
+				b_log[W_ERR] << "IPC: Received a frame without its fd";
+				alive = false;
+				break;
+			}
+			m.fd = rxfds.front();
+			rxfds.pop_front();
+		}
+
+		msgs.push_back(m);
+		offset += n;
+	}
+	rxbuf.erase(0, offset);
+
+	return alive;
+}
+
+size_t IPCChannel::getQueuedBytes() const
+{
+	size_t len = 0;
+	for(std::deque<pending_t>::const_iterator it = txqueue.begin(); it != txqueue.end(); ++it)
+		len += it->data.size() - it->offset;
+	return len;
+}
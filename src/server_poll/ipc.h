@@ -0,0 +1,173 @@
+/*
+ * Minbif - IRC instant messaging gateway
+ * Copyright(C) 2009 Romain Bignon
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef SERVER_POLL_IPC_H
+#define SERVER_POLL_IPC_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <stdint.h>
+
+using std::string;
+using std::vector;
+
+class _CallBack;
+
+/** \page IPC
+ *
+ * Daemon fork mode forks everytimes there is a new connection.
+ *
+ * Communication between children and parent is made with a pair of
+ * UNIX sockets. Every message is sent in a frame:
+ *
+ * <pre>
+ * uint32_t length   size of payload, in network byte order
+ * uint16_t type     IPCMessage::type_t, in network byte order
+ * uint16_t flags    IPCMessage::FLAG_FD if a file descriptor is attached
+ * payload           arguments, each one is a uint32_t length in network
+ *                   byte order followed by the raw bytes
+ * </pre>
+ *
+ * An attached file descriptor is sent with SCM_RIGHTS along with the
+ * first byte of its frame.
+ */
+class IPCMessage
+{
+public:
+
+	enum type_t
+	{
+		NONE,
+		WALLOPS,        /**< nick message */
+		REHASH,         /**< */
+		DIE,            /**< nick reason */
+		OPER,           /**< nick */
+		USER,           /**< nick */
+		STATS,          /**< nick pid rss cpu nicks channels accounts sendq in out */
+		STATS_REQUEST,  /**< */
+		STATS_END,      /**< */
+		METRICS         /**< name value [name value...] */
+	};
+
+	static const uint16_t FLAG_FD = 1 << 0;
+	static const size_t HEADER_SIZE = 8;
+
+	/** Maximum payload size, larger frames are considered as a protocol error. */
+	static const size_t MAX_PAYLOAD = 1 << 20;
+
+	IPCMessage(type_t type = NONE);
+
+	type_t getType() const { return type; }
+
+	IPCMessage& addArg(const string& arg);
+	string getArg(size_t i) const;
+	size_t countArgs() const { return args.size(); }
+
+	/** Attach a file descriptor.
+	 *
+	 * It is duplicated by the kernel in the peer process, and is
+	 * still owned by the caller. In a received message, the fd
+	 * belongs to the receiver, which has to close it.
+	 */
+	IPCMessage& setFD(int fd);
+	int getFD() const { return fd; }
+
+	/** Build the frame. */
+	string format() const;
+
+	/** Parse a frame.
+	 *
+	 * @param buf  received bytes
+	 * @param len  size of buffer
+	 * @param msg  set to the parsed message
+	 * @return  number of bytes used, 0 if the frame is not complete
+	 *          yet, or -1 if the frame is invalid.
+	 */
+	static ssize_t parse(const char* buf, size_t len, IPCMessage& msg);
+
+private:
+
+	type_t type;
+	uint16_t flags;
+	vector<string> args;
+	int fd;
+
+	friend class IPCChannel;
+};
+
+/** One end of an IPC socket.
+ *
+ * Frames are queued and sent when the socket is writable. Received
+ * bytes are kept until their frame is complete.
+ */
+class IPCChannel
+{
+	struct pending_t
+	{
+		string data;
+		size_t offset;
+		int fd;          /**< duplicated fd to send with data, -1 if none */
+	};
+
+	int fd;
+	int write_id;
+	_CallBack* write_cb;
+
+	string rxbuf;
+	std::deque<int> rxfds;
+	std::deque<pending_t> txqueue;
+
+	bool write_cb_run(void*);
+
+	IPCChannel(const IPCChannel&);
+	IPCChannel& operator=(const IPCChannel&);
+
+public:
+
+	/** @param fd  a non-blocking UNIX socket. It is closed with the channel. */
+	IPCChannel(int fd);
+	~IPCChannel();
+
+	int getFD() const { return fd; }
+
+	/** Queue a message and try to send it.
+	 *
+	 * @return  false if the channel is broken.
+	 */
+	bool send(const IPCMessage& msg);
+
+	/** Send queued frames. */
+	bool flush();
+
+	/** Read every available bytes, and extract complete frames.
+	 *
+	 * @param msgs  received messages are appended to this vector
+	 * @return  false when the peer has left or has sent an invalid
+	 *          frame; messages read before are still returned.
+	 */
+	bool read(vector<IPCMessage>& msgs);
+
+	/** Bytes waiting to be sent. */
+	size_t getQueuedBytes() const;
+
+	/** Are there neither partial frames received nor frames to send? */
+	bool isIdle() const { return txqueue.empty() && rxbuf.empty() && rxfds.empty(); }
+};
+
+#endif /* SERVER_POLL_IPC_H */
@@ -63,6 +63,12 @@ public:
 	virtual void rehash() = 0;
 	virtual bool ipc_send(const irc::Message& m) { return false; }
 
+	/** Replace the running binary without closing connections.
+	 *
+	 * @return  false if it isn't supported by this server poll.
+	 */
+	virtual bool upgrade() { return false; }
+
 	virtual void log(size_t level, string string) const = 0;
 };
 
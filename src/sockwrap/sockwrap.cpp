@@ -17,6 +17,7 @@
  */
 
 #include <unistd.h>
+#include <sys/ioctl.h>
 
 #include "sockwrap.h"
 #include "sockwrap_plain.h"
@@ -129,5 +130,15 @@ string SockWrapper::GetClientUsername()
 	return "";
 }
 
+size_t SockWrapper::GetOutputQueueSize() const
+{
+#ifdef TIOCOUTQ
+	int queued;
+	if (ioctl(send_fd, TIOCOUTQ, &queued) == 0 && queued > 0)
+		return queued;
+#endif
+	return 0;
+}
+
 };
 
@@ -58,6 +58,9 @@ namespace sock
 		virtual int AttachCallback(PurpleInputCondition cond, _CallBack* cb);
 		virtual string GetClientUsername();
 
+		/** Bytes written but not yet sent by the kernel. */
+		size_t GetOutputQueueSize() const;
+
 	protected:
 		int recv_fd, send_fd;
 		bool sock_ok;